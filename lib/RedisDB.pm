@@ -7,14 +7,17 @@ our $VERSION = "2.57";
 $VERSION = eval $VERSION;
 
 use RedisDB::Error;
+use RedisDB::KeyMap;
+use RedisDB::KeySpec;
 use RedisDB::Parser;
 use IO::Socket::IP;
 use IO::Socket::UNIX;
-use Socket qw(MSG_DONTWAIT MSG_NOSIGNAL SO_RCVTIMEO SO_SNDTIMEO);
+use Socket qw(MSG_DONTWAIT MSG_NOSIGNAL SO_RCVTIMEO SO_SNDTIMEO SOL_SOCKET SO_KEEPALIVE IPPROTO_TCP);
 use POSIX qw(:errno_h);
 use Config;
 use Carp;
 use Try::Tiny;
+use Time::HiRes ();
 use Encode qw();
 use URI;
 use URI::redis;
@@ -79,6 +82,30 @@ A Redis URL as described in L<URI::redis>.
 You cannot use C<url> together with any of C<host>, C<port>, C<path>,
 C<password>, C<database>.
 
+=item endpoints
+
+list of servers of a master/replica group that is not managed by sentinel.
+Every element is either a "host:port" string or a hash with "host" and "port"
+elements. Every time the client (re)connects, it sends ROLE command to all
+endpoints concurrently and connects to the master. If several servers claim to
+be masters, e.g. the old master after manual promotion of a replica, the one
+with the most replicas is chosen. Replies to ROLE are waited for not longer
+than I<timeout>, or 1 second if it is not set. If the server replies with
+READONLY error, which happens if the master was demoted, the client
+reconnects and probes the endpoints again before sending the next command,
+I<execute> and wrapper methods without callback also resend the command that
+got the error. You cannot use C<endpoints> together with C<host>, C<port>,
+C<path>, and C<url>.
+
+=item read_from_replicas
+
+if set together with I<endpoints>, read-only commands invoked using
+I<execute> or wrapper methods without callback are sent to one of the
+connected replicas found while probing the endpoints. Replicas replicate
+asynchronously, so the data may be slightly outdated. If the replica is not
+available, the command is sent to the master. Commands inside transactions
+and commands sent with I<send_command> always go to the master.
+
 =item raise_error
 
 By default if redis-server returned error reply, or there was a connection
@@ -95,6 +122,25 @@ L<RedisDB::Error::EAGAIN> error object depending on L</raise_error> setting.
 Note, that some OSes do not support SO_RCVTIMEO, and SO_SNDTIMEO socket
 options, in this case timeout will not work.
 
+By default after a timeout the connection is closed and all commands waiting
+for replies get an error, so a short latency spike on the server causes
+reconnects of all clients. See I<soft_timeout>.
+
+=item soft_timeout
+
+if set, a timeout doesn't close the connection. Instead, the oldest command
+waiting for the reply gets L<RedisDB::Error::EAGAIN> error, and its reply is
+discarded when it arrives, so the following replies are matched with their
+commands. Every timeout fails one command, so I<get_reply> and I<mainloop>
+keep waiting for the remaining replies. Commands inside transactions and in
+the subscription loop are not affected, timeouts there close the connection.
+
+=item max_abandoned
+
+maximum number of timed out commands whose replies are still expected, if
+one more command times out, the connection is closed as without
+I<soft_timeout>. Default is 10.
+
 =item utf8
 
 Assume that all data on the server encoded in UTF-8. As result all strings will
@@ -112,6 +158,128 @@ by default I<new> establishes a connection to the server. If this parameter is
 set, then connection will be established only when you will send first command
 to the server.
 
+=item near_cache
+
+L<RedisDB::NearCache> object. If specified, I<get> and I<hget> methods invoked
+without callback first check if the value is in the cache and only send
+command to the server if it is not, the value received from the server is
+stored in the cache. Values are cached separately for every server and
+database. Keys modified by commands sent through the object are removed from
+the cache, including destinations of the STORE options of SORT and GEORADIUS,
+and FLUSHDB, FLUSHALL, and SWAPDB clear the whole cache, so the process always
+sees its own writes. The cache is not used
+inside transactions, while keys are watched, and with I<endpoints>.
+
+=item spool
+
+L<RedisDB::Spool> object. If specified and connection to the server can't be
+established or was lost, commands listed as eligible for the spool are
+appended to the spool file and "SPOOLED" is returned as the reply instead of
+an error. The client makes a single connection attempt for such commands
+regardless of I<reconnect_attempts>. While the spool is not empty, eligible
+commands are appended to it as well, so they are executed in order. See
+L</"$self-E<gt>drain_spool">.
+
+=item value_codec
+
+codec object used to encode values before sending them to the server and
+decode values in the replies, e.g. L<RedisDB::DictCodec>. The object must have
+I<encode> and I<decode> methods. Values are encoded in the arguments of SET,
+SETNX, GETSET, SETEX, PSETEX, MSET, MSETNX, HSET, HMSET, and HSETNX commands,
+and decoded in the replies to GET, GETSET, HGET, MGET, HMGET, HVALS, and
+HGETALL. Values of other commands are passed as is. Can't be used together
+with I<utf8> option, encode strings yourself before passing them to redis.
+
+=item admission
+
+L<RedisDB::Admission> object. It limits the number of commands sent to the
+server and not replied yet, adapting the limit to the observed latency, and
+commands exceeding the limit get L<RedisDB::Error::OVERLOADED> error without
+being sent to the server. The object may be shared by many connections.
+
+=item profiler
+
+L<RedisDB::Profiler> object. If specified, time till the reply and the size of
+the request and the reply are recorded for every command together with the
+perl call site that sent the command.
+
+=item deferred_callbacks
+
+by default callbacks are invoked by the parser as soon as the reply is
+parsed. If a callback sends a new command, I<send_command> reads and parses
+available data, which invokes more callbacks recursively, so under a heavy
+pipelined load the stack grows and the latency becomes unpredictable. If this
+parameter is set, the parser only queues the replies, and callbacks are
+invoked one after another once the received data has been parsed. Commands
+sent by the callbacks read new data, but their replies are queued and
+processed by the same loop. Callbacks are still invoked in the order the
+commands were sent.
+
+=item on_batch
+
+callback that is invoked after callbacks of all replies parsed from the data
+received by one read from the socket. The first argument is the RedisDB
+object, the second is a reference to the array of the replies in the order
+they were received. Useful to process pipelined replies in bulk. Implies
+I<deferred_callbacks>.
+
+=item key_sampler
+
+L<RedisDB::KeySampler> object. If specified, keys accessed by read and write
+commands are sampled together with the sizes of the values, and the sample
+can be replayed through simulated caches of different sizes to find out how
+much memory is needed for the desired hit rate.
+
+=item key_map
+
+L<RedisDB::KeyMap> object. If specified, registered long prefixes of the keys
+in the arguments of the commands are replaced with short codes, and the codes
+in the keys returned by KEYS, SCAN, and similar commands are replaced back
+with the prefixes, saving memory on the server for applications with long
+repetitive key names.
+
+=item retry
+
+if set, commands that failed because of a transient condition on the server
+are sent again after a delay. The value is either a true scalar to use the
+defaults, or a hash with the following elements:
+
+=over 4
+
+=item errors
+
+list of error prefixes that are considered transient. Default is LOADING
+(server is loading the dataset), BUSY (a script is running), TRYAGAIN (keys
+are being migrated), CLUSTERDOWN, and MASTERDOWN.
+
+=item deadline
+
+maximum time in seconds since the command has been sent during which it may
+be retried, after that the last error is returned. Default is 10.
+
+=item base_delay, max_delay
+
+delay before the first retry, the delay doubles with every attempt up to
+I<max_delay>. A random jitter of up to the half of the delay is subtracted, so
+clients don't retry in lockstep. Defaults are 0.05 and 1 second.
+
+=back
+
+Only the commands that got a transient error are retried, if the command was
+sent as a part of the pipeline, other commands are not sent again, and
+replies are still returned by I<get_reply> in the order the commands were
+sent. Failed commands are sent again together in one batch, in the order they
+were originally sent, and the delay is kept for the connection, it grows with
+every batch till a retried command succeeds. Commands sent by the application
+while the retries are waiting are not delayed, so they may be executed before
+the retried ones. Callbacks are invoked when the final reply is received.
+Commands inside transactions and during WATCH are not retried.
+
+A retried write sent with I<send_durable> is executed after the WAIT command
+of its group, so WAIT doesn't confirm it. The callback of such write is
+invoked when the final reply is received, and the achieved durability is
+undefined.
+
 =item reconnect_attempts
 
 this parameter allows you to specify how many attempts to (re)connect to the
@@ -124,6 +292,43 @@ module waits some time before every new attempt to connect. Delay increases
 each time. This parameter allows you to specify maximum delay between attempts
 to reconnect. Default value is 10.
 
+=item keepalive
+
+enable TCP keepalive on the connection, so a server that disappeared without
+closing the connection, e.g. because the host crashed or the network was
+partitioned, is noticed while the client waits for a reply. The value is the
+number of seconds after which an idle connection to an unresponsive server
+is considered dead, or a hash with I<idle>, I<interval>, and I<count>
+elements that are used as TCP_KEEPIDLE, TCP_KEEPINTVL, and TCP_KEEPCNT socket
+options. A scalar value I<N> sets both idle time and probe interval to a
+third of I<N> seconds, but not less than 1 second, and the number of probes
+to 2. If the OS doesn't support tuning keepalive parameters, system defaults
+are used, and they normally are in hours.
+
+=item tcp_user_timeout
+
+maximum time in seconds that sent data may remain unacknowledged by the
+server before the connection is closed by the OS (TCP_USER_TIMEOUT option).
+Without it a request sent to a dead server sits in the kernel buffers for
+many minutes while TCP retransmits it. Keepalive probes are not sent while
+there is unacknowledged data, so this option complements I<keepalive>. Only
+supported on Linux, ignored on other systems.
+
+=item heartbeat
+
+interval in seconds. If the client is waiting for a reply and didn't receive
+anything from the server for this time, it sends PING to the server. The
+reply to PING is consumed internally. On a connection to a dead server the
+PING is never acknowledged, so together with I<tcp_user_timeout> this
+detects dead server even if the reply is legitimately taking long time, e.g.
+for a blocking command. See also L</"$self-E<gt>send_heartbeat"> for idle
+connections.
+
+When the OS closes the connection because of keepalive or user timeout, the
+client handles it as any other disconnect: the pending commands get an error,
+and the next command reconnects, or finds the new master if I<endpoints> are
+used.
+
 =item on_connect_error
 
 if module failed to establish connection with the server it will invoke this
@@ -155,6 +360,41 @@ sub new {
 
         $self->_parse_url( $self->{url} );
     }
+    if ( $self->{endpoints} ) {
+        if ( $self->{host} or $self->{port} or $self->{path} or $self->{url} ) {
+            croak "You can't specify \"endpoints\" together with \"host\", \"port\", \"path\", and \"url\"";
+        }
+        $self->{endpoints} = [
+            map {
+                my ( $host, $port ) = ref $_ ? @$_{qw(host port)} : /^(.+?)(?::([0-9]+))?$/;
+                { host => $host, port => $port || 6379 }
+            } @{ $self->{endpoints} }
+        ];
+        croak "\"endpoints\" list is empty" unless @{ $self->{endpoints} };
+    }
+    croak "You can't use \"value_codec\" together with \"utf8\""
+      if $self->{value_codec} and $self->{utf8};
+    if ( my $retry = $self->{retry} ) {
+        my %retry = (
+            errors     => [qw(LOADING BUSY TRYAGAIN CLUSTERDOWN MASTERDOWN)],
+            deadline   => 10,
+            base_delay => 0.05,
+            max_delay  => 1,
+            ( ref $retry ? %$retry : () ),
+        );
+        my $errors = join '|', map { quotemeta } @{ $retry{errors} };
+        $retry{_errors} = qr/^(?:$errors)\b/;
+        $self->{retry} = \%retry;
+    }
+    if ( my $keepalive = $self->{keepalive} ) {
+        unless ( ref $keepalive ) {
+            my $interval = int( $keepalive / 3 ) || 1;
+            $keepalive = { idle => $interval, interval => $interval, count => 2 };
+        }
+        $self->{keepalive} = $keepalive;
+    }
+    $self->{deferred_callbacks} = 1 if $self->{on_batch};
+    $self->{max_abandoned} = 10 unless defined $self->{max_abandoned};
     $self->{port} ||= 6379;
     $self->{host} ||= 'localhost';
     $self->{raise_error}    = 1 unless exists $self->{raise_error};
@@ -218,21 +458,198 @@ all replies.
 
 =cut
 
+# positions of values in the arguments of the commands that are encoded by
+# value_codec. "pairs" means every second argument starting from the second,
+# "hash" means every second argument starting from the third.
+my %CODEC_ARGS = (
+    SET    => [1],
+    SETNX  => [1],
+    GETSET => [1],
+    SETEX  => [2],
+    PSETEX => [2],
+    HSETNX => [2],
+    MSET   => 'pairs',
+    MSETNX => 'pairs',
+    HSET   => 'hash',
+    HMSET  => 'hash',
+);
+
+# commands that are sent to replicas if read_from_replicas is set
+my %READ_ONLY = map { $_ => 1 } qw(
+  BITCOUNT BITPOS DBSIZE EXISTS GET GETBIT GETRANGE HEXISTS HGET HGETALL HKEYS
+  HLEN HMGET HSCAN HSTRLEN HVALS KEYS LINDEX LLEN LRANGE MGET PTTL RANDOMKEY
+  SCAN SCARD SDIFF SINTER SISMEMBER SMEMBERS SRANDMEMBER SSCAN STRLEN SUNION TTL
+  TYPE ZCARD ZCOUNT ZLEXCOUNT ZRANGE ZRANGEBYLEX ZRANGEBYSCORE ZRANK ZREVRANGE
+  ZREVRANGEBYLEX ZREVRANGEBYSCORE ZREVRANK ZSCAN ZSCORE
+);
+
+# replies that are decoded by value_codec
+my %CODEC_REPLY = (
+    GET     => 'scalar',
+    GETSET  => 'scalar',
+    HGET    => 'scalar',
+    MGET    => 'list',
+    HMGET   => 'list',
+    HVALS   => 'list',
+    HGETALL => 'pairs',
+);
+
 sub execute {
     my $self = shift;
     croak "You can't use RedisDB::execute when you have replies to fetch."
       if $self->replies_to_fetch;
     croak "This function is not available in subscription mode." if $self->{_subscription_loop};
     my $cmd = uc shift;
+    return $self->_execute_cached( $cmd, @_ )
+      if $self->{near_cache}
+      and ( $cmd eq 'GET' and @_ == 1 or $cmd eq 'HGET' and @_ == 2 )
+      and not( $self->{_in_multi} or $self->{_watching} or $self->{endpoints} );
+
+    return $self->_execute_endpoints( $cmd, @_ )
+      if $self->{endpoints}
+      and not( $self->{_in_multi} or $self->{_watching} );
+
     $self->send_command( $cmd, @_ );
     return $self->get_reply;
 }
 
+# send read-only commands to a replica. If the master was demoted and replied
+# with READONLY error, find the new master and resend the command to it
+sub _execute_endpoints {
+    my ( $self, $cmd, @args ) = @_;
+
+    if ( $self->{read_from_replicas} and $READ_ONLY{$cmd} and my $replica = $self->_replica ) {
+        my $res = $replica->execute( $cmd, @args );
+        if ( ref $res eq 'RedisDB::Error::DISCONNECTED' or ref $res eq 'RedisDB::Error::EAGAIN' ) {
+            my $failed = delete $self->{_replica_endpoint};
+            delete $self->{_replica};
+            $self->{_replicas} = [ grep { $_ != $failed } @{ $self->{_replicas} } ];
+        }
+        else {
+            croak $res if _is_redisdb_error($res) and $self->{raise_error};
+            return $res;
+        }
+    }
+
+    my $res;
+    for ( 1 .. 2 ) {
+        local $self->{raise_error} = 0;
+        $self->send_command( $cmd, @args );
+        $res = $self->get_reply;
+        last unless _is_redisdb_error($res) and $res =~ /^READONLY/;
+        $self->{_readonly} = 1;
+    }
+    croak $res if _is_redisdb_error($res) and $self->{raise_error};
+    return $res;
+}
+
+# return connection to a replica, or undef if there are no known replicas
+sub _replica {
+    my $self = shift;
+    return $self->{_replica} if $self->{_replica};
+    my $replicas = $self->{_replicas} or return;
+    return unless @$replicas;
+    my $replica = $replicas->[ rand @$replicas ];
+    $self->{_replica_endpoint} = $replica;
+    return $self->{_replica} = RedisDB->new(
+        host        => $replica->{host},
+        port        => $replica->{port},
+        raise_error => 0,
+        lazy        => 1,
+        database    => $self->{database},
+        _inherited_options($self),
+    );
+}
+
+# options that are passed to the connections created on behalf of the user:
+# connections to the replicas, and connections to the nodes of the cluster
+my @INHERITED = qw(
+  password timeout utf8 value_codec connection_name retry keepalive
+  tcp_user_timeout heartbeat admission profiler deferred_callbacks on_batch
+  soft_timeout max_abandoned key_sampler key_map
+);
+
+sub _inherited_options {
+    my $params = shift;
+    return map { defined $params->{$_} ? ( $_ => $params->{$_} ) : () } @INHERITED;
+}
+
+# check if the value is in the near cache before sending GET or HGET to the server.
+# Entries are stored separately for every server and database
+sub _execute_cached {
+    my ( $self, $cmd, @args ) = @_;
+
+    my $cache = $self->{near_cache};
+    my $ns = ( $self->{path} || "$self->{host}:$self->{port}" ) . "/$self->{database}";
+    my @key = $self->{key_map} ? ( $self->{key_map}->encode( $args[0] ), @args[ 1 .. $#args ] ) : @args;
+    @key = map { Encode::encode( 'UTF-8', $_ ) } @key if $self->{utf8};
+    my @found = $cache->_get( $ns, @key );
+    if (@found) {
+        my $value = $found[0];
+        $value = Encode::decode( 'UTF-8', $value ) if $self->{utf8} and defined $value;
+        return $value;
+    }
+
+    my $generation = $cache->generation;
+    $self->send_command( $cmd, @args );
+    my $res = $self->get_reply;
+    unless ( _is_redisdb_error($res) ) {
+        my $value = $self->{utf8} && defined $res ? Encode::encode( 'UTF-8', $res ) : $res;
+        $cache->_set( $ns, $key[0], $key[1], $value, $generation );
+    }
+    return $res;
+}
+
+# commands that change whole databases, they clear the near cache
+my %FLUSHES = map { $_ => 1 } qw(FLUSHDB FLUSHALL SWAPDB);
+
+# commands that write to the key passed in the STORE or STOREDIST option
+my %STORE_OPTION = map { $_ => 1 } qw(SORT GEORADIUS GEORADIUSBYMEMBER);
+
+# remove the keys written by the command from the near cache when the command
+# is sent, and again when the reply is received, so the process reads its own
+# writes even if another process has cached the old value meanwhile. Commands
+# inside a transaction are executed by EXEC
+sub _invalidate_cached {
+    my ( $self, $command, $callback, @args ) = @_;
+    my ( @keys, $flush );
+    if ( $command eq 'EXEC' ) {
+        @keys  = @{ delete $self->{_multi_written} || [] };
+        $flush = delete $self->{_multi_flush};
+    }
+    elsif ( $command eq 'DISCARD' ) {
+        delete @$self{qw(_multi_written _multi_flush)};
+    }
+    else {
+        $flush = $FLUSHES{$command};
+        @keys = grep { defined } @args[ RedisDB::KeySpec::_key_indexes( $command, \@args ) ];
+        if ( $STORE_OPTION{$command} ) {
+            for my $i ( 0 .. $#args - 1 ) {
+                push @keys, $args[ $i + 1 ] if $args[$i] =~ /^STORE(?:DIST)?$/i;
+            }
+        }
+        if ( $self->{_in_multi} ) {
+            push @{ $self->{_multi_written} }, @keys;
+            $self->{_multi_flush} = 1 if $flush;
+            return $callback;
+        }
+    }
+    return $callback unless @keys or $flush;
+    @keys = map { Encode::encode( 'UTF-8', $_ ) } @keys if $self->{utf8};
+    my $cache = $self->{near_cache};
+    my $clear = $flush ? sub { $cache->flush } : sub { $cache->invalidate(@keys) };
+    $clear->();
+    return sub {
+        $clear->();
+        $callback->(@_);
+    };
+}
+
 sub _on_connect_error {
     my ( $self, $err ) = @_;
     my $server = $self->{path} || ("$self->{host}:$self->{port}");
     my $error_obj =
-      RedisDB::Error::DISCONNECTED->new("Couldn't connect to the redis server at $server: $!");
+      RedisDB::Error::DISCONNECTED->new("Couldn't connect to the redis server at $server: $err");
     die $error_obj;
 }
 
@@ -309,12 +726,18 @@ sub _connect {
             my $delay;
             while ( not $self->{_socket} and $attempts ) {
                 sleep $delay if $delay;
-                $self->{_socket} = IO::Socket::IP->new(
-                    PeerAddr => $self->{host},
-                    PeerPort => $self->{port},
-                    Proto    => 'tcp',
-                    ( $self->{timeout} ? ( Timeout => $self->{timeout} ) : () ),
-                ) or $error = $!;
+                my $no_master = $self->{endpoints} && $self->_discover_master;
+                if ($no_master) {
+                    $error = $no_master;
+                }
+                else {
+                    $self->{_socket} = IO::Socket::IP->new(
+                        PeerAddr => $self->{host},
+                        PeerPort => $self->{port},
+                        Proto    => 'tcp',
+                        ( $self->{timeout} ? ( Timeout => $self->{timeout} ) : () ),
+                    ) or $error = $!;
+                }
                 $delay = $delay ? ( 1 + rand ) * $delay : 1;
                 $delay = $self->{reconnect_delay_max} if $delay > $self->{reconnect_delay_max};
                 $attempts--;
@@ -389,9 +812,14 @@ sub _connect {
         };
     }
 
+    $self->_set_tcp_options
+      if not $self->{path} and ( $self->{keepalive} or $self->{tcp_user_timeout} );
+
     $self->{_in_connect}++;
     $self->_init_parser;
     $self->{_subscription_loop} = 0;
+    delete $self->{_heartbeats};
+    $self->{_last_write} = Time::HiRes::time();
     delete $self->{_server_version};
 
     # authenticate
@@ -420,6 +848,68 @@ sub _connect {
     return;
 }
 
+# TCP level options are not exported by Socket on all systems, on Linux use
+# values from the kernel headers
+my %TCP_OPT;
+for my $name (qw(TCP_KEEPIDLE TCP_KEEPINTVL TCP_KEEPCNT TCP_USER_TIMEOUT)) {
+    my $value = try { Socket->can($name) && Socket->can($name)->() };
+    $TCP_OPT{$name} = $value || ( $^O eq 'linux' ? {
+            TCP_KEEPIDLE     => 4,
+            TCP_KEEPINTVL    => 5,
+            TCP_KEEPCNT      => 6,
+            TCP_USER_TIMEOUT => 18,
+        }->{$name} : undef );
+}
+
+# enable keepalive and set user timeout on the socket. Failure to set an
+# option results in a warning, the connection is usable anyway.
+sub _set_tcp_options {
+    my $self   = shift;
+    my $socket = $self->{_socket};
+    my @options;
+    if ( my $keepalive = $self->{keepalive} ) {
+        push @options, [ SOL_SOCKET, SO_KEEPALIVE, 1, 'SO_KEEPALIVE' ];
+        for ( [ idle => 'TCP_KEEPIDLE' ], [ interval => 'TCP_KEEPINTVL' ], [ count => 'TCP_KEEPCNT' ] ) {
+            my ( $param, $name ) = @$_;
+            push @options, [ IPPROTO_TCP, $TCP_OPT{$name}, $keepalive->{$param}, $name ]
+              if $keepalive->{$param} and defined $TCP_OPT{$name};
+        }
+    }
+    if ( $self->{tcp_user_timeout} and $^O eq 'linux' ) {
+        push @options,
+          [ IPPROTO_TCP, $TCP_OPT{TCP_USER_TIMEOUT}, int( $self->{tcp_user_timeout} * 1000 ), 'TCP_USER_TIMEOUT' ];
+    }
+    for (@options) {
+        my ( $level, $option, $value, $name ) = @$_;
+        setsockopt( $socket, $level, $option, $value ) or warn "Can't set $name: $!\n";
+    }
+    return;
+}
+
+# wait till the socket becomes readable. If nothing was received during the
+# heartbeat interval send PING, so the OS notices if the server is dead.
+sub _heartbeat_wait {
+    my $self = shift;
+    return if $self->{_heartbeats} or $self->{_in_multi} or not $self->{_socket};
+    my $rin = '';
+    vec( $rin, fileno( $self->{_socket} ), 1 ) = 1;
+    my $ready = select( my $rout = $rin, undef, undef, $self->{heartbeat} );
+    $self->_send_ping unless $ready;
+    return;
+}
+
+sub _send_ping {
+    my $self = shift;
+    $self->{_heartbeats}++;
+
+    # in subscription mode the reply is ignored by get_reply
+    unless ( $self->{_subscription_loop} ) {
+        $self->{_parser}->push_callback( sub { $_[0]{_heartbeats}-- if $_[0]{_heartbeats} } );
+    }
+    $self->_write( $self->{_parser}->build_request('PING') );
+    return;
+}
+
 my $SET_NB   = 0;
 my $DONTWAIT = 0;
 
@@ -455,7 +945,7 @@ sub _recv_data_nb {
         elsif ( $buf ne '' ) {
 
             # received some data
-            $self->{_parser}->parse($buf);
+            $self->_parse( $buf, 1 );
         }
         else {
             delete $self->{_socket};
@@ -483,6 +973,86 @@ sub _recv_data_nb {
     return;
 }
 
+# pass received data to the parser. With deferred_callbacks the parser only
+# queues replies, and their callbacks are invoked from a loop after the data
+# has been parsed. If $nested is set and the callbacks are being dispatched
+# already, e.g. the data was read by send_command invoked from a callback,
+# the replies are left in the queue for the outer loop.
+sub _parse {
+    my ( $self, $data, $nested ) = @_;
+    return $self->{_parser}->parse($data) unless $self->{deferred_callbacks};
+    {
+        local $self->{_parsing} = 1;
+        my $queue = $self->{_deferred} ||= [];
+        my $count = @$queue;
+        $self->{_parser}->parse($data);
+        if ( $self->{on_batch} and @$queue > $count ) {
+            push @$queue, [ $self->{on_batch}, [ map { $_->[1] } @$queue[ $count .. $#$queue ] ] ];
+        }
+    }
+    $self->_dispatch unless $nested and $self->{_dispatching};
+    return;
+}
+
+sub _defer {
+    my ( $self, $callback ) = @_;
+    return sub {
+        my ( $redis, $reply ) = @_;
+        return $callback->(@_) unless $redis->{_parsing} or $redis->{_dispatching};
+        push @{ $redis->{_deferred} }, [ $callback, $reply ];
+    };
+}
+
+# invoke queued callbacks
+sub _dispatch {
+    my $self = shift;
+    local $self->{_dispatching} = 1;
+    while ( $self->{_deferred} and my $item = shift @{ $self->{_deferred} } ) {
+        $item->[0]->( $self, $item->[1] );
+    }
+    return;
+}
+
+# with soft_timeout remember the order of commands waiting for replies, so
+# on timeout the oldest command can be failed while its reply is expected
+sub _track {
+    my ( $self, $callback ) = @_;
+    my $slot = { callback => $callback };
+    push @{ $self->{_pending} }, $slot;
+    return sub {
+        my $redis   = $_[0];
+        my $pending = $redis->{_pending};
+        if ( $pending and @$pending and $pending->[0] == $slot ) {
+            shift @$pending;
+        }
+        elsif ($pending) {
+            @$pending = grep { $_ != $slot } @$pending;
+        }
+        if ( $slot->{abandoned} ) {
+            $redis->{_abandoned}-- if $redis->{_abandoned};
+            return;
+        }
+        $callback->(@_);
+    };
+}
+
+# fail the oldest command waiting for the reply, and discard the reply when it
+# arrives. If there are too many discarded replies expected, close the
+# connection. Returns false if the timeout should be handled as usual.
+sub _soft_timeout {
+    my ( $self, $error ) = @_;
+    return if $self->{_in_multi} or $self->{_watching} or $self->{_subscription_loop};
+    my ($slot) = grep { not $_->{abandoned} } @{ $self->{_pending} || [] } or return;
+    if ( ( $self->{_abandoned} || 0 ) >= $self->{max_abandoned} ) {
+        $self->_on_disconnect( 1, $error );
+        return 1;
+    }
+    $slot->{abandoned} = 1;
+    $self->{_abandoned}++;
+    $slot->{callback}->( $self, $error );
+    return 1;
+}
+
 sub _queue {
     my ( $self, $reply ) = @_;
     --$self->{_to_be_fetched};
@@ -514,13 +1084,14 @@ my $NOSIGNAL = try { MSG_NOSIGNAL } || 0;
 sub send_command {
     my $self = shift;
 
-    my $callback;
+    my ( $callback, $queued );
     if ( ref $_[-1] eq 'CODE' ) {
         $callback = pop;
     }
     else {
         ++$self->{_to_be_fetched};
         $callback = \&_queue;
+        $queued   = 1;
     }
 
     my $command = uc shift;
@@ -549,11 +1120,76 @@ sub send_command {
         $self->{connection_name} = $_[1];
     }
 
+    # replace long key prefixes with short codes
+    ( $callback, @_ ) = $self->{key_map}->_apply( $command, $callback, @_ ) if $self->{key_map};
+
+    # forget cached values of the keys modified by this client
+    $callback = $self->_invalidate_cached( $command, $callback, @_ )
+      if $self->{near_cache} and not $READ_ONLY{$command};
+
+    # compress values and decompress replies
+    if ( $self->{value_codec} and ( $CODEC_ARGS{$command} or $CODEC_REPLY{$command} ) ) {
+        ( $callback, @_ ) = $self->_apply_codec( $command, $callback, @_ );
+    }
+
+    # record accessed keys and sizes of the values as they are stored
+    $callback = $self->{key_sampler}->_wrap( $command, \@_, $callback )
+      if $self->{key_sampler} and not $self->{_in_multi};
+
+    # keep the order of writes, store the command in the spool if the spool is
+    # not empty and couldn't be drained
+    my $spool = $self->{spool} && $self->{spool}->eligible($command);
+    if ( $spool and $self->{spool}->pending ) {
+        return $self->_spool( undef, $command, $callback, @_ )
+          unless $self->{spool}->_drain_due and $self->drain_spool;
+    }
+
+    # don't send the command if there are too many commands in flight
+    if (    $self->{admission}
+        and not( $self->{_in_multi} or $self->{_watching} or $self->{_in_connect} )
+        and not $self->{_subscription_loop} )
+    {
+        my $res = $self->{admission}->_admit( $self, $command, $callback );
+        if ( not ref $res ) {
+
+            # the arguments and the callback have been processed already, so
+            # they are not passed through send_command again
+            push @{ $self->{_admission_queue} }, [ $command, $callback, @_ ];
+            return 1;
+        }
+        elsif ( _is_redisdb_error($res) ) {
+            $callback->( $self, $res );
+            return $res;
+        }
+        $callback = $res;
+    }
+
+    return $self->_send_admitted( $command, $callback, $queued, @_ );
+}
+
+# send the command after it has been admitted. The arguments and the callback
+# are already processed by the preceding steps of send_command
+sub _send_admitted {
+    my ( $self, $command, $callback, $queued, @args ) = @_;
+    my $spool = $self->{spool} && $self->{spool}->eligible($command);
+
+    # remember if the server replied with READONLY error, so the client
+    # finds the new master before sending the next command
+    if ( $self->{endpoints} ) {
+        $self->_check_readonly;
+        my $cb = $callback;
+        $callback = sub {
+            $_[0]->{_readonly} = 1 if _is_redisdb_error( $_[1] ) and $_[1] =~ /^READONLY/;
+            $cb->(@_);
+        };
+    }
+
     # if not yet connected to server, or if process was forked
     # reestablish connection
     unless ( $self->{_socket} and $self->{_pid} == $$ ) {
-        my $error = $self->_connect;
+        my $error = $spool ? $self->_spool_connect : $self->_connect;
         if ($error) {
+            return $self->_spool( $error, $command, $callback, @args ) if $spool;
             $callback->( $self, $error );
             return $error;
         }
@@ -561,22 +1197,406 @@ sub send_command {
 
     # Here we are reading received data and parsing it,
     # and at the same time checking if the connection is still alive
-    my $error = $self->_recv_data_nb;
+    my $error = $spool ? $self->_spool_connect : $self->_recv_data_nb;
     if ($error) {
+        return $self->_spool( $error, $command, $callback, @args ) if $spool;
         $callback->( $self, $error );
         return $error;
     }
+    $self->_send_retries if $self->{_retries} and not $self->{_in_connect};
 
-    $self->{_parser}->push_callback($callback);
-
-    my $request = $self->{_parser}->build_request( $command, @_ );
+    my $request = $self->{_parser}->build_request( $command, @args );
+    if (    $self->{retry}
+        and not( $self->{_in_multi} or $self->{_watching} or $self->{_in_connect} )
+        and not $self->{_subscription_loop} )
     {
-        local $SIG{PIPE} = 'IGNORE' unless $NOSIGNAL;
-        defined send( $self->{_socket}, $request, $NOSIGNAL )
-          or $self->_on_disconnect( 1,
-            RedisDB::Error::DISCONNECTED->new("Can't send request to server: $!") );
+        $callback = $self->_retry_callback( $command, $request, $callback, $queued, $self->_retry_state );
+    }
+    $self->{_parser}->push_callback( $self->_wrap_sent( $command, $request, $callback ) );
+    $self->_write($request);
+
+    return 1;
+}
+
+# send request to the server.
+# returns undef on success or RedisDB::Error if failed
+sub _write {
+    my ( $self, $request ) = @_;
+    local $SIG{PIPE} = 'IGNORE' unless $NOSIGNAL;
+    $self->{_last_write} = Time::HiRes::time() if $self->{heartbeat};
+    unless ( defined send( $self->{_socket}, $request, $NOSIGNAL ) ) {
+        my $error = RedisDB::Error::DISCONNECTED->new("Can't send request to server: $!");
+        $self->_on_disconnect( 1, $error );
+        return $error;
+    }
+    return;
+}
+
+# send commands that were queued by the admission controller while there is
+# room for them. If the connection was lost, pass the error to their callbacks.
+sub _send_admission_queue {
+    my ( $self, $reply ) = @_;
+    my $queue = $self->{_admission_queue};
+    if ( ref $reply eq 'RedisDB::Error::DISCONNECTED' ) {
+        delete $self->{_admission_queue};
+        $_->[1]->( $self, $reply ) for @$queue;
+        return;
+    }
+    while ( @$queue and $self->{admission}->_has_room($self) ) {
+        my ( $command, $callback, @args ) = @{ shift @$queue };
+        $callback = $self->{admission}->_admit( $self, $command, $callback );
+        $self->_send_admitted( $command, $callback, undef, @args );
+    }
+    return;
+}
+
+# drop the connection if the server replied with READONLY error and there are
+# no replies to wait for, so the endpoints are probed again on reconnect
+sub _check_readonly {
+    my $self = shift;
+    return unless $self->{_readonly} and $self->{_socket};
+    return if $self->{_in_multi} or $self->{_watching};
+    return if $self->{_parser} and $self->{_parser}->callbacks;
+    delete $self->{_readonly};
+    delete $self->{_socket};
+    return;
+}
+
+sub _retry_state {
+    my $self = shift;
+    return { deadline => Time::HiRes::time() + $self->{retry}{deadline} };
+}
+
+# return the time when the command should be sent again if the reply is a
+# transient error and the deadline has not passed yet, otherwise undef. All
+# failed commands are sent again in one batch, so they share the time and the
+# backoff, which grows with every batch till a retried command succeeds
+sub _retry_due {
+    my ( $self, $reply, $state ) = @_;
+    my $retry = $self->{retry} or return;
+    return unless _is_redisdb_error($reply) and $reply =~ $retry->{_errors};
+    my $due = $self->{_retry_due};
+    unless ($due) {
+        my $delay = $retry->{base_delay} * 2**( $self->{_retry_attempt} || 0 );
+        $delay = $retry->{max_delay} if $delay > $retry->{max_delay};
+        $delay -= rand( $delay / 2 );
+        $due = Time::HiRes::time() + $delay;
+    }
+    return if $due > $state->{deadline};
+    return $due;
+}
+
+# wrap callback, so the request is scheduled to be sent again if it got a
+# transient error. If the reply was supposed to be queued for get_reply, a
+# placeholder is queued instead, so replies are still returned in order
+sub _retry_callback {
+    my ( $self, $command, $request, $callback, $queued, $state, $slot ) = @_;
+    return sub {
+        my ( $redis, $reply ) = @_;
+        my $due = $redis->_retry_due( $reply, $state );
+        if ( defined $due ) {
+            if ( $queued and not $slot ) {
+                $slot = bless { done => 0 }, 'RedisDB::_Retry';
+                --$redis->{_to_be_fetched};
+                push @{ $redis->{_replies} }, $slot;
+            }
+            unless ( $redis->{_retry_due} ) {
+                $redis->{_retry_due} = $due;
+                $redis->{_retry_attempt}++;
+            }
+            $state->{retried} = 1;
+            push @{ $redis->{_retries} },
+              {
+                command  => $command,
+                request  => $request,
+                callback => $redis->_retry_callback( $command, $request, $callback, $queued, $state, $slot ),
+              };
+            return;
+        }
+        delete $redis->{_retry_attempt} if $state->{retried};
+        if ($slot) {
+
+            # let the callback chain process the reply, and catch it before
+            # it gets into the queue
+            local $redis->{_replies}       = [];
+            local $redis->{_to_be_fetched} = 1;
+            $callback->( $redis, $reply );
+            $slot->{reply} = $redis->{_replies}[0];
+            $slot->{done}  = 1;
+        }
+        else {
+            $callback->( $redis, $reply );
+        }
+    };
+}
+
+# wrap callback of the request that is about to be written to the socket, so
+# the reply is profiled, deferred and tracked for soft_timeout. Applied to
+# every attempt, so retried commands are treated the same as the first send
+sub _wrap_sent {
+    my ( $self, $command, $request, $callback ) = @_;
+    $callback = $self->{profiler}->_wrap( $command, length $request, $callback ) if $self->{profiler};
+    $callback = $self->_defer($callback)
+      if $self->{deferred_callbacks} and not $self->{_subscription_loop};
+    $callback = $self->_track($callback)
+      if $self->{soft_timeout}
+      and not( $self->{_in_multi} or $self->{_watching} or $self->{_subscription_loop} );
+    return $callback;
+}
+
+sub _waiting_retry {
+    my $reply = shift;
+    return ref $reply eq 'RedisDB::_Retry' && !$reply->{done};
+}
+
+# send again the requests that got transient errors if they are due. All of
+# them are sent in one batch in the order they were originally sent. If $block
+# is true and there are no replies to wait for, sleep till the batch is due
+sub _send_retries {
+    my ( $self, $block ) = @_;
+    my $retries = $self->{_retries} or return;
+    my $now = Time::HiRes::time();
+    if ( $block and not( $self->{_parser} and $self->{_parser}->callbacks ) ) {
+        if ( $self->{_retry_due} > $now ) {
+            Time::HiRes::sleep( $self->{_retry_due} - $now );
+            $now = Time::HiRes::time();
+        }
+    }
+    return if $self->{_retry_due} > $now;
+    delete @{$self}{qw(_retries _retry_due)};
+
+    unless ( $self->{_socket} and $self->{_pid} == $$ ) {
+        my $error = $self->_connect;
+        if ($error) {
+            $_->{callback}->( $self, $error ) for @$retries;
+            return;
+        }
+    }
+    $self->{_parser}->push_callback( $self->_wrap_sent( @{$_}{qw(command request callback)} ) )
+      for @$retries;
+    $self->_write( join '', map { $_->{request} } @$retries );
+    return;
+}
+
+# probe the endpoints and set host and port to the address of the master.
+# Returns error message if the master was not found
+sub _discover_master {
+    my $self  = shift;
+    my $roles = $self->_probe_endpoints;
+    my ( $master, $master_role, @replicas );
+    for my $ep ( @{ $self->{endpoints} } ) {
+        my $role = $roles->{"$ep->{host}:$ep->{port}"} or next;
+        if ( $role->{role} eq 'master' ) {
+            my $slaves = @{ $role->{slaves} || [] };
+            ( $master, $master_role ) = ( $ep, $role )
+              unless $master and @{ $master_role->{slaves} || [] } >= $slaves;
+        }
+        elsif ( $role->{role} eq 'slave' and $role->{status} eq 'connected' ) {
+            push @replicas, $ep;
+        }
+    }
+    return "no master found among the endpoints" unless $master;
+    @$self{qw(host port)} = @$master{qw(host port)};
+    $self->{_replicas} = \@replicas;
+    delete $self->{_replica};
+    delete $self->{_replica_endpoint};
+    return;
+}
+
+# send ROLE command to all endpoints concurrently. Returns reference to a hash
+# with "host:port" as keys and parsed replies as values
+sub _probe_endpoints {
+    my $self = shift;
+
+    my $builder = RedisDB::Parser->new( master => $self );
+    my $request = $builder->build_request('ROLE');
+    $request = $builder->build_request( 'AUTH', $self->{password} ) . $request
+      if $self->{password};
+
+    my ( %replies, %probes );
+    for my $ep ( @{ $self->{endpoints} } ) {
+        my $key    = "$ep->{host}:$ep->{port}";
+        my $socket = IO::Socket::IP->new(
+            PeerHost => $ep->{host},
+            PeerPort => $ep->{port},
+            Proto    => 'tcp',
+            Blocking => 0,
+        ) or next;
+        my $parser = RedisDB::Parser->new( master => $self, error_class => 'RedisDB::Error' );
+        $parser->push_callback( \&_ignore ) if $self->{password};
+        $parser->push_callback(
+            sub {
+                $replies{$key} = $_[1] unless _is_redisdb_error( $_[1] );
+                delete $probes{$key};
+            }
+        );
+        $probes{$key} = { socket => $socket, parser => $parser, request => $request };
+    }
+
+    local $SIG{PIPE} = 'IGNORE' unless $NOSIGNAL;
+    my $deadline = Time::HiRes::time() + ( $self->{timeout} || 1 );
+    while (%probes) {
+        my $left = $deadline - Time::HiRes::time();
+        last if $left <= 0;
+        my ( $rin, $win ) = ( '', '' );
+        for ( values %probes ) {
+            if ( defined $_->{request} ) {
+                vec( $win, fileno $_->{socket}, 1 ) = 1;
+            }
+            else {
+                vec( $rin, fileno $_->{socket}, 1 ) = 1;
+            }
+        }
+        my ( $rout, $wout ) = ( $rin, $win );
+        next unless select( $rout, $wout, undef, $left ) > 0;
+
+        for my $key ( keys %probes ) {
+            my $probe  = $probes{$key} or next;
+            my $socket = $probe->{socket};
+            if ( defined $probe->{request} ) {
+                next unless vec( $wout, fileno $socket, 1 );
+
+                # connect completes the non-blocking connect started by the constructor
+                if ( $socket->connect ) {
+                    if ( defined send( $socket, $probe->{request}, $NOSIGNAL ) ) {
+                        delete $probe->{request};
+                    }
+                    else {
+                        delete $probes{$key};
+                    }
+                }
+                elsif ( $! != EINPROGRESS and $! != EALREADY and $! != EWOULDBLOCK ) {
+                    delete $probes{$key};
+                }
+            }
+            elsif ( vec( $rout, fileno $socket, 1 ) ) {
+                my $ret = recv( $socket, my $buf, 65536, 0 );
+                if ( defined $ret and $buf ne '' ) {
+                    $probe->{parser}->parse($buf);
+                }
+                elsif ( defined $ret or ( $! != EAGAIN and $! != EWOULDBLOCK and $! != EINTR ) ) {
+                    delete $probes{$key};
+                }
+            }
+        }
+    }
+
+    my %roles;
+    for my $key ( keys %replies ) {
+        my $role = try { _parse_role( $replies{$key} ) } or next;
+        $roles{$key} = $role;
+    }
+    return \%roles;
+}
+
+# encode values in the arguments and wrap the callback into a function that
+# decodes the reply
+sub _apply_codec {
+    my ( $self, $command, $callback, @args ) = @_;
+    my $codec = $self->{value_codec};
+
+    if ( my $spec = $CODEC_ARGS{$command} ) {
+        my @pos =
+            ref $spec       ? @$spec
+          : $spec eq 'pairs' ? grep { $_ % 2 } 0 .. $#args
+          :                    grep { $_ and $_ % 2 == 0 } 0 .. $#args;
+        $args[$_] = $codec->encode( $args[$_] ) for grep { $_ <= $#args } @pos;
+    }
+
+    # SET with GET flag returns the old value
+    my $type = $CODEC_REPLY{$command};
+    $type = 'scalar' if $command eq 'SET' and grep { uc eq 'GET' } @args[ 2 .. $#args ];
+    if ($type) {
+        my $cb = $callback;
+        $callback = sub {
+            my ( $redis, $reply ) = @_;
+            unless ( _is_redisdb_error($reply) ) {
+                if ( $type eq 'scalar' ) {
+                    $reply = $codec->decode($reply);
+                }
+                elsif ( ref $reply eq 'ARRAY' ) {
+                    my $step = $type eq 'pairs' ? 2 : 1;
+                    for ( my $i = $step - 1 ; $i < @$reply ; $i += $step ) {
+                        $reply->[$i] = $codec->decode( $reply->[$i] );
+                    }
+                }
+            }
+            $cb->( $redis, $reply );
+        };
+    }
+
+    return ( $callback, @args );
+}
+
+# append the command to the spool and pass "SPOOLED" to the callback, or the
+# error if the spool is full. $error is the reason the command wasn't sent
+sub _spool {
+    my ( $self, $error, $command, $callback, @args ) = @_;
+    $self->_init_parser unless $self->{_parser};
+    my $res =
+      $self->{spool}->append( $self->{_parser}->build_request( $command, @args ) )
+      ? 'SPOOLED'
+      : RedisDB::Error::DISCONNECTED->new(
+        "Spool is full" . ( $error ? ", couldn't connect to the server: $error" : "" ) );
+    $callback->( $self, $res );
+    return _is_redisdb_error($res) ? $res : 1;
+}
+
+# check that the connection is alive, or try to establish it if there's no
+# connection. Doesn't wait between connection attempts, as the commands can
+# be spooled instead. Returns error if failed
+sub _spool_connect {
+    my $self = shift;
+    local $self->{raise_error}        = 0;
+    local $self->{reconnect_attempts} = 1;
+    return try {
+        $self->{_socket} && $self->{_pid} == $$ ? $self->_recv_data_nb : $self->_connect;
     }
+    catch { $_ };
+}
+
+=head2 $self->drain_spool
+
+send commands stored in the spool to the server in pipelined batches. Returns
+true if the spool has been drained, or false if connection to the server has
+failed. Note, that the method waits for replies to all commands sent
+previously with callbacks. See L<RedisDB::Spool>.
+
+=cut
 
+sub drain_spool {
+    my $self  = shift;
+    my $spool = $self->{spool} or croak "spool is not configured";
+    $spool->_drain_started;
+    return 1 unless $spool->pending;
+    return 0 if $self->_spool_connect;
+    while ( $spool->pending ) {
+        my ( $requests, $pos ) = $spool->_read_batch;
+        my $lost;
+        my $ok = try {
+            local $self->{raise_error} = 0;
+            for (@$requests) {
+                $self->{_parser}->push_callback(
+                    sub {
+                        my $reply = $_[1];
+                        if ( ref($reply) =~ /^RedisDB::Error::(?:DISCONNECTED|EAGAIN)$/ ) {
+                            $lost = 1;
+                        }
+                        elsif ( _is_redisdb_error($reply) ) {
+                            $spool->{stats}{errors}++;
+                        }
+                    }
+                );
+            }
+            if (@$requests) {
+                return if $self->_write( join '', @$requests );
+                $self->mainloop;
+            }
+            1;
+        };
+        return 0 if $lost or not $ok;
+        $spool->_commit( $pos, scalar @$requests );
+    }
     return 1;
 }
 
@@ -589,6 +1609,118 @@ sub _ignore {
 
 sub IGNORE_REPLY { return \&_ignore; }
 
+=head2 $self->send_durable(\%durability, $command[, @arguments], \&callback)
+
+send a write command to the server and invoke the I<callback> only after the
+server has confirmed that the write reached replicas, or was written to AOF.
+Instead of sending WAIT after every write, the client groups durable writes
+and sends a single WAIT (or WAITAOF) after the last write of the group. The
+group is closed when the client starts waiting for replies, e.g. in
+I<mainloop> or I<get_reply>, when I<flush_durable> is invoked, or when it
+contains 1000 writes. WAIT applies to all writes sent before it over the same
+connection, so it confirms all writes of the group. The following elements of
+I<%durability> are recognized:
+
+=over 4
+
+=item replicas
+
+number of replicas that should acknowledge the write, default is 1
+
+=item timeout
+
+maximum time to wait for acknowledgements in milliseconds, default is 1000.
+Zero means wait forever.
+
+=item aof
+
+if true, WAITAOF command is sent instead of WAIT, so the write is also
+confirmed to be fsynced to the local AOF and to AOF of I<replicas> replicas
+
+=back
+
+If several writes in the group requested different durability, the group
+waits for the largest number of replicas and the longest timeout. The
+I<callback> is invoked with three arguments: the RedisDB object, the reply to
+the command, and the achieved durability. Durability is a hash with
+"replicas" element, which contains the number of replicas that acknowledged
+the writes, and in case of WAITAOF "local" element, which is 1 if the writes
+were fsynced to the local AOF. If WAIT or WAITAOF command failed, the third
+argument is the error object. Note, that the write is not rolled back if the
+requested durability was not achieved, it is up to the callback to decide
+what to do. If the write was retried because of the I<retry> option, the
+callback is invoked after the final reply with undefined durability.
+
+=cut
+
+sub send_durable {
+    my $self       = shift;
+    my $durability = shift;
+    croak "callback is required" unless ref $_[-1] eq 'CODE';
+    my $callback = pop;
+
+    my $group = $self->{_durable} ||= { replicas => 0, timeout => -1, aof => 0, writes => [] };
+    my $replicas = defined $durability->{replicas} ? $durability->{replicas} : 1;
+    my $timeout  = defined $durability->{timeout}  ? $durability->{timeout}  : 1000;
+    $group->{replicas} = $replicas if $replicas > $group->{replicas};
+
+    # zero timeout means wait forever, so it takes precedence
+    $group->{timeout} = $timeout
+      if $group->{timeout} != 0 and ( $timeout == 0 or $timeout > $group->{timeout} );
+    $group->{aof} ||= $durability->{aof};
+
+    my $write = { callback => $callback };
+    push @{ $group->{writes} }, $write;
+    my $res = $self->send_command(
+        @_,
+        sub {
+            $write->{reply} = $_[1];
+
+            # the write was retried and WAIT has been processed before it
+            $write->{callback}->( $_[0], $_[1], undef ) if delete $write->{late};
+        }
+    );
+    $self->flush_durable if @{ $group->{writes} } >= 1000;
+    return $res;
+}
+
+=head2 $self->flush_durable
+
+close the current group of durable writes and send WAIT or WAITAOF command
+for it. You only need to invoke this method if you are not going to wait for
+replies, e.g. if you are using an event loop and checking for replies using
+I<reply_ready>.
+
+=cut
+
+sub flush_durable {
+    my $self = shift;
+    my $group = delete $self->{_durable} or return;
+    my @wait =
+      $group->{aof}
+      ? ( 'WAITAOF', 1, $group->{replicas}, $group->{timeout} )
+      : ( 'WAIT', $group->{replicas}, $group->{timeout} );
+    $self->send_command(
+        @wait,
+        sub {
+            my ( $redis, $reply ) = @_;
+            my $achieved =
+                _is_redisdb_error($reply) ? $reply
+              : $group->{aof} ? { local => $reply->[0], replicas => $reply->[1] }
+              :                 { replicas => $reply };
+            for ( @{ $group->{writes} } ) {
+                if ( exists $_->{reply} ) {
+                    $_->{callback}->( $redis, $_->{reply}, $achieved );
+                }
+                else {
+                    $_->{late} = 1;
+                }
+            }
+        }
+    );
+    return 1;
+}
+
 =begin comment
 
 =head2 $self->send_command_cb($command[, @arguments][, \&callback])
@@ -642,11 +1774,35 @@ ready to be fetched with I<get_reply> method.
 sub reply_ready {
     my $self = shift;
 
+    $self->flush_durable if $self->{_durable};
     my $error = $self->_recv_data_nb;
     if ($error) {
         $self->_on_disconnect( 1, $error );
     }
-    return @{ $self->{_replies} } ? 1 : 0;
+    $self->_send_retries if $self->{_retries};
+    return @{ $self->{_replies} } && !_waiting_retry( $self->{_replies}[0] ) ? 1 : 0;
+}
+
+=head2 $self->send_heartbeat
+
+send PING to the server if I<heartbeat> option is set and nothing has been
+sent over the connection for I<heartbeat> seconds. Use it to check idle
+connections, e.g. invoke it periodically from the event loop, together with
+I<tcp_user_timeout> a dead server will be noticed even if the application has
+nothing to send. The reply is processed when you invoke I<reply_ready>,
+I<get_reply>, or I<mainloop>. Returns true if PING was sent.
+
+=cut
+
+sub send_heartbeat {
+    my $self = shift;
+    return 0 unless $self->{heartbeat} and $self->{_socket} and $self->{_pid} == $$;
+    return 0 if $self->{_heartbeats} or $self->{_in_multi};
+    return 0 if Time::HiRes::time() - $self->{_last_write} < $self->{heartbeat};
+    my $error = $self->_recv_data_nb;
+    return 0 if $error or not $self->{_socket};
+    $self->_send_ping;
+    return 1;
 }
 
 =head2 $self->mainloop
@@ -660,14 +1816,27 @@ method may block for indefinite time.
 sub mainloop {
     my $self = shift;
 
+    $self->flush_durable if $self->{_durable};
+    $self->_dispatch if $self->{_deferred} and @{ $self->{_deferred} };
     return unless $self->{_parser};
 
-    while ( $self->{_parser}->callbacks ) {
+    # replies to timed out commands are not waited for
+    while ( $self->{_parser} and $self->{_parser}->callbacks > ( $self->{_abandoned} || 0 )
+        or $self->{_retries} )
+    {
         croak "You can't call mainloop in the child process" unless $self->{_pid} == $$;
+        if ( $self->{_retries} ) {
+            $self->_send_retries(1);
+            next unless $self->{_parser} and $self->{_parser}->callbacks;
+        }
+        $self->_heartbeat_wait if $self->{heartbeat};
         my $ret = recv( $self->{_socket}, my $buffer, 131073, 0 );
         unless ( defined $ret ) {
             next if $! == EINTR;
             if ( $! == EAGAIN ) {
+                next
+                  if $self->{soft_timeout}
+                  and $self->_soft_timeout( RedisDB::Error::EAGAIN->new("Timed out waiting reply from the server") );
                 confess "Timed out waiting reply from the server";
             }
             else {
@@ -679,7 +1848,7 @@ sub mainloop {
         if ( $buffer ne '' ) {
 
             # received some data
-            $self->{_parser}->parse($buffer);
+            $self->_parse($buffer);
         }
         else {
 
@@ -710,13 +1879,18 @@ sub get_reply {
       or $self->{_to_be_fetched}
       or $self->{_subscription_loop};
     croak "You can't read reply in child process" unless $self->{_pid} == $$;
-    while ( not @{ $self->{_replies} } ) {
+    $self->flush_durable if $self->{_durable};
+    $self->_dispatch if $self->{_deferred} and @{ $self->{_deferred} };
+    while ( not @{ $self->{_replies} } or _waiting_retry( $self->{_replies}[0] ) ) {
+        $self->_send_retries(1) if $self->{_retries};
+        $self->_heartbeat_wait if $self->{heartbeat};
         my $ret = recv( $self->{_socket}, my $buffer, 131074, 0 );
         if ( not defined $ret ) {
             next if $! == EINTR or $! == 0;
             my $err;
             if ( $! == EAGAIN or $! == EWOULDBLOCK ) {
                 $err = RedisDB::Error::EAGAIN->new("$!");
+                next if $self->{soft_timeout} and $self->_soft_timeout($err);
             }
             else {
                 $err = RedisDB::Error::DISCONNECTED->new("Connection error: $!");
@@ -726,7 +1900,7 @@ sub get_reply {
         elsif ( $buffer ne '' ) {
 
             # received some data
-            $self->{_parser}->parse($buffer);
+            $self->_parse($buffer);
         }
         else {
 
@@ -736,6 +1910,7 @@ sub get_reply {
     }
 
     my $res = shift @{ $self->{_replies} };
+    $res = $res->{reply} if ref $res eq 'RedisDB::_Retry';
     if ( _is_redisdb_error($res)
         and ( $self->{raise_error} or $self->{_in_multi} or $self->{_watching} ) )
     {
@@ -756,6 +1931,11 @@ sub get_reply {
 
             # ignore
         }
+        elsif ( $res->[0] eq 'pong' ) {
+
+            # reply to heartbeat
+            $self->{_heartbeats}-- if $self->{_heartbeats};
+        }
         else {
             confess "Got unknown reply $res->[0] in subscription mode";
         }
@@ -808,13 +1988,17 @@ sub selected_database {
 =head2 $self->reset_connection
 
 reset connection. This method closes existing connection and drops all
-previously sent requests. After invoking this method the object returns to the
+previously sent requests. Callbacks of the commands queued by the admission
+controller are invoked with L<RedisDB::Error::DISCONNECTED> error. After invoking this method the object returns to the
 same state as it was returned by the constructor.
 
 =cut
 
 sub reset_connection {
     my $self = shift;
+    $self->{admission}->_reset($self) if $self->{_admission_inflight};
+    $self->_send_admission_queue( RedisDB::Error::DISCONNECTED->new("Connection was reset") )
+      if $self->{_admission_queue};
     delete $self->{$_} for grep /^_/, keys %$self;
     $self->{_replies} = [];
     $self->_init_parser;
@@ -1389,6 +2573,9 @@ You can publish messages into the channels using the I<publish> method. This
 method should be called when you in the normal mode, and can't be used while
 you're in the subscription mode.
 
+If many independent parts of the application need subscriptions, you can use
+L<RedisDB::PubSubHub> to share one subscription connection between them.
+
 Following methods can be used in subscription mode:
 
 =cut
@@ -1725,6 +2912,11 @@ For accessing redis cluster use L<RedisDB::Cluster> package
 
 For accessing redis servers managed by sentinel use L<RedisDB::Sentinel> package
 
+=head1 COROUTINES
+
+For sharing one connection between L<Coro> coroutines use L<RedisDB::Coro>
+package
+
 =cut
 
 1;
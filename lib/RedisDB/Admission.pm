@@ -0,0 +1,291 @@
+package RedisDB::Admission;
+
+use strict;
+use warnings;
+our $VERSION = "2.57";
+$VERSION = eval $VERSION;
+
+use Carp;
+use RedisDB::Error;
+use Time::HiRes qw(time);
+
+=head1 NAME
+
+RedisDB::Admission - adaptive client side limit of in-flight commands
+
+=head1 SYNOPSIS
+
+    my $admission = RedisDB::Admission->new(
+        max_limit    => 200,
+        low_priority => [qw(SCAN KEYS INFO)],
+    );
+    my $redis = RedisDB->new( host => 'master', raise_error => 0, admission => $admission );
+
+    my $res = $redis->get('foo');
+    if ( ref $res eq 'RedisDB::Error::OVERLOADED' ) {
+        # the command was not sent, serve a degraded response
+    }
+
+    # what was shed
+    my $stats = $admission->stats;
+
+=head1 DESCRIPTION
+
+When the server is overloaded, clients that keep sending commands make things
+worse: pipelines get deeper, commands time out and are retried, and the server
+never gets a chance to recover. The admission controller tracks the number of
+commands sent to every server and not replied yet, and the smoothed latency of
+replies, and limits the number of in-flight commands. The limit is adjusted
+using additive increase, multiplicative decrease: while the smoothed latency
+stays below I<tolerance> times the baseline latency every reply increases the
+limit by 1/limit, so with full utilization the limit grows by one per round
+trip. When the smoothed latency exceeds the target, or on a timeout or a
+disconnect, the limit is multiplied by I<backoff> factor, but not more often
+than once per round trip.
+
+A command that would exceed the limit is not sent, instead the
+L<RedisDB::Error::OVERLOADED> error is returned or thrown, depending on
+I<raise_error> setting of the connection. Commands listed as I<low_priority>
+that were sent with a callback are queued instead, and sent when the
+connection receives replies to its in-flight commands. If the connection was
+lost, queued commands get the same error as the in-flight ones.
+
+One controller may be shared by many connections, e.g. by all connections
+from a pool, or by all nodes of L<RedisDB::Cluster>. The state is kept for
+every server separately, so an overloaded node doesn't affect the others.
+Commands sent inside transactions, and while the connection is being
+established, are not limited.
+
+=head1 METHODS
+
+=cut
+
+=head2 $class->new(%params)
+
+create a new admission controller. Accepts the following parameters:
+
+=over 4
+
+=item initial_limit
+
+initial limit of in-flight commands for every server. Default is 20.
+
+=item min_limit, max_limit
+
+the limit is kept between these values. Defaults are 1 and 1000.
+
+=item target_latency
+
+smoothed latency in seconds above which the server is considered overloaded. By default the
+target is I<tolerance> times the baseline latency, which is the lowest latency
+observed during the last I<baseline_window> seconds.
+
+=item tolerance
+
+see I<target_latency>, default is 2
+
+=item baseline_window
+
+see I<target_latency>, default is 60
+
+=item backoff
+
+factor by which the limit is multiplied when the server is considered
+overloaded. Default is 0.9.
+
+=item smoothing
+
+weight of a new sample in the exponentially weighted moving average of
+latency. Default is 0.1.
+
+=item low_priority
+
+list of commands that are queued when the limit is reached
+
+=item max_queue
+
+maximum number of queued commands for a connection, when the queue is full low
+priority commands are shed as well. Default is 1000.
+
+=back
+
+=cut
+
+sub new {
+    my ( $class, %params ) = @_;
+    my $self = bless {
+        initial_limit   => $params{initial_limit}   || 20,
+        min_limit       => $params{min_limit}       || 1,
+        max_limit       => $params{max_limit}       || 1000,
+        target_latency  => $params{target_latency},
+        tolerance       => $params{tolerance}       || 2,
+        baseline_window => $params{baseline_window} || 60,
+        backoff         => $params{backoff}         || 0.9,
+        smoothing       => $params{smoothing}       || 0.1,
+        low_priority    => { map { uc($_) => 1 } @{ $params{low_priority} || [] } },
+        max_queue       => defined $params{max_queue} ? $params{max_queue} : 1000,
+        _servers        => {},
+    }, $class;
+    croak "min_limit can't be greater than max_limit" if $self->{min_limit} > $self->{max_limit};
+    return $self;
+}
+
+sub _server {
+    my ( $self, $redis ) = @_;
+    my $name = $redis->{path} || "$redis->{host}:$redis->{port}";
+    return $self->{_servers}{$name} ||= {
+        limit         => $self->{initial_limit},
+        inflight      => 0,
+        latency       => undef,
+        baseline      => undef,
+        admitted      => 0,
+        shed          => 0,
+        queued        => 0,
+        late          => 0,
+        errors        => 0,
+        _baseline_at  => 0,
+        _decreased_at => 0,
+    };
+}
+
+# decide what to do with the command. Returns wrapped callback if the command
+# may be sent, "queue" if it should be queued, or error object if it is shed
+sub _admit {
+    my ( $self, $redis, $command, $callback ) = @_;
+    my $server = $self->_server($redis);
+
+    if ( $server->{inflight} >= $server->{limit} ) {
+        my $queue = $redis->{_admission_queue} ||= [];
+        if (    $self->{low_priority}{$command}
+            and $callback != \&RedisDB::_queue
+            and @$queue < $self->{max_queue}
+            and $redis->{_admission_inflight} )
+        {
+            $server->{queued}++;
+            return 'queue';
+        }
+        $server->{shed}++;
+        return RedisDB::Error::OVERLOADED->new(
+            sprintf "Too many commands in flight to the server (limit %d)", $server->{limit} );
+    }
+
+    $server->{inflight}++;
+    $server->{admitted}++;
+    $redis->{_admission_inflight}++;
+    my $sent = time;
+    return sub {
+        my ( $redis, $reply ) = @_;
+        $server->{inflight}--;
+        $redis->{_admission_inflight}--;
+        $self->_observe( $server, time - $sent, $reply );
+        $callback->(@_);
+        $redis->_send_admission_queue($reply)
+          if $redis->{_admission_queue} and @{ $redis->{_admission_queue} };
+    };
+}
+
+# return true if one more command may be sent to the server
+sub _has_room {
+    my ( $self, $redis ) = @_;
+    my $server = $self->_server($redis);
+    return $server->{inflight} < $server->{limit};
+}
+
+# connection has been reset, forget its in-flight commands
+sub _reset {
+    my ( $self, $redis ) = @_;
+    $self->_server($redis)->{inflight} -= $redis->{_admission_inflight};
+    $redis->{_admission_inflight} = 0;
+    return;
+}
+
+# update latency and the limit using the observed reply
+sub _observe {
+    my ( $self, $server, $latency, $reply ) = @_;
+    my $now = time;
+    my $overloaded;
+    if ( ref $reply eq 'RedisDB::Error::EAGAIN' or ref $reply eq 'RedisDB::Error::DISCONNECTED' ) {
+        $server->{errors}++;
+        $overloaded = 1;
+    }
+    else {
+        $server->{latency} =
+          defined $server->{latency}
+          ? $server->{latency} + $self->{smoothing} * ( $latency - $server->{latency} )
+          : $latency;
+        if ( not defined $server->{baseline}
+            or $latency < $server->{baseline}
+            or $now - $server->{_baseline_at} > $self->{baseline_window} )
+        {
+            $server->{baseline}     = $latency;
+            $server->{_baseline_at} = $now;
+        }
+        my $target = $self->{target_latency} || $self->{tolerance} * $server->{baseline};
+        if ( $server->{latency} > $target ) {
+            $server->{late}++;
+            $overloaded = 1;
+        }
+    }
+
+    if ($overloaded) {
+
+        # all replies to commands sent in the same round trip are late, so the
+        # limit is decreased only once per round trip
+        if ( $now - $server->{_decreased_at} >= ( $server->{latency} || 0 ) ) {
+            $server->{limit} *= $self->{backoff};
+            $server->{_decreased_at} = $now;
+        }
+    }
+    else {
+        $server->{limit} += 1 / $server->{limit};
+    }
+    $server->{limit} = $self->{min_limit} if $server->{limit} < $self->{min_limit};
+    $server->{limit} = $self->{max_limit} if $server->{limit} > $self->{max_limit};
+    return;
+}
+
+=head2 $self->stats
+
+return reference to a hash with statistics for every server. Keys are server
+addresses, values are hashes with the following elements: current I<limit>,
+number of commands I<inflight>, smoothed I<latency> and I<baseline> latency
+in seconds, and the number of I<admitted>, I<shed>, and I<queued> commands,
+number of replies received while the latency was above the target as
+I<late>, and number of timeouts and disconnects
+counted as I<errors>.
+
+=cut
+
+sub stats {
+    my $self = shift;
+    my %stats;
+    for my $name ( keys %{ $self->{_servers} } ) {
+        my $server = $self->{_servers}{$name};
+        $stats{$name} = { map { $_ => $server->{$_} } grep { !/^_/ } keys %$server };
+    }
+    return \%stats;
+}
+
+1;
+
+__END__
+
+=head1 SEE ALSO
+
+L<RedisDB>
+
+=head1 AUTHOR
+
+Pavel Shaydo, C<< <zwon at cpan.org> >>
+
+=head1 LICENSE AND COPYRIGHT
+
+Copyright 2011-2021 Pavel Shaydo.
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of either: the GNU General Public License as published
+by the Free Software Foundation; or the Artistic License.
+
+See http://dev.perl.org/licenses/ for more information.
+
+=cut
@@ -0,0 +1,295 @@
+package RedisDB::Bitmap;
+
+use strict;
+use warnings;
+our $VERSION = "2.57";
+$VERSION = eval $VERSION;
+
+use Carp;
+use RedisDB;
+
+=head1 NAME
+
+RedisDB::Bitmap - bitmap operations on the client side
+
+=head1 SYNOPSIS
+
+    my $bitmap = RedisDB::Bitmap->new( cluster => $cluster );
+
+    # keys may be in different slots
+    my ( $visited, $paid ) = $bitmap->fetch( 'visited:2021-05', 'paid:2021-05' );
+    my $both = RedisDB::Bitmap::bitop( AND => $visited, $paid );
+    say RedisDB::Bitmap::bitcount($both);
+    say RedisDB::Bitmap::bitpos( $both, 1 );
+
+    # the same as BITOP, but computed by the client
+    $bitmap->combine( OR => 'active:2021-05', 'visited:2021-05', 'paid:2021-05' );
+
+=head1 DESCRIPTION
+
+BITOP command requires all keys to be in the same slot, so it can't be used
+across slots of redis cluster, and on big bitmaps it blocks the server for a
+long time. This module fetches bitmaps from the server in chunks using
+GETRANGE, performs operations on the client, and optionally writes the
+result back in chunks using SETRANGE. Chunks of all bitmaps are requested in
+one pipelined batch, with cluster the batches are sent to all involved nodes
+before waiting for replies.
+
+Bitmaps are represented as perl byte strings using the same layout as redis
+uses, so they can be passed to L<vec|perlfunc/vec>. Operations are performed
+by perl string bitwise operators, which process strings a machine word at a
+time, and by L<unpack|perlfunc/unpack> checksums for counting bits.
+
+=head1 METHODS
+
+=cut
+
+=head2 $class->new(%params)
+
+create a new object. Accepts the following parameters:
+
+=over 4
+
+=item redis
+
+L<RedisDB> object
+
+=item cluster
+
+L<RedisDB::Cluster> object. You must specify either I<redis> or I<cluster>.
+
+=item chunk_size
+
+size of chunks in bytes in which bitmaps are fetched and stored. Default is
+1MB.
+
+=back
+
+=cut
+
+sub new {
+    my ( $class, %params ) = @_;
+    croak 'either "redis" or "cluster" parameter is required'
+      unless $params{redis} or $params{cluster};
+    my $self = {
+        redis      => $params{redis},
+        cluster    => $params{cluster},
+        chunk_size => $params{chunk_size} || 1024 * 1024,
+    };
+    return bless $self, $class;
+}
+
+sub _conn {
+    my $self = shift;
+    return $self->{redis} || $self->{cluster};
+}
+
+=head2 $self->fetch(@keys)
+
+fetch bitmaps stored in I<@keys> and return them as a list of strings.
+Bitmaps that don't exist are returned as empty strings. Croaks if the server
+returned an error.
+
+=cut
+
+sub fetch {
+    my ( $self, @keys ) = @_;
+    my $conn = $self->_conn;
+    my $size = $self->{chunk_size};
+
+    my ( @len, @chunks, $error );
+    for my $i ( 0 .. $#keys ) {
+        $conn->send_command( 'STRLEN', $keys[$i],
+            sub { RedisDB::_is_redisdb_error( $_[1] ) ? $error ||= $_[1] : ( $len[$i] = $_[1] ) } );
+    }
+    $conn->mainloop;
+    croak $error if $error;
+
+    for my $i ( 0 .. $#keys ) {
+        $chunks[$i] = [];
+        my $count = int( ( $len[$i] + $size - 1 ) / $size );
+        for my $n ( 0 .. $count - 1 ) {
+            $conn->send_command(
+                'GETRANGE',
+                $keys[$i],
+                $n * $size,
+                ( $n + 1 ) * $size - 1,
+                sub {
+                    RedisDB::_is_redisdb_error( $_[1] )
+                      ? $error ||= $_[1]
+                      : ( $chunks[$i][$n] = $_[1] );
+                }
+            );
+        }
+    }
+    $conn->mainloop;
+    croak $error if $error;
+
+    # the bitmap might have been truncated between STRLEN and GETRANGE
+    return map { join '', map { defined ? $_ : '' } @$_ } @chunks;
+}
+
+=head2 $self->store($key, $bitmap)
+
+replace the value of the I<$key> with the I<$bitmap>. The bitmap is written
+in chunks, so the operation is not atomic, readers may see partially written
+value.
+
+=cut
+
+sub store {
+    my ( $self, $key, $bitmap ) = @_;
+    my $conn = $self->_conn;
+    my $size = $self->{chunk_size};
+
+    my $error;
+    my $cb = sub { $error ||= $_[1] if RedisDB::_is_redisdb_error( $_[1] ) };
+    $conn->send_command( 'DEL', $key, $cb );
+    for ( my $off = 0 ; $off < length $bitmap ; $off += $size ) {
+        $conn->send_command( 'SETRANGE', $key, $off, substr( $bitmap, $off, $size ), $cb );
+    }
+    $conn->mainloop;
+    croak $error if $error;
+    return length $bitmap;
+}
+
+=head2 $self->combine($operation, $destkey, @keys)
+
+the same as BITOP command, but bitmaps are fetched and the operation is
+performed by the client, so keys may be in different slots. Returns the size
+of the result in bytes.
+
+=cut
+
+sub combine {
+    my ( $self, $op, $dest, @keys ) = @_;
+    croak "BITOP NOT requires exactly one source key" if uc $op eq 'NOT' and @keys != 1;
+    my $result = RedisDB::Bitmap::bitop( $op, $self->fetch(@keys) );
+    return $self->store( $dest, $result );
+}
+
+=head1 FUNCTIONS
+
+=head2 bitop($operation, @bitmaps)
+
+perform bitwise operation on the bitmaps and return the result. Operation is
+one of AND, OR, XOR, or NOT, the same as for BITOP command. Shorter bitmaps
+are padded with zero bytes, the result has the size of the longest bitmap.
+
+=cut
+
+sub bitop {
+    my ( $op, @bitmaps ) = @_;
+    $op = uc $op;
+    if ( $op eq 'NOT' ) {
+        croak "NOT requires exactly one bitmap" unless @bitmaps == 1;
+        return ~"$bitmaps[0]";
+    }
+    return '' unless @bitmaps;
+
+    my $len = 0;
+    for (@bitmaps) {
+        $len = length if length > $len;
+    }
+    my $res = "$bitmaps[0]" . "\0" x ( $len - length $bitmaps[0] );
+
+    # operands are stringified, so perl performs string operation even if
+    # some bitmap looks like a number
+    if ( $op eq 'AND' ) {
+        $res &= "$_" . "\0" x ( $len - length ) for @bitmaps[ 1 .. $#bitmaps ];
+    }
+    elsif ( $op eq 'OR' ) {
+        $res |= "$_" for @bitmaps[ 1 .. $#bitmaps ];
+    }
+    elsif ( $op eq 'XOR' ) {
+        $res ^= "$_" for @bitmaps[ 1 .. $#bitmaps ];
+    }
+    else {
+        croak "Unknown bit operation $op";
+    }
+    return $res;
+}
+
+# convert start and end byte offsets to offset and length like BITCOUNT does
+sub _range {
+    my ( $bitmap, $start, $end ) = @_;
+    my $len = length $bitmap;
+    return ( 0, $len ) unless defined $start;
+    $end = -1 unless defined $end;
+    $start += $len if $start < 0;
+    $end   += $len if $end < 0;
+    $start = 0 if $start < 0;
+    $end = $len - 1 if $end >= $len;
+    return ( $start, $start > $end ? 0 : $end - $start + 1 );
+}
+
+=head2 bitcount($bitmap[, $start, $end])
+
+return the number of set bits in the I<$bitmap>. I<$start> and I<$end> are
+byte offsets and may be negative, the same as for BITCOUNT command.
+
+=cut
+
+sub bitcount {
+    my ( $bitmap, $start, $end ) = @_;
+    my ( $off, $len ) = _range( $bitmap, $start, $end );
+    my $count = 0;
+
+    # 32 bit checksum may overflow on long strings, so count in chunks
+    for ( my $pos = $off ; $pos < $off + $len ; $pos += 65536 ) {
+        my $size = $off + $len - $pos;
+        $size = 65536 if $size > 65536;
+        $count += unpack '%32b*', substr( $bitmap, $pos, $size );
+    }
+    return $count;
+}
+
+=head2 bitpos($bitmap, $bit[, $start, $end])
+
+return the position of the first bit set to I<$bit> in the I<$bitmap>, the
+same as BITPOS command. I<$start> and I<$end> are byte offsets. Returns -1 if
+there is no such bit. Like BITPOS, if looking for a clear bit and the range
+is not specified, returns the position of the first bit past the end of the
+bitmap if all bits are set.
+
+=cut
+
+sub bitpos {
+    my ( $bitmap, $bit, $start, $end ) = @_;
+    my ( $off, $len ) = _range( $bitmap, $start, $end );
+    my $re = $bit ? qr/[^\x00]/ : qr/[^\xff]/;
+
+    # find the first byte that contains the bit, then the bit in this byte
+    my $part = substr $bitmap, $off, $len;
+    if ( $part =~ /$re/g ) {
+        my $pos = pos($part) - 1;
+        my $bits = unpack 'B8', substr( $part, $pos, 1 );
+        return 8 * ( $off + $pos ) + index( $bits, $bit ? '1' : '0' );
+    }
+    return 8 * ( $off + $len ) if not $bit and not defined $end;
+    return -1;
+}
+
+1;
+
+__END__
+
+=head1 SEE ALSO
+
+L<RedisDB>, L<RedisDB::Cluster>
+
+=head1 AUTHOR
+
+Pavel Shaydo, C<< <zwon at cpan.org> >>
+
+=head1 LICENSE AND COPYRIGHT
+
+Copyright 2011-2021 Pavel Shaydo.
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of either: the GNU General Public License as published
+by the Free Software Foundation; or the Artistic License.
+
+See http://dev.perl.org/licenses/ for more information.
+
+=cut
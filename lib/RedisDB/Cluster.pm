@@ -8,126 +8,20 @@ $VERSION = eval $VERSION;
 
 use Carp;
 use RedisDB;
+use RedisDB::KeySpec;
+use Scalar::Util qw(weaken);
 use Time::HiRes qw(usleep);
 
 our $DEBUG = 0;
 
-# use util/generate_key_positions.pl to generate this
-# command / first key position
-my %key_pos = (
-    append           => 1,
-    bitcount         => 1,
-    bitop            => 2,
-    bitpos           => 1,
-    blpop            => 1,
-    brpop            => 1,
-    brpoplpush       => 1,
-    decr             => 1,
-    decrby           => 1,
-    del              => 1,
-    dump             => 1,
-    exists           => 1,
-    expire           => 1,
-    expireat         => 1,
-    get              => 1,
-    getbit           => 1,
-    getrange         => 1,
-    getset           => 1,
-    hdel             => 1,
-    hexists          => 1,
-    hget             => 1,
-    hgetall          => 1,
-    hincrby          => 1,
-    hincrbyfloat     => 1,
-    hkeys            => 1,
-    hlen             => 1,
-    hmget            => 1,
-    hmset            => 1,
-    hscan            => 1,
-    hset             => 1,
-    hsetnx           => 1,
-    hvals            => 1,
-    incr             => 1,
-    incrby           => 1,
-    incrbyfloat      => 1,
-    lindex           => 1,
-    linsert          => 1,
-    llen             => 1,
-    lpop             => 1,
-    lpush            => 1,
-    lpushx           => 1,
-    lrange           => 1,
-    lrem             => 1,
-    lset             => 1,
-    ltrim            => 1,
-    mget             => 1,
-    move             => 1,
-    mset             => 1,
-    msetnx           => 1,
-    object           => 2,
-    persist          => 1,
-    pexpire          => 1,
-    pexpireat        => 1,
-    pfadd            => 1,
-    pfcount          => 1,
-    pfmerge          => 1,
-    psetex           => 1,
-    pttl             => 1,
-    rename           => 1,
-    renamenx         => 1,
-    restore          => 1,
-    'restore-asking' => 1,
-    rpop             => 1,
-    rpoplpush        => 1,
-    rpush            => 1,
-    rpushx           => 1,
-    sadd             => 1,
-    scard            => 1,
-    sdiff            => 1,
-    sdiffstore       => 1,
-    set              => 1,
-    setbit           => 1,
-    setex            => 1,
-    setnx            => 1,
-    setrange         => 1,
-    sinter           => 1,
-    sinterstore      => 1,
-    sismember        => 1,
-    smembers         => 1,
-    smove            => 1,
-    sort             => 1,
-    spop             => 1,
-    srandmember      => 1,
-    srem             => 1,
-    sscan            => 1,
-    strlen           => 1,
-    substr           => 1,
-    sunion           => 1,
-    sunionstore      => 1,
-    ttl              => 1,
-    type             => 1,
-    watch            => 1,
-    zadd             => 1,
-    zcard            => 1,
-    zcount           => 1,
-    zincrby          => 1,
-    zlexcount        => 1,
-    zrange           => 1,
-    zrangebylex      => 1,
-    zrangebyscore    => 1,
-    zrank            => 1,
-    zrem             => 1,
-    zremrangebylex   => 1,
-    zremrangebyrank  => 1,
-    zremrangebyscore => 1,
-    zrevrange        => 1,
-    zrevrangebylex   => 1,
-    zrevrangebyscore => 1,
-    zrevrank         => 1,
-    zscan            => 1,
-    zscore           => 1,
+my %cross_slot = map { $_ => 1 } qw(
+  sunion sinter sdiff sunionstore sinterstore sdiffstore
+  zunion zinter zdiff zunionstore zinterstore zdiffstore
 );
 
+# number of elements requested by SSCAN and ZSCAN in cross-slot operations
+our $SCAN_COUNT = 1000;
+
 =head1 NAME
 
 RedisDB::Cluster - client for redis cluster
@@ -160,6 +54,52 @@ will retrieve information about all cluster nodes and slots mappings.
 
 Password, if redis server requires authentication.
 
+=item utf8, value_codec, connection_name
+
+passed to the connections to the nodes, see description in L<RedisDB>
+
+=item keepalive, tcp_user_timeout, heartbeat
+
+options for detecting dead nodes, passed to the connections to the nodes, see
+description in L<RedisDB>.
+
+=item admission
+
+L<RedisDB::Admission> object shared by the connections to all nodes, see
+description of the I<admission> option in L<RedisDB>. The limit is kept for
+every node separately.
+
+=item profiler
+
+L<RedisDB::Profiler> object that records commands sent to all nodes
+
+=item timeout, soft_timeout, max_abandoned
+
+IO timeout for the connections to the nodes, and whether the connections are
+kept after timeouts, see description in L<RedisDB>.
+
+=item key_sampler
+
+L<RedisDB::KeySampler> object that samples keys accessed on all nodes
+
+=item key_map
+
+L<RedisDB::KeyMap> object that replaces long key prefixes with short codes,
+see description in L<RedisDB>. Slots are computed from the mapped keys, as
+they are stored on the server. Codes don't contain braces, so keys with the
+same hash tag are in the same slot after the mapping.
+
+=item deferred_callbacks, on_batch
+
+passed to the connections to the nodes, see description in L<RedisDB>. The
+first argument of I<on_batch> is the connection to the node.
+
+=item retry
+
+retry commands that got LOADING, BUSY, TRYAGAIN, CLUSTERDOWN, or MASTERDOWN
+errors with exponential backoff. The value is passed to the connections to
+the nodes, see description of the I<retry> option in L<RedisDB>.
+
 =back
 
 =cut
@@ -171,7 +111,8 @@ sub new {
         _slots       => [],
         _connections => {},
         _nodes       => $params{startup_nodes},
-        _password    => $params{password},
+        _key_map     => $params{key_map},
+        _node_options => { RedisDB::_inherited_options( \%params ) },
     };
     $self->{no_slots_initialization} = 1 if $params{no_slots_initialization};
 
@@ -189,7 +130,6 @@ sub _initialize_slots {
         confess "list of cluster nodes is empty";
     }
 
-    my %new_nodes;
     my $new_nodes;
     for my $node ( @{ $self->{_nodes} } ) {
         my $redis = _connect_to_node( $self, $node );
@@ -198,31 +138,47 @@ sub _initialize_slots {
         my $nodes = $redis->cluster_nodes;
         next if ref ($nodes) =~ /^RedisDB::Error/;
         $new_nodes = $nodes;
-        for (@$nodes) {
-            $new_nodes{"$_->{host}:$_->{port}"}++;
-        }
 
         my $slots = $redis->cluster('SLOTS');
         confess "got an error trying retrieve a list of cluster slots: $slots"
           if ref $slots =~ /^RedisDB::Error/;
-        for (@$slots) {
-            my ( $ip, $port ) = @{ $_->[2] };
-            my $node_key = "$ip:$port";
-            for ( $_->[0] .. $_->[1] ) {
-                $self->{_slots}[$_] = $node_key;
-            }
-        }
+        $self->_update_slots( $nodes, $slots );
         last;
     }
 
     unless ( $new_nodes and @$new_nodes ) {
         confess "couldn't get list of cluster nodes";
     }
-    $self->{_nodes} = $new_nodes;
+    delete $self->{_refresh_slots};
+
+    return;
+}
+
+# update list of nodes and slots table using replies to CLUSTER NODES and
+# CLUSTER SLOTS commands
+sub _update_slots {
+    my ( $self, $nodes, $slots ) = @_;
+
+    my %new_nodes;
+    for (@$nodes) {
+        $new_nodes{"$_->{host}:$_->{port}"}++;
+    }
+    for (@$slots) {
+        my ( $ip, $port ) = @{ $_->[2] };
+        my $node_key = "$ip:$port";
+        for ( $_->[0] .. $_->[1] ) {
+            $self->{_slots}[$_] = $node_key;
+        }
+    }
+    $self->{_nodes} = $nodes if @$nodes;
 
-    # close connections to nodes that are not in cluster
+    # close connections to nodes that are not in cluster, unless there are
+    # commands waiting for replies from them
     for ( keys %{ $self->{_connections} } ) {
-        delete $self->{_connections}{$_} unless $new_nodes{$_};
+        next if $new_nodes{$_};
+        my $redis = $self->{_connections}{$_};
+        next if $redis and $redis->{_parser} and $redis->{_parser}->callbacks;
+        delete $self->{_connections}{$_};
     }
 
     return;
@@ -254,14 +210,15 @@ sub execute {
     my @args = @_;
 
     my $command = lc $args[0];
-    confess "Command $command does not have key" unless $key_pos{$command};
-    my $key = $args[ $key_pos{$command} ];
+    my $pos = RedisDB::KeySpec::_first_key($command)
+      or confess "Command $command does not have key";
+    my $key = $args[$pos];
     confess "Key is not specified in: ", join " ", @args unless length $key;
 
     if ( $self->{_refresh_slots} ) {
         $self->_initialize_slots;
     }
-    my $slot     = key_slot($key);
+    my $slot     = key_slot( $self->_stored_key($key) );
     my $node_key = $self->{_slots}[$slot]
       || "$self->{_nodes}[0]{host}:$self->{_nodes}[0]{port}";
     my $asking;
@@ -335,9 +292,249 @@ sub execute {
         "Couldn't send command after 10 attempts");
 }
 
-for my $command (keys %key_pos) {
+for my $command ( grep { not $cross_slot{$_} } RedisDB::KeySpec::_commands() ) {
     no strict 'refs';
-    *{ __PACKAGE__ . "::$command" } = sub { execute(shift, $command, @_) };
+    *{ __PACKAGE__ . "::$command" } = sub {
+        my $self = shift;
+        if ( ref $_[-1] eq 'CODE' ) {
+            return $self->send_command( $command, @_ );
+        }
+        else {
+            return $self->execute( $command, @_ );
+        }
+    };
+}
+
+=head2 $self->send_command($command, @args, \&callback)
+
+sends command to redis and returns without waiting for the reply. When the
+reply is received, the I<callback> is invoked with two arguments: the
+RedisDB::Cluster object and the reply. The node is determined the same way as
+for I<execute>. MOVED and ASK redirections and reconnects are handled without
+blocking, and the I<callback> gets the final reply. See L</"ASYNCHRONOUS
+INTERFACE">.
+
+Wrapper methods invoke I<send_command> if the last argument is a code
+reference:
+
+    $cluster->get( "foo", sub { my ( $cluster, $reply ) = @_; ... } );
+
+=cut
+
+sub send_command {
+    my $self = shift;
+    croak "callback is required" unless ref $_[-1] eq 'CODE';
+    my $callback = pop;
+    my @args     = @_;
+
+    my $command = lc $args[0];
+    my $pos = RedisDB::KeySpec::_first_key($command)
+      or confess "Command $command does not have key";
+    my $key = $args[$pos];
+    confess "Key is not specified in: ", join " ", @args unless length $key;
+
+    $self->_refresh_slots_async if $self->{_refresh_slots};
+    $self->_send_async(
+        {
+            args     => \@args,
+            slot     => key_slot( $self->_stored_key($key) ),
+            callback => $callback,
+            attempts => 10,
+        }
+    );
+    return 1;
+}
+
+=head2 $self->send_durable(\%durability, $command, @args, \&callback)
+
+the same as I<send_command>, but the I<callback> is invoked only after the
+write has been confirmed by replicas of the node, see I<send_durable> in
+L<RedisDB>. Writes sent to the same node are grouped under one WAIT command.
+The callback gets the achieved durability as the third argument.
+
+=cut
+
+sub send_durable {
+    my $self       = shift;
+    my $durability = shift;
+    croak "callback is required" unless ref $_[-1] eq 'CODE';
+    my $callback = pop;
+    my @args     = @_;
+
+    my $command = lc $args[0];
+    my $pos = RedisDB::KeySpec::_first_key($command)
+      or confess "Command $command does not have key";
+    my $key = $args[$pos];
+    confess "Key is not specified in: ", join " ", @args unless length $key;
+
+    $self->_refresh_slots_async if $self->{_refresh_slots};
+    $self->_send_async(
+        {
+            args       => \@args,
+            slot       => key_slot( $self->_stored_key($key) ),
+            callback   => $callback,
+            attempts   => 10,
+            durability => $durability,
+        }
+    );
+    return 1;
+}
+
+sub _send_async {
+    my ( $self, $req, $node_key, $asking ) = @_;
+
+    $node_key ||= $self->{_slots}[ $req->{slot} ]
+      || "$self->{_nodes}[0]{host}:$self->{_nodes}[0]{port}";
+    unless ( $req->{attempts}-- > 0 ) {
+        return $req->{callback}->(
+            $self, RedisDB::Error::DISCONNECTED->new("Couldn't send command after 10 attempts") );
+    }
+
+    my $redis = _connect_to_node( $self, _ensure_hash_address($node_key) );
+    unless ($redis) {
+        delete $self->{_connections}{$node_key};
+        return $self->_retry_after_refresh( $req,
+            RedisDB::Error::DISCONNECTED->new("Couldn't connect to redis server at $node_key") );
+    }
+
+    weaken( my $cluster = $self );
+    $self->{_pending}++;
+    $redis->send_command( 'ASKING', RedisDB::IGNORE_REPLY ) if $asking;
+    my $send = $req->{durability} ? 'send_durable' : 'send_command';
+    $redis->$send(
+        ( $req->{durability} ? $req->{durability} : () ),
+        @{ $req->{args} },
+        sub {
+            my ( $res, $durability ) = @_[ 1, 2 ];
+            return unless $cluster;
+            $cluster->{_pending}--;
+            if ( ref $res eq 'RedisDB::Error::MOVED' ) {
+                warn "slot $res->{slot} moved to $res->{host}:$res->{port}" if $DEBUG;
+                $cluster->{_slots}[ $res->{slot} ] = "$res->{host}:$res->{port}";
+                $cluster->{_refresh_slots} = 1;
+                $cluster->_send_async($req);
+            }
+            elsif ( ref $res eq 'RedisDB::Error::ASK' ) {
+                warn "asking $res->{host}:$res->{port} about slot $req->{slot}" if $DEBUG;
+                $cluster->_send_async( $req, "$res->{host}:$res->{port}", 1 );
+            }
+            elsif ( ref $res eq 'RedisDB::Error::DISCONNECTED' ) {
+                warn "$res" if $DEBUG;
+                delete $cluster->{_connections}{$node_key};
+                $cluster->_retry_after_refresh( $req, $res );
+            }
+            else {
+                $req->{callback}->( $cluster, $res, ( $req->{durability} ? $durability : () ) );
+            }
+        }
+    );
+    return;
+}
+
+# refresh slots table and then send the request again
+sub _retry_after_refresh {
+    my ( $self, $req, $error ) = @_;
+    push @{ $self->{_refresh_waiters} }, sub {
+        my $refresh_error = shift;
+        if ($refresh_error) {
+            $req->{callback}->( $self, $error );
+        }
+        else {
+            $self->_send_async($req);
+        }
+    };
+    $self->_refresh_slots_async;
+    return;
+}
+
+# send CLUSTER NODES and CLUSTER SLOTS to some node and update slots table
+# when replies are received
+sub _refresh_slots_async {
+    my $self = shift;
+    return if $self->{_refreshing};
+    delete $self->{_refresh_slots};
+
+    my $done = sub {
+        my $error   = shift;
+        my $waiters = delete $self->{_refresh_waiters} || [];
+        delete $self->{_refreshing};
+        $_->($error) for @$waiters;
+    };
+    return $done->() if $self->{no_slots_initialization};
+    my $redis = $self->random_connection
+      or return $done->( RedisDB::Error::DISCONNECTED->new("Couldn't connect to any cluster node") );
+
+    warn "refreshing slots table" if $DEBUG;
+    $self->{_refreshing} = 1;
+    $self->{_pending}++;
+    my $nodes;
+    $redis->cluster_nodes( sub { $nodes = $_[1] } );
+    $redis->cluster(
+        'SLOTS',
+        sub {
+            my $slots = $_[1];
+            $self->{_pending}--;
+            for ( $nodes, $slots ) {
+                if ( ref($_) =~ /^RedisDB::Error/ ) {
+                    delete $self->{_connections}{"$redis->{host}:$redis->{port}"};
+                    return $done->($_);
+                }
+            }
+            $self->_update_slots( $nodes, $slots );
+            $done->();
+        }
+    );
+    return;
+}
+
+=head2 $self->process_replies
+
+read replies that have already been received from all nodes and invoke
+corresponding callbacks. This method does not block. Returns the number of
+commands still waiting for replies.
+
+=cut
+
+sub process_replies {
+    my $self = shift;
+    for ( grep { $_ and $_->{_socket} } values %{ $self->{_connections} } ) {
+        $_->reply_ready;
+    }
+    return $self->{_pending} || 0;
+}
+
+=head2 $self->mainloop
+
+block till replies to all commands sent with I<send_command> are received and
+processed
+
+=cut
+
+sub mainloop {
+    my $self = shift;
+    while ( $self->{_pending} ) {
+        my @busy =
+          grep { $_ and ( $_->{_parser} and $_->{_parser}->callbacks or $_->{_retries} ) }
+          values %{ $self->{_connections} };
+        last unless @busy;
+        $_->mainloop for @busy;
+    }
+    return;
+}
+
+=head2 $self->sockets
+
+return the list of sockets of all established connections to the nodes. You
+can watch them using your event loop and call I<process_replies> when some of
+them become readable. Note, that new connections may be established when a
+command is redirected to another node, so you should check the list of
+sockets after invoking I<send_command> or I<process_replies>.
+
+=cut
+
+sub sockets {
+    my $self = shift;
+    return grep { defined } map { $_ && $_->{_socket} } values %{ $self->{_connections} };
 }
 
 =head2 $self->random_connection
@@ -401,7 +598,370 @@ node_for_slot method.
 sub node_for_key {
     my ($self, $key, %params) = @_;
 
-    return $self->node_for_slot(key_slot($key), %params);
+    return $self->node_for_slot( key_slot( $self->_stored_key($key) ), %params );
+}
+
+=head1 ASYNCHRONOUS INTERFACE
+
+Besides synchronous I<execute>, commands may be sent using I<send_command>
+method, or wrapper methods with callback. Commands are sent over the same
+connections that are used by I<execute>, so commands to the same node are
+pipelined. Redirections are handled by sending the command to the new node
+from inside the callback, and if the node is not available, the slots table
+is refreshed by sending CLUSTER NODES and CLUSTER SLOTS commands
+asynchronously, the commands are sent again when the new table is received.
+
+Here is an example of using RedisDB::Cluster with L<AnyEvent>:
+
+    my %watchers;
+    my $update_watchers = sub {
+        for my $socket ( $cluster->sockets ) {
+            $watchers{ fileno $socket } ||= AnyEvent->io(
+                fh   => $socket,
+                poll => 'r',
+                cb   => sub { $cluster->process_replies },
+            );
+        }
+    };
+    $cluster->get( $_, sub { say $_[1]; $update_watchers->() } ) for @keys;
+    $update_watchers->();
+
+Note, that connecting to a node is still a blocking operation, so it is best
+to start with connections to all nodes established, e.g. by sending a command
+to every node.
+
+=head1 CROSS-SLOT SET OPERATIONS
+
+Redis cluster refuses to execute SUNION, SINTER, SDIFF, ZUNIONSTORE, and
+similar commands if the keys are in different slots. Wrapper methods for these
+commands check the slots of the keys, and if they are all in the same slot
+send the command to the server as usual, otherwise the result is computed by
+the client:
+
+    my $members = $cluster->sunion( 'users:eu', 'users:us' );
+    my $count = $cluster->zunionstore( 'top', 2, 'scores:eu', 'scores:us',
+        WEIGHTS => 1, 2, AGGREGATE => 'MAX' );
+
+The following methods are supported: I<sunion>, I<sinter>, I<sdiff>,
+I<sunionstore>, I<sinterstore>, I<sdiffstore>, I<zunion>, I<zinter>,
+I<zdiff>, I<zunionstore>, I<zinterstore>, and I<zdiffstore>. They accept the
+same arguments and return the same results as the commands. Asynchronous
+calls with a callback are always sent to the server.
+
+Source keys are read in pages of C<$RedisDB::Cluster::SCAN_COUNT> elements
+(default is 1000) using SSCAN and ZSCAN, pages of all keys are requested in
+parallel. For intersection the smallest key is scanned, and members of every
+page are checked in the other keys using SMISMEMBER or ZMSCORE, for difference
+the first key is scanned the same way. Members of the result are written into
+a temporary key in the slot of the destination as the pages arrive: sets using
+SADD, sorted sets using ZADD with GT or LT flag for MAX and MIN aggregates, so
+the memory used by the client is bounded by the size of the page. When all
+pages have been processed, the temporary key is renamed into the destination.
+For ZUNIONSTORE with SUM aggregate every source key is copied into a temporary
+key in the slot of the destination, and the union of the copies is computed
+by the server. Commands that return the result need to keep the whole result
+in memory of course. These methods require redis 6.2 or newer.
+
+Unlike the server side commands, the operations are not atomic, if the source
+keys are modified while they are scanned, the result may include some of the
+changes. SSCAN and ZSCAN may return the same member more than once, such
+members are counted only once.
+
+=cut
+
+# return the key as it is stored on the server, i.e. mapped by the key map
+sub _stored_key {
+    my ( $self, $key ) = @_;
+    return $self->{_key_map} ? $self->{_key_map}->encode($key) : $key;
+}
+
+# return true if all keys are in the same slot
+sub _same_slot {
+    my @keys = @_;
+    my $slot = key_slot( shift @keys );
+    for (@keys) {
+        return 0 unless key_slot($_) == $slot;
+    }
+    return 1;
+}
+
+# return name for a temporary key in the same slot as $key
+sub _temp_key {
+    my $key = shift;
+    my $suffix = ":tmp:" . join '', map { sprintf "%04x", int rand 65536 } 1 .. 4;
+    my $slot = key_slot($key);
+    for my $tmp ( "$key$suffix", "{$key}$suffix" ) {
+        return $tmp if key_slot($tmp) == $slot;
+    }
+    for my $tag ( 0 .. 65535 ) {
+        return "{$tag}$suffix" if key_slot("{$tag}") == $slot;
+    }
+    confess "Couldn't find a temporary key in slot $slot";
+}
+
+for my $command ( sort keys %cross_slot ) {
+    no strict 'refs';
+    *{ __PACKAGE__ . "::$command" } = sub {
+        my $self = shift;
+        return $self->send_command( $command, @_ ) if ref $_[-1] eq 'CODE';
+        my @args = @_;
+        my $dest = $command =~ /store$/ ? shift @args : undef;
+        my $opts = $command =~ /^s/ ? { keys => \@args } : _parse_zset_args( $command, @args );
+        return $self->execute( $command, @_ )
+          if _same_slot( map { $self->_stored_key($_) } ( defined $dest ? $dest : () ), @{ $opts->{keys} } );
+        $command =~ /^(s|z)(union|inter|diff)/;
+        return $self->_cross_slot( $1 eq 's' ? 'set' : 'zset', $2, $dest, $opts );
+    };
+}
+
+# parse arguments of ZUNION, ZINTER, ZDIFF and their STORE variants
+sub _parse_zset_args {
+    my ( $command, $numkeys, @args ) = @_;
+    croak "Number of keys must be positive" unless $numkeys and $numkeys > 0;
+    croak "Not enough keys for $command" if @args < $numkeys;
+    my %opts = (
+        keys      => [ splice @args, 0, $numkeys ],
+        aggregate => 'SUM',
+    );
+    $opts{weights} = [ (1) x $numkeys ];
+    while (@args) {
+        my $opt = uc shift @args;
+
+        # ZDIFF doesn't support weights and aggregation
+        if ( $opt =~ /^(?:WEIGHTS|AGGREGATE)$/ and $command =~ /^zdiff/ ) {
+            croak "Unsupported option $opt for $command";
+        }
+        elsif ( $opt eq 'WEIGHTS' ) {
+            croak "Not enough weights for $command" if @args < $numkeys;
+            $opts{weights} = [ splice @args, 0, $numkeys ];
+        }
+        elsif ( $opt eq 'AGGREGATE' ) {
+            $opts{aggregate} = uc shift @args;
+            croak "Unknown aggregate $opts{aggregate}"
+              unless $opts{aggregate} =~ /^(?:SUM|MIN|MAX)$/;
+        }
+        elsif ( $opt eq 'WITHSCORES' ) {
+            $opts{withscores} = 1;
+        }
+        else {
+            croak "Unsupported option $opt for $command";
+        }
+    }
+    return \%opts;
+}
+
+# scan the keys in parallel, and invoke $cb->($index, $page) for every page.
+# Returns error if any command failed
+sub _scan_keys {
+    my ( $self, $scan, $keys, $cb, $error ) = @_;
+    my @cursors = (0) x @$keys;
+    my @active  = 0 .. $#$keys;
+    while (@active) {
+        for my $i (@active) {
+            $self->send_command(
+                $scan,
+                $keys->[$i],
+                $cursors[$i],
+                COUNT => $SCAN_COUNT,
+                sub {
+                    my $reply = $_[1];
+                    if ( RedisDB::_is_redisdb_error($reply) ) {
+                        $$error ||= $reply;
+                        $cursors[$i] = 0;
+                        return;
+                    }
+                    $cursors[$i] = $reply->[0];
+                    $cb->( $i, $reply->[1] ) unless $$error;
+                }
+            );
+        }
+        $self->mainloop;
+        return $$error if $$error;
+        @active = grep { $cursors[$_] } @active;
+    }
+    return;
+}
+
+# compute set or sorted set operation on the client
+sub _cross_slot {
+    my ( $self, $type, $op, $dest, $opts ) = @_;
+    my $keys = $opts->{keys};
+    my $zset = $type eq 'zset';
+    my $agg  = $opts->{aggregate} || '';
+    my $w    = $opts->{weights};
+    my ( $error, %result, @seen );
+    my $tmp = defined $dest ? _temp_key( $self->_stored_key($dest) ) : undef;
+
+    # SSCAN and ZSCAN may return a member more than once. Other aggregations
+    # are not affected by that, but to store the sum every source is copied
+    # into a temporary key in the slot of the destination, and the server
+    # computes the union of the copies
+    my @copies =
+      $zset && $op eq 'union' && $agg eq 'SUM' && defined $tmp
+      ? map { _temp_key( $self->_stored_key($dest) ) } @$keys
+      : ();
+
+    my $on_reply = sub {
+        $error ||= $_[1] if RedisDB::_is_redisdb_error( $_[1] );
+    };
+
+    # add members to the result, for sorted sets @_ is a list of member,
+    # score pairs
+    my $emit = sub {
+        return unless @_;
+        if ( not defined $tmp ) {
+            if ( not $zset ) {
+                $result{$_} = 1 for @_;
+            }
+            else {
+                for ( my $i = 0 ; $i < @_ ; $i += 2 ) {
+                    my ( $member, $score ) = @_[ $i, $i + 1 ];
+                    if ( not exists $result{$member} or $op ne 'union' ) {
+                        $result{$member} = $score;
+                    }
+                    elsif ( $agg eq 'SUM' ) {
+                        $result{$member} += $score;
+                    }
+                    elsif ( $agg eq 'MIN' ? $score < $result{$member} : $score > $result{$member} ) {
+                        $result{$member} = $score;
+                    }
+                }
+            }
+        }
+        elsif ( not $zset ) {
+            $self->send_command( 'SADD', $tmp, @_, $on_reply );
+        }
+        else {
+            my @pairs;
+            for ( my $i = 0 ; $i < @_ ; $i += 2 ) {
+                push @pairs, $_[ $i + 1 ], $_[$i];
+            }
+            $self->send_command( 'ZADD', $tmp, ( $agg eq 'MIN' ? 'LT' : $agg eq 'MAX' ? 'GT' : () ),
+                @pairs, $on_reply );
+        }
+    };
+
+    if ( $op eq 'union' ) {
+        $self->_scan_keys(
+            ( $zset ? 'ZSCAN' : 'SSCAN' ),
+            $keys,
+            sub {
+                my ( $i, $page ) = @_;
+                return $emit->(@$page) unless $zset;
+                my @pairs;
+                for ( my $n = 0 ; $n < @$page ; $n += 2 ) {
+                    my ( $member, $score ) = @$page[ $n, $n + 1 ];
+                    if (@copies) {
+                        push @pairs, $score, $member;
+                    }
+                    elsif ( defined $tmp or not $seen[$i]{$member}++ ) {
+                        push @pairs, $member, $score * $w->[$i];
+                    }
+                }
+                return unless @pairs;
+                return $emit->(@pairs) unless @copies;
+                $self->send_command( 'ZADD', $copies[$i], @pairs, $on_reply );
+            },
+            \$error
+        );
+    }
+    else {
+
+        # scan the smallest key for intersection, and the first for difference
+        my @keys = @$keys;
+        my @idx  = 0 .. $#keys;
+        if ( $op eq 'inter' ) {
+            my @card;
+            for my $i (@idx) {
+                $self->send_command( ( $zset ? 'ZCARD' : 'SCARD' ),
+                    $keys[$i], sub { $on_reply->(@_); $card[$i] = $_[1] } );
+            }
+            $self->mainloop;
+            @idx = sort { $card[$a] <=> $card[$b] } @idx unless $error;
+        }
+        my ( $first, @others ) = @idx;
+
+        $self->_scan_keys(
+            ( $zset ? 'ZSCAN' : 'SSCAN' ),
+            [ $keys[$first] ],
+            sub {
+                my $page = $_[1];
+                my ( @members, @scores );
+                if ($zset) {
+                    for ( my $i = 0 ; $i < @$page ; $i += 2 ) {
+                        push @members, $page->[$i];
+                        push @scores,  $page->[ $i + 1 ] * ( $w ? $w->[$first] : 1 );
+                    }
+                }
+                else {
+                    @members = @$page;
+                }
+                return unless @members;
+
+                # number of other keys that contain the member
+                my @found = (0) x @members;
+                my $done  = sub {
+                    my @keep = grep { $op eq 'inter' ? $found[$_] == @others : !$found[$_] }
+                      0 .. $#members;
+                    $emit->( $zset ? map { $members[$_], $scores[$_] } @keep : @members[@keep] );
+                };
+                return $done->() unless @others;
+                my $left = @others;
+                for my $j (@others) {
+                    $self->send_command(
+                        ( $zset ? 'ZMSCORE' : 'SMISMEMBER' ),
+                        $keys[$j], @members,
+                        sub {
+                            my $reply = $_[1];
+                            if ( RedisDB::_is_redisdb_error($reply) ) {
+                                $error ||= $reply;
+                                return;
+                            }
+                            for my $n ( 0 .. $#members ) {
+                                next unless $zset ? defined $reply->[$n] : $reply->[$n];
+                                $found[$n]++;
+                                next unless $zset and $op eq 'inter';
+                                my $score = $reply->[$n] * $w->[$j];
+                                if ( $agg eq 'SUM' ) {
+                                    $scores[$n] += $score;
+                                }
+                                elsif ( $agg eq 'MIN' ? $score < $scores[$n] : $score > $scores[$n] ) {
+                                    $scores[$n] = $score;
+                                }
+                            }
+                            $done->() unless --$left or $error;
+                        }
+                    );
+                }
+            },
+            \$error
+        ) unless $error;
+    }
+    $self->mainloop;
+
+    if (@copies) {
+        my $res = $error || $self->execute( 'ZUNIONSTORE', $tmp, scalar @copies, @copies, WEIGHTS => @$w );
+        $self->execute( 'DEL', @copies );
+        $error ||= $res if RedisDB::_is_redisdb_error($res);
+    }
+
+    if ( defined $tmp ) {
+        if ($error) {
+            $self->execute( 'DEL', $tmp );
+            return $error;
+        }
+        my $renamed = $self->execute( 'RENAME', $tmp, $dest );
+        if ( RedisDB::_is_redisdb_error($renamed) ) {
+            return $renamed unless $renamed =~ /no such key/i;
+            $self->execute( 'DEL', $dest );
+            return 0;
+        }
+        return $self->execute( ( $zset ? 'ZCARD' : 'SCARD' ), $dest );
+    }
+    return $error if $error;
+    return [ keys %result ] unless $zset;
+    my @members = sort { $result{$a} <=> $result{$b} or $a cmp $b } keys %result;
+    return [ $opts->{withscores} ? map { $_, $result{$_} } @members : @members ];
 }
 
 =head1 CLUSTER MANAGEMENT METHODS
@@ -622,7 +1182,7 @@ sub _connect_to_node {
             host        => $node->{host},
             port        => $node->{port},
             raise_error => 0,
-            password    => $self->{_password},
+            %{ $self->{_node_options} || {} },
         );
         $self->{_connections}{$host_key} = $redis->{_socket} ? $redis : undef;
     }
@@ -0,0 +1,253 @@
+package RedisDB::Coro;
+
+use strict;
+use warnings;
+our $VERSION = "2.57";
+$VERSION = eval $VERSION;
+
+use Carp;
+use Coro;
+use Coro::AnyEvent;
+use RedisDB;
+use Scalar::Util qw(weaken);
+use Try::Tiny;
+
+our @ISA = qw(RedisDB);
+
+=head1 NAME
+
+RedisDB::Coro - share one redis connection between many coroutines
+
+=head1 SYNOPSIS
+
+    use Coro;
+    use RedisDB::Coro;
+
+    my $redis = RedisDB::Coro->new( host => 'localhost' );
+    my @workers = map {
+        my $id = $_;
+        async {
+            # this only blocks the current coroutine
+            my $value = $redis->get("key:$id");
+            $redis->set( "copy:$id", $value );
+        };
+    } 1 .. 100;
+    $_->join for @workers;
+
+=head1 DESCRIPTION
+
+With plain L<RedisDB> object a coroutine that invokes a synchronous method,
+like C<< $redis->get($key) >>, blocks the whole process in I<recv> till the
+reply arrives. This class is a subclass of L<RedisDB> that makes synchronous
+methods cooperative. A coroutine that invokes I<execute> or a wrapper method
+without callback sends the command, and then sleeps till the reply is
+received, allowing other coroutines to run. Commands sent by different
+coroutines are pipelined over the same connection. A reader coroutine is
+started when there are commands waiting for replies, it waits till the socket
+becomes readable, parses replies, and wakes up coroutines in the order in
+which they sent their commands. When there are no more replies to wait for
+the reader exits.
+
+Waiting is done using L<Coro::AnyEvent>, so the program should use an
+L<AnyEvent> compatible event loop. Note, that connecting to the server is
+still a blocking operation.
+
+All methods of L<RedisDB> are available, the following behave differently:
+
+=over 4
+
+=item execute, wrapper methods without callback
+
+block only the current coroutine
+
+=item send_command, wrapper methods with callback
+
+start the reader if it is not running, so callbacks are invoked without any
+further calls to the object. Callbacks are invoked by the reader, so they must
+not wait for replies, start a new coroutine if you need to do that.
+
+=item mainloop, get_reply, get_all_replies
+
+block only the current coroutine till the replies are received
+
+=back
+
+Subscription mode is not supported, use a separate L<RedisDB> object in a
+separate process or thread for that. Also note, that commands from different
+coroutines are interleaved, so if you are using transactions you should make
+sure that only one coroutine uses the connection between MULTI or WATCH and
+the corresponding EXEC, e.g. by protecting it with L<Coro::Semaphore>.
+
+If the connection is lost, all coroutines waiting for replies get
+L<RedisDB::Error::DISCONNECTED> error, which is thrown or returned depending
+on the I<raise_error> setting. If I<timeout> is set and no data was received
+from the server for that long, waiting coroutines get
+L<RedisDB::Error::EAGAIN> error.
+
+=head1 METHODS
+
+=head2 $class->new(%options)
+
+accepts the following options of L<RedisDB> constructor: I<host>, I<port>,
+I<path>, I<password>, I<database>, I<url>, I<raise_error>, I<timeout>,
+I<utf8>, I<connection_name>, I<lazy>, I<reconnect_attempts>,
+I<reconnect_delay_max>, I<on_connect_error>, I<keepalive>,
+I<tcp_user_timeout>, I<value_codec>, I<key_map>, I<key_sampler>, and
+I<profiler>. Other options depend on waiting for the replies in the calling
+code and are not supported.
+
+=cut
+
+my %OPTIONS = map { $_ => 1 } qw(
+  host port path password database url raise_error timeout utf8
+  connection_name lazy reconnect_attempts reconnect_delay_max on_connect_error
+  keepalive tcp_user_timeout value_codec key_map key_sampler profiler
+);
+
+sub new {
+    my $class = shift;
+    my %params = ref $_[0] ? %{ $_[0] } : @_;
+    my @unsupported = sort grep { not $OPTIONS{$_} } keys %params;
+    croak "Options not supported by $class: @unsupported" if @unsupported;
+    return $class->SUPER::new(@_);
+}
+
+sub execute {
+    my $self = shift;
+    croak "You can't use RedisDB::execute when you have replies to fetch."
+      if $self->replies_to_fetch;
+    $self->_check_not_reader;
+    my $rouse = rouse_cb;
+    $self->send_command( @_, sub { $rouse->( $_[1] ) } );
+    my $res = rouse_wait $rouse;
+    if ( RedisDB::_is_redisdb_error($res)
+        and ( $self->{raise_error} or $self->{_in_multi} or $self->{_watching} ) )
+    {
+        croak $res;
+    }
+    return $res;
+}
+
+sub send_command {
+    my $self = shift;
+    my $res  = $self->SUPER::send_command(@_);
+    $self->_start_reader;
+    return $res;
+}
+
+sub mainloop {
+    my $self = shift;
+    return unless $self->{_parser};
+    croak "You can't call mainloop in the child process"
+      if $self->{_pid} and $self->{_pid} != $$;
+    $self->_check_not_reader;
+    while ( $self->{_parser}->callbacks ) {
+        $self->_wait_reader or return $self->SUPER::mainloop;
+    }
+    return;
+}
+
+sub get_reply {
+    my $self = shift;
+    $self->_check_not_reader;
+    while ( not @{ $self->{_replies} } and $self->{_to_be_fetched} ) {
+        $self->_wait_reader or last;
+    }
+    return $self->SUPER::get_reply;
+}
+
+sub subscription_loop {
+    croak "Subscriptions are not supported by " . ref shift;
+}
+
+sub subscribe {
+    croak "Subscriptions are not supported by " . ref shift;
+}
+
+sub psubscribe {
+    croak "Subscriptions are not supported by " . ref shift;
+}
+
+# pass the error to every coroutine waiting for reply before the parent class
+# resets the connection
+sub _on_disconnect {
+    my ( $self, $err, $error_obj ) = @_;
+    if ( $err and $self->{_parser} ) {
+        $error_obj ||= RedisDB::Error::DISCONNECTED->new(
+            "Server unexpectedly closed connection. Some data might have been lost.");
+        $self->{_parser}->propagate_reply($error_obj);
+    }
+    return $self->SUPER::_on_disconnect( $err, $error_obj );
+}
+
+# callbacks are invoked by the reader in the middle of parsing, the reader
+# can't wait for replies there
+sub _check_not_reader {
+    my $self = shift;
+    croak "You can't wait for replies inside a callback, start a new coroutine instead"
+      if $self->{_reader} and $self->{_reader} == $Coro::current;
+}
+
+# wait till the reader exits. Returns false if the reader couldn't be started
+sub _wait_reader {
+    my $self = shift;
+    $self->_start_reader;
+    my $reader = $self->{_reader} or return;
+    $reader->join;
+    return 1;
+}
+
+# start the coroutine that reads replies from the socket. The reader exits
+# when there are no more commands waiting for replies
+sub _start_reader {
+    my $self = shift;
+    return if $self->{_reader};
+    return unless $self->{_parser} and $self->{_parser}->callbacks;
+    weaken( my $redis = $self );
+    $self->{_reader} = async {
+        while ( $redis and $redis->{_parser} and $redis->{_parser}->callbacks ) {
+            my $socket = $redis->{_socket} or last;
+            try {
+                if ( Coro::AnyEvent::readable( $socket, $redis->{timeout} ) ) {
+                    $redis->_recv_data_nb;
+                }
+                else {
+                    $redis->_on_disconnect( 1,
+                        RedisDB::Error::EAGAIN->new("Timed out waiting reply from the server") );
+                }
+            }
+            catch {
+                # the error has been passed to the waiting coroutines already
+            };
+        }
+        delete $redis->{_reader}
+          if $redis
+          and $redis->{_reader}
+          and $redis->{_reader} == $Coro::current;
+    };
+    return;
+}
+
+1;
+
+__END__
+
+=head1 SEE ALSO
+
+L<RedisDB>, L<Coro>, L<Coro::AnyEvent>
+
+=head1 AUTHOR
+
+Pavel Shaydo, C<< <zwon at cpan.org> >>
+
+=head1 LICENSE AND COPYRIGHT
+
+Copyright 2011-2021 Pavel Shaydo.
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of either: the GNU General Public License as published
+by the Free Software Foundation; or the Artistic License.
+
+See http://dev.perl.org/licenses/ for more information.
+
+=cut
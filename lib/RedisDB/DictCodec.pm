@@ -0,0 +1,393 @@
+package RedisDB::DictCodec;
+
+use strict;
+use warnings;
+our $VERSION = "2.57";
+$VERSION = eval $VERSION;
+
+use Carp;
+use Compress::Raw::Zlib;
+use Time::HiRes qw(time);
+
+=head1 NAME
+
+RedisDB::DictCodec - compress small values using shared dictionaries
+
+=head1 SYNOPSIS
+
+    my $codec = RedisDB::DictCodec->new(
+        redis => RedisDB->new,
+        name  => 'users',
+    );
+    my $redis = RedisDB->new( value_codec => $codec );
+
+    # values are sampled while they are written
+    $redis->set( "user:$_->{id}", encode_json($_) ) for @users;
+
+    # build a new dictionary from the samples, store it in redis and start
+    # using it for new values
+    $codec->train;
+
+    # values are decompressed transparently
+    my $user = decode_json( $redis->get("user:42") );
+
+=head1 DESCRIPTION
+
+Generic compression doesn't help much for small values, as there is not
+enough data in a single value to find repetitions. But values stored in the
+same database are often very similar to each other, e.g. JSON documents with
+the same set of fields. This codec compresses values using deflate with a
+preset dictionary built from sample values, so the common parts of the values
+are encoded as references into the dictionary.
+
+Dictionaries are stored in redis and are versioned, every dictionary has a
+numeric ID that is stored together with the compressed value, so values that
+were compressed with older dictionaries can be decompressed after the new
+dictionary has been trained. All processes using the codec with the same
+I<name> pick up the current dictionary from redis, and load older
+dictionaries on demand when they need to decompress a value. Dictionaries are
+never deleted by the codec.
+
+Compressed values start with "\xffZD" followed by the dictionary ID. Values
+that are not compressed, because they are too small or too big, or because
+compression didn't make them smaller, are stored as is, unless they start
+with "\xffZ" in which case they are prefixed with "\xffZR".
+
+The dictionary is built by a simplified version of the COVER algorithm used
+by zstd: it counts in how many samples every 8 byte substring occurs, and then
+greedily selects 32 byte segments of samples that cover the most frequent
+substrings not yet covered by the dictionary. The most useful segments are
+placed at the end of the dictionary, as deflate encodes closer references
+more efficiently. As deflate can only reference the last 32KB, dictionary
+size is limited to 32KB.
+
+=head1 METHODS
+
+=cut
+
+my $TAG_DICT = "\xffZD";
+my $TAG_RAW  = "\xffZR";
+my $DMER     = 8;
+my $SEGMENT  = 32;
+
+=head2 $class->new(%params)
+
+create a new codec object. Accepts the following parameters:
+
+=over 4
+
+=item redis
+
+L<RedisDB> object that is used to store and load dictionaries, required. It
+should not be the same object that uses the codec, as dictionaries may be
+loaded while the object is processing a reply.
+
+=item name
+
+name of the codec. Dictionaries are stored in keys starting with
+"I<name>:dict:". Required.
+
+=item min_size
+
+values shorter than this are not compressed. Default is 32.
+
+=item max_size
+
+values longer than this are not compressed. Default is 65536.
+
+=item sample_rate
+
+fraction of the encoded values that are kept as samples for training. Default
+is 0.01.
+
+=item max_samples
+
+maximum number of kept samples. Default is 2000.
+
+=item dict_size
+
+size of the trained dictionary. Default is 16384, maximum is 32768.
+
+=item refresh_interval
+
+how often in seconds to check if there is a new current dictionary in redis.
+Default is 60.
+
+=item level
+
+compression level, default is 9
+
+=back
+
+=cut
+
+sub new {
+    my ( $class, %params ) = @_;
+    my $self = bless {
+        redis            => $params{redis} || croak('"redis" parameter is required'),
+        name             => $params{name}  || croak('"name" parameter is required'),
+        min_size         => $params{min_size}  || 32,
+        max_size         => $params{max_size}  || 65536,
+        sample_rate      => defined $params{sample_rate} ? $params{sample_rate} : 0.01,
+        max_samples      => $params{max_samples} || 2000,
+        dict_size        => $params{dict_size}   || 16384,
+        refresh_interval => $params{refresh_interval} || 60,
+        level            => defined $params{level} ? $params{level} : 9,
+        samples          => [],
+        dicts            => {},
+        stats            => {
+            encoded    => 0,
+            compressed => 0,
+            decoded    => 0,
+            bytes_in   => 0,
+            bytes_out  => 0,
+        },
+        _current    => 0,
+        _checked_at => 0,
+    }, $class;
+    $self->{dict_size} = 32768 if $self->{dict_size} > 32768;
+    return $self;
+}
+
+sub _key {
+    my ( $self, $suffix ) = @_;
+    return "$self->{name}:dict:$suffix";
+}
+
+=head2 $self->encode($value)
+
+return encoded I<$value>. Value must be a byte string.
+
+=cut
+
+sub encode {
+    my ( $self, $value ) = @_;
+    return $value unless defined $value;
+    croak "Can't compress string with wide characters" if utf8::is_utf8($value);
+    my $len = length $value;
+    $self->{stats}{encoded}++;
+    $self->{stats}{bytes_in} += $len;
+
+    if ( $len >= $self->{min_size} and $len <= $self->{max_size} ) {
+        $self->_sample($value);
+        my $id = $self->current_dict;
+        my ( $d, $status ) = Compress::Raw::Zlib::Deflate->new(
+            -WindowBits   => -MAX_WBITS,
+            -Level        => $self->{level},
+            -AppendOutput => 1,
+            ( $id ? ( -Dictionary => $self->_dict($id) ) : () ),
+        );
+        croak "Couldn't create deflate stream: $status" unless $d;
+        my $out = $TAG_DICT . pack( 'N', $id );
+        $d->deflate( $value, $out ) == Z_OK or croak "Couldn't compress value";
+        $d->flush($out) == Z_OK or croak "Couldn't compress value";
+        if ( length $out < $len ) {
+            $self->{stats}{compressed}++;
+            $self->{stats}{bytes_out} += length $out;
+            return $out;
+        }
+    }
+    $value = $TAG_RAW . $value if substr( $value, 0, 2 ) eq "\xffZ";
+    $self->{stats}{bytes_out} += length $value;
+    return $value;
+}
+
+=head2 $self->decode($value)
+
+return decoded I<$value>. Dictionary is loaded from redis if it is not in the
+cache yet.
+
+=cut
+
+sub decode {
+    my ( $self, $value ) = @_;
+    return $value unless defined $value and substr( $value, 0, 2 ) eq "\xffZ";
+    my $tag = substr $value, 0, 3;
+    return substr( $value, 3 ) if $tag eq $TAG_RAW;
+    return $value unless $tag eq $TAG_DICT and length $value >= 7;
+
+    $self->{stats}{decoded}++;
+    my $id = unpack 'N', substr( $value, 3, 4 );
+    my ( $i, $status ) = Compress::Raw::Zlib::Inflate->new(
+        -WindowBits   => -MAX_WBITS,
+        -AppendOutput => 1,
+        -ConsumeInput => 1,
+        ( $id ? ( -Dictionary => $self->_dict($id) ) : () ),
+    );
+    croak "Couldn't create inflate stream: $status" unless $i;
+    my $in  = substr $value, 7;
+    my $out = '';
+    $status = $i->inflate( $in, $out );
+    croak "Couldn't decompress value: $status" unless $status == Z_STREAM_END;
+    return $out;
+}
+
+# return dictionary with the given ID, load it from redis if needed
+sub _dict {
+    my ( $self, $id ) = @_;
+    return $self->{dicts}{$id} ||= do {
+        my $dict = $self->{redis}->get( $self->_key($id) );
+        croak "Dictionary $id for $self->{name} is not found" unless defined $dict;
+        $dict;
+    };
+}
+
+sub _sample {
+    my ( $self, $value ) = @_;
+    return unless $self->{sample_rate} and rand() < $self->{sample_rate};
+    my $samples = $self->{samples};
+    if ( @$samples < $self->{max_samples} ) {
+        push @$samples, $value;
+    }
+    else {
+        $samples->[ rand @$samples ] = $value;
+    }
+    return;
+}
+
+=head2 $self->current_dict
+
+return ID of the dictionary used to compress new values, 0 if there is no
+dictionary yet. The ID is checked in redis not more often than once in
+I<refresh_interval> seconds.
+
+=cut
+
+sub current_dict {
+    my $self = shift;
+    if ( time - $self->{_checked_at} >= $self->{refresh_interval} ) {
+        $self->{_checked_at} = time;
+        $self->{_current} = $self->{redis}->get( $self->_key('current') ) || 0;
+    }
+    return $self->{_current};
+}
+
+=head2 $self->add_samples(@values)
+
+add values to the samples used for training
+
+=cut
+
+sub add_samples {
+    my ( $self, @values ) = @_;
+    local $self->{sample_rate} = 1;
+    $self->_sample($_) for @values;
+    return;
+}
+
+=head2 $self->train([\@samples])
+
+build a new dictionary from I<@samples>, or from the samples collected by
+I<encode> and I<add_samples> if no samples are specified. The dictionary is
+stored in redis and becomes the current dictionary for all processes using
+the codec with the same name. Returns ID of the new dictionary.
+
+=cut
+
+sub train {
+    my ( $self, $samples ) = @_;
+    $samples ||= $self->{samples};
+    croak "No samples to train dictionary" unless @$samples;
+
+    my $dict = build_dictionary( $samples, $self->{dict_size} );
+    my $redis = $self->{redis};
+    my $id    = $redis->incr( $self->_key('next') );
+    $redis->set( $self->_key($id), $dict );
+    $redis->set( $self->_key('current'), $id );
+    $self->{dicts}{$id}  = $dict;
+    $self->{_current}    = $id;
+    $self->{_checked_at} = time;
+    $self->{samples}     = [] if $samples == $self->{samples};
+    return $id;
+}
+
+=head2 $self->stats
+
+return reference to a hash with the number of encoded, compressed, and
+decoded values, and the total size of values before and after encoding
+
+=cut
+
+sub stats {
+    return { %{ shift->{stats} } };
+}
+
+=head2 build_dictionary(\@samples, $size)
+
+build and return dictionary of the given I<$size> from I<@samples>
+
+=cut
+
+sub build_dictionary {
+    my ( $samples, $size ) = @_;
+
+    # in how many samples every dmer occurs
+    my %freq;
+    for my $sample (@$samples) {
+        my %seen;
+        for my $i ( 0 .. length($sample) - $DMER ) {
+            $seen{ substr $sample, $i, $DMER } = 1;
+        }
+        $freq{$_}++ for keys %seen;
+    }
+
+    # candidate segments with the number of samples containing their dmers
+    my @candidates;
+    for my $sample (@$samples) {
+        for ( my $pos = 0 ; $pos < length $sample ; $pos += $DMER ) {
+            my $segment = substr $sample, $pos, $SEGMENT;
+            next if length $segment < $DMER;
+            my $score = 0;
+            for my $i ( 0 .. length($segment) - $DMER ) {
+                my $f = $freq{ substr $segment, $i, $DMER };
+                $score += $f if $f > 1;
+            }
+            push @candidates, [ $score, $segment ] if $score;
+        }
+    }
+
+    # greedily take segments that cover the most frequent dmers, every dmer is
+    # counted only once
+    my ( @dict, $dict_size );
+    $dict_size = 0;
+    for ( sort { $b->[0] <=> $a->[0] } @candidates ) {
+        my $segment = $_->[1];
+        my $score   = 0;
+        for my $i ( 0 .. length($segment) - $DMER ) {
+            $score += $freq{ substr $segment, $i, $DMER } || 0;
+        }
+        next if $score < $_->[0] / 2 or $score < 2;
+        $freq{ substr $segment, $_, $DMER } = 0 for 0 .. length($segment) - $DMER;
+        push @dict, $segment;
+        $dict_size += length $segment;
+        last if $dict_size >= $size;
+    }
+
+    my $dict = join '', reverse @dict;
+    return substr $dict, -$size if length $dict > $size;
+    return $dict;
+}
+
+1;
+
+__END__
+
+=head1 SEE ALSO
+
+L<RedisDB>, L<Compress::Raw::Zlib>
+
+=head1 AUTHOR
+
+Pavel Shaydo, C<< <zwon at cpan.org> >>
+
+=head1 LICENSE AND COPYRIGHT
+
+Copyright 2011-2021 Pavel Shaydo.
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of either: the GNU General Public License as published
+by the Free Software Foundation; or the Artistic License.
+
+See http://dev.perl.org/licenses/ for more information.
+
+=cut
@@ -34,6 +34,9 @@ our @ISA = qw(RedisDB::Error);
 package RedisDB::Error::DISCONNECTED;
 our @ISA = qw(RedisDB::Error);
 
+package RedisDB::Error::OVERLOADED;
+our @ISA = qw(RedisDB::Error);
+
 package RedisDB::Error::MOVED;
 our @ISA = qw(RedisDB::Parser::Error::MOVED RedisDB::Error);
 
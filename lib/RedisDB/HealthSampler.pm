@@ -0,0 +1,408 @@
+package RedisDB::HealthSampler;
+
+use strict;
+use warnings;
+our $VERSION = "2.57";
+$VERSION = eval $VERSION;
+
+use Carp;
+use RedisDB;
+use Scalar::Util qw(looks_like_number);
+use Time::HiRes qw(time sleep);
+
+=head1 NAME
+
+RedisDB::HealthSampler - collect health metrics from redis servers
+
+=head1 SYNOPSIS
+
+    my $sampler = RedisDB::HealthSampler->new( cluster => $cluster );
+    $sampler->run(
+        10,
+        sub {
+            my $sample = shift;
+            for my $node ( keys %$sample ) {
+                my $s = $sample->{$node};
+                printf "%s: %.1f ops/s, rtt %.3fms\n", $node,
+                  $s->{rates}{total_commands_processed} || 0, 1000 * $s->{rtt};
+            }
+        }
+    );
+
+=head1 DESCRIPTION
+
+The sampler periodically collects INFO, LATENCY LATEST, SLOWLOG GET, and
+CLIENT LIST from a redis server or from all nodes of a cluster. All commands
+are sent to a node in one pipelined batch, and batches are sent to all nodes
+before waiting for replies, so sampling a cluster takes a single round trip.
+The sampler parses the replies into data structures, converts numeric fields
+into numbers, computes rates for counters from the difference with the
+previous sample, and adds round trip time measured by the client, so you can
+compare it with latency reported by the server.
+
+=head1 METHODS
+
+=cut
+
+# INFO fields that are counters. Some fields starting with "total_", like
+# total_system_memory and total_blocking_keys, are gauges
+my @COUNTERS = qw(
+  total_connections_received total_commands_processed total_net_input_bytes
+  total_net_output_bytes total_net_repl_input_bytes total_net_repl_output_bytes
+  total_reads_processed total_writes_processed total_error_replies total_forks
+  total_eviction_exceeded_time total_active_defrag_time
+  expired_keys expired_time_cap_reached_count expire_cycle_cpu_milliseconds
+  evicted_keys evicted_clients keyspace_hits keyspace_misses
+  rejected_connections sync_full sync_partial_ok sync_partial_err
+  unexpected_error_replies dump_payload_sanitizations
+  io_threaded_reads_processed io_threaded_writes_processed
+  client_query_buffer_limit_disconnections client_output_buffer_limit_disconnections
+  acl_access_denied_auth acl_access_denied_cmd acl_access_denied_key
+  acl_access_denied_channel used_cpu_sys used_cpu_user used_cpu_sys_children
+  used_cpu_user_children
+);
+
+=head2 $class->new(%params)
+
+create a new sampler. Accepts the following parameters:
+
+=over 4
+
+=item redis
+
+L<RedisDB> object connected to the server
+
+=item cluster
+
+L<RedisDB::Cluster> object, all nodes of the cluster are sampled. You must
+specify either I<redis> or I<cluster>.
+
+=item slowlog
+
+number of SLOWLOG entries to fetch, default is 10
+
+=back
+
+=cut
+
+sub new {
+    my ( $class, %params ) = @_;
+    croak 'either "redis" or "cluster" parameter is required'
+      unless $params{redis} or $params{cluster};
+    my $self = {
+        redis    => $params{redis},
+        cluster  => $params{cluster},
+        slowlog  => $params{slowlog} || 10,
+        counters => { map { $_ => 1 } @COUNTERS },
+        _prev    => {},
+    };
+    return bless $self, $class;
+}
+
+sub _nodes {
+    my $self = shift;
+    if ( my $cluster = $self->{cluster} ) {
+        my %nodes;
+        for ( @{ $cluster->{_nodes} } ) {
+            my $redis = $cluster->_connect_to_node($_) or next;
+            $nodes{"$_->{host}:$_->{port}"} = $redis;
+        }
+        return \%nodes;
+    }
+    my $redis = $self->{redis};
+    return { ( $redis->{path} || "$redis->{host}:$redis->{port}" ) => $redis };
+}
+
+=head2 $self->sample
+
+collect metrics from all nodes and return them as a reference to a hash. Keys
+of the hash are node addresses, values are hashes with the following
+elements:
+
+=over 4
+
+=item time
+
+time when the sample was taken
+
+=item rtt
+
+time in seconds between sending the commands to the node and receiving the
+last reply as observed by the client
+
+=item info
+
+INFO output as a hash of sections, each section is a hash of fields. Numeric
+values are converted into numbers, values that are lists of I<key=value>
+pairs, like the ones in "keyspace" or "commandstats" sections, are converted
+into hashes.
+
+=item keyspace
+
+shortcut to the "keyspace" section of the I<info>
+
+=item rates
+
+per second rates for the counters, computed using the previous sample. The
+keys are field names, for commandstats fields the rates for "calls" and "usec"
+are included using names like "cmdstat_get.calls". Absent in the first
+sample.
+
+=item latency
+
+LATENCY LATEST output as a hash with event names as keys. Each element is a
+hash with "time", "latest", and "max" elements.
+
+=item slowlog
+
+SLOWLOG GET output as a list of hashes with "id", "time", "duration",
+"command", "client", and "client_name" elements.
+
+=item clients
+
+summary of CLIENT LIST output: total number of clients, number of "blocked"
+and "pubsub" clients, maximum "idle" time, maximum "qbuf", maximum and total
+"omem".
+
+=item errors
+
+if some of the commands failed, hash with command names as keys and errors as
+values
+
+=back
+
+=cut
+
+sub sample {
+    my $self  = shift;
+    my $nodes = $self->_nodes;
+
+    my %sample;
+    for my $node ( keys %$nodes ) {
+        my $redis = $nodes->{$node};
+        my $s = $sample{$node} = { time => time, errors => {} };
+        my $start = time;
+        my $cb    = sub {
+            my ( $name, $parse ) = @_;
+            return sub {
+                my ( $redis, $reply ) = @_;
+                $s->{rtt} = time - $start;
+                if ( ref($reply) =~ /^RedisDB::Error/ ) {
+                    $s->{errors}{$name} = "$reply";
+                }
+                else {
+                    $parse->($reply);
+                }
+            };
+        };
+        $redis->send_command( 'INFO', 'ALL',
+            $cb->( info => sub { $s->{info} = _parse_info_sections(shift) } ) );
+        $redis->send_command( 'LATENCY', 'LATEST',
+            $cb->( latency => sub { $s->{latency} = _parse_latency(shift) } ) );
+        $redis->send_command( 'SLOWLOG', 'GET', $self->{slowlog},
+            $cb->( slowlog => sub { $s->{slowlog} = _parse_slowlog(shift) } ) );
+        $redis->send_command(
+            'CLIENT', 'LIST',
+            $cb->(
+                clients => sub {
+                    $s->{clients} = _summarize_clients( RedisDB::_parse_client_list(shift) );
+                }
+            )
+        );
+    }
+    $self->_wait_replies( values %$nodes );
+
+    for my $node ( keys %sample ) {
+        my $s = $sample{$node};
+        $s->{keyspace} = $s->{info}{keyspace} if $s->{info};
+        if ( my $prev = $self->{_prev}{$node} ) {
+            $s->{rates} = $self->_rates( $prev, $s );
+        }
+    }
+    $self->{_prev} = \%sample;
+
+    return \%sample;
+}
+
+# wait for the replies from all nodes at once and process the replies of a node
+# as soon as they arrive, so the round trip time of a node doesn't include the
+# time spent waiting for other nodes. Nodes that don't reply within a second or
+# lost the connection are left to mainloop, which handles timeouts and errors
+sub _wait_replies {
+    my ( $self, @nodes ) = @_;
+    while ( my @busy = grep { $_->{_parser} and $_->{_parser}->callbacks } @nodes ) {
+        my @ready = grep { $_->{_socket} } @busy;
+        my $rin   = '';
+        vec( $rin, fileno $_->{_socket}, 1 ) = 1 for @ready;
+        my $rout = $rin;
+        if ( @ready < @busy or select( $rout, undef, undef, 1 ) <= 0 ) {
+            $_->mainloop for @busy;
+            last;
+        }
+        $_->reply_ready for grep { vec( $rout, fileno $_->{_socket}, 1 ) } @ready;
+    }
+    return;
+}
+
+=head2 $self->run($interval, \&callback)
+
+take a sample every I<$interval> seconds and pass it to the I<callback>. The
+method returns when the callback returns false.
+
+=cut
+
+sub run {
+    my ( $self, $interval, $cb ) = @_;
+    while (1) {
+        my $start = time;
+        $cb->( $self->sample ) or last;
+        my $left = $interval - ( time - $start );
+        sleep $left if $left > 0;
+    }
+    return;
+}
+
+sub _is_counter {
+    my ( $self, $field ) = @_;
+    return $self->{counters}{$field};
+}
+
+sub _rates {
+    my ( $self, $prev, $cur ) = @_;
+    return unless $prev->{info} and $cur->{info};
+    my $elapsed = $cur->{time} - $prev->{time};
+    return unless $elapsed > 0;
+
+    my %rates;
+    for my $section ( keys %{ $cur->{info} } ) {
+        my $old = $prev->{info}{$section} or next;
+        my $new = $cur->{info}{$section};
+        for my $field ( keys %$new ) {
+            next unless defined $old->{$field};
+            if ( ref $new->{$field} ) {
+                next unless $field =~ /^cmdstat_/;
+                for (qw(calls usec)) {
+                    next unless defined $old->{$field}{$_} and defined $new->{$field}{$_};
+                    $rates{"$field.$_"} = ( $new->{$field}{$_} - $old->{$field}{$_} ) / $elapsed;
+                }
+            }
+            elsif ( $self->_is_counter($field)
+                and looks_like_number( $new->{$field} )
+                and looks_like_number( $old->{$field} ) )
+            {
+                $rates{$field} = ( $new->{$field} - $old->{$field} ) / $elapsed;
+            }
+        }
+    }
+    return \%rates;
+}
+
+sub _value {
+    my $value = shift;
+    return $value + 0 if $value =~ /^-?[0-9]+(?:\.[0-9]+)?$/;
+    return $value;
+}
+
+sub _parse_info_sections {
+    my $info = shift;
+    my %sections;
+    my $section = $sections{default} = {};
+    for ( split /\r?\n/, $info ) {
+        if (/^# (.+)$/) {
+            $section = $sections{ lc $1 } ||= {};
+        }
+        elsif (/^([^:]+):(.*)$/) {
+            my ( $field, $value ) = ( $1, $2 );
+
+            # db0:keys=1,expires=0,avg_ttl=0
+            if ( $value =~ /^[a-z_]+=[^,]*(?:,[a-z_]+=[^,]*)*$/ ) {
+                $section->{$field} = {
+                    map { my ( $k, $v ) = split /=/, $_, 2; ( $k => _value($v) ) }
+                      split /,/, $value
+                };
+            }
+            else {
+                $section->{$field} = _value($value);
+            }
+        }
+    }
+    delete $sections{default} unless %{ $sections{default} };
+    return \%sections;
+}
+
+sub _parse_latency {
+    my $reply = shift;
+    my %latency;
+    for (@$reply) {
+        my ( $event, $time, $latest, $max ) = @$_;
+        $latency{$event} = {
+            time   => $time,
+            latest => $latest,
+            max    => $max,
+        };
+    }
+    return \%latency;
+}
+
+sub _parse_slowlog {
+    my $reply = shift;
+    return [
+        map {
+            {
+                id          => $_->[0],
+                time        => $_->[1],
+                duration    => $_->[2],
+                command     => $_->[3],
+                client      => $_->[4],
+                client_name => $_->[5],
+            }
+        } @$reply
+    ];
+}
+
+sub _summarize_clients {
+    my $clients = shift;
+    my %summary = (
+        count    => scalar @$clients,
+        blocked  => 0,
+        pubsub   => 0,
+        max_idle => 0,
+        max_qbuf => 0,
+        max_omem => 0,
+        omem     => 0,
+    );
+    for (@$clients) {
+        $summary{blocked}++ if ( $_->{flags} || '' ) =~ /b/;
+        $summary{pubsub}++ if ( $_->{sub} || 0 ) + ( $_->{psub} || 0 ) > 0;
+        for my $field (qw(idle qbuf omem)) {
+            my $value = $_->{$field} || 0;
+            $summary{"max_$field"} = $value if $value > $summary{"max_$field"};
+        }
+        $summary{omem} += $_->{omem} || 0;
+    }
+    return \%summary;
+}
+
+1;
+
+__END__
+
+=head1 SEE ALSO
+
+L<RedisDB>, L<RedisDB::Cluster>
+
+=head1 AUTHOR
+
+Pavel Shaydo, C<< <zwon at cpan.org> >>
+
+=head1 LICENSE AND COPYRIGHT
+
+Copyright 2011-2021 Pavel Shaydo.
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of either: the GNU General Public License as published
+by the Free Software Foundation; or the Artistic License.
+
+See http://dev.perl.org/licenses/ for more information.
+
+=cut
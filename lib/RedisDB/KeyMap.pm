@@ -0,0 +1,214 @@
+package RedisDB::KeyMap;
+
+use strict;
+use warnings;
+our $VERSION = "2.57";
+$VERSION = eval $VERSION;
+
+use Carp;
+use RedisDB::KeySpec;
+
+=head1 NAME
+
+RedisDB::KeyMap - replace long key prefixes with short codes
+
+=head1 SYNOPSIS
+
+    my $map = RedisDB::KeyMap->new(
+        prefixes => {
+            'production:service-name:user-profile:v3:' => 'up3:',
+            'production:service-name:session:'         => 'ss:',
+        },
+    );
+    my $redis = RedisDB->new( host => 'cache', key_map => $map );
+
+    # stored as "up3:1234567"
+    $redis->set( 'production:service-name:user-profile:v3:1234567', $profile );
+
+    # returns "production:service-name:session:..." keys
+    my $sessions = $redis->keys('production:service-name:session:*');
+
+=head1 DESCRIPTION
+
+Keys often start with long prefixes made of the environment, service, and
+entity names. With a lot of small keys the prefixes take a considerable part
+of the server memory and of the traffic. The key map replaces registered
+prefixes with short codes in the key arguments of the commands sent through
+L<RedisDB> or L<RedisDB::Cluster>, and replaces codes back with the prefixes
+in the keys returned by KEYS, SCAN, RANDOMKEY, blocking list and sorted set
+pops, and XREAD, so the application code uses the original names.
+
+Keys are found in the arguments using the known key positions of the commands,
+including commands with the number of keys in the arguments, like EVAL,
+ZUNIONSTORE, and XREAD. Arguments of other commands, keys in the options like
+STORE of SORT and GEORADIUS, and keys in the replies to the commands inside
+MULTI/EXEC are not mapped. The pattern of KEYS and the MATCH option of SCAN
+are mapped if they start with a registered prefix, so a pattern matching only
+a part of the prefix doesn't find mapped keys.
+
+Prefixes and codes can't contain braces, so hash tags in the keys stay the
+same and keys with the same tag remain in the same cluster slot. No code may
+start with a prefix or another code, and no prefix may start with a code, so
+mapping is unambiguous and mapping a key twice doesn't change it. Keys that
+are not mapped must not start with any of the codes, otherwise they would be
+returned with the prefix in the replies, so choose codes that don't occur in
+other keys, e.g. starting with a character not used otherwise.
+
+Note that all clients that access the keys must use the same map.
+
+=head1 METHODS
+
+=cut
+
+# commands that return keys: all - list of keys, scan - cursor and list of
+# keys, scalar - the key, first - the first element of the list, streams -
+# list of key and entries pairs
+my %REPLY = (
+    KEYS      => 'all',
+    SCAN      => 'scan',
+    RANDOMKEY => 'scalar',
+    ( map { $_ => 'first' } qw(BLPOP BRPOP BZPOPMIN BZPOPMAX BLMPOP BZMPOP LMPOP ZMPOP) ),
+    ( map { $_ => 'streams' } qw(XREAD XREADGROUP) ),
+);
+
+=head2 $class->new(prefixes => \%prefixes)
+
+create a new key map. I<%prefixes> maps prefixes to their codes.
+
+=cut
+
+sub new {
+    my ( $class, %params ) = @_;
+    my $prefixes = $params{prefixes};
+    croak "prefixes must be a hash reference" unless ref $prefixes eq 'HASH' and %$prefixes;
+    my %codes;
+    for my $prefix ( keys %$prefixes ) {
+        my $code = $prefixes->{$prefix};
+        croak "Empty prefix or code" unless length $prefix and defined $code and length $code;
+        croak "Prefixes and codes can't contain braces: $prefix => $code" if "$prefix$code" =~ /[{}]/;
+        croak "Code $code is used for $codes{$code} and $prefix" if exists $codes{$code};
+        croak "Code $code is not shorter than prefix $prefix" unless length $code < length $prefix;
+        $codes{$code} = $prefix;
+    }
+    for my $code ( keys %codes ) {
+        for ( grep { $_ ne $code } keys %codes ) {
+            croak "Code $code starts with code $_" if index( $code, $_ ) == 0;
+        }
+        for ( keys %$prefixes ) {
+            croak "Prefix $_ starts with code $code" if index( $_, $code ) == 0;
+        }
+    }
+    my $alt = sub {
+        my $re = join '|', map { quotemeta } sort { length $b <=> length $a } @_;
+        return qr/^($re)/;
+    };
+    return bless {
+        _prefixes  => {%$prefixes},
+        _codes     => \%codes,
+        _encode_re => $alt->( keys %$prefixes ),
+        _decode_re => $alt->( keys %codes ),
+    }, $class;
+}
+
+=head2 $self->encode($key)
+
+return the key with the prefix replaced by the code
+
+=cut
+
+sub encode {
+    my ( $self, $key ) = @_;
+    return $key unless defined $key and $key =~ $self->{_encode_re};
+    return $self->{_prefixes}{$1} . substr( $key, length $1 );
+}
+
+=head2 $self->decode($key)
+
+return the key with the code replaced by the prefix
+
+=cut
+
+sub decode {
+    my ( $self, $key ) = @_;
+    return $key unless defined $key and $key =~ $self->{_decode_re};
+    return $self->{_codes}{$1} . substr( $key, length $1 );
+}
+
+# return the arguments with the keys and patterns mapped
+sub _encode_args {
+    my ( $self, $command, @args ) = @_;
+    $args[$_] = $self->encode( $args[$_] ) for RedisDB::KeySpec::_key_indexes( $command, \@args );
+    if ( $command eq 'KEYS' ) {
+        $args[0] = $self->encode( $args[0] );
+    }
+    elsif ( $command eq 'SCAN' ) {
+        for my $i ( 1 .. $#args - 1 ) {
+            $args[ $i + 1 ] = $self->encode( $args[ $i + 1 ] ) if uc $args[$i] eq 'MATCH';
+        }
+    }
+    return @args;
+}
+
+# return the reply with the keys mapped back
+sub _decode_reply {
+    my ( $self, $command, $reply ) = @_;
+    my $type = $REPLY{$command} or return $reply;
+    return $reply if RedisDB::_is_redisdb_error($reply);
+    if ( $type eq 'scalar' ) {
+        return $self->decode($reply) unless ref $reply;
+    }
+    elsif ( ref $reply eq 'ARRAY' ) {
+        if ( $type eq 'all' ) {
+            $_ = $self->decode($_) for @$reply;
+        }
+        elsif ( $type eq 'scan' ) {
+            $_ = $self->decode($_) for ref $reply->[1] ? @{ $reply->[1] } : ();
+        }
+        elsif ( $type eq 'first' ) {
+            $reply->[0] = $self->decode( $reply->[0] ) if @$reply;
+        }
+        else {
+            $_->[0] = $self->decode( $_->[0] ) for grep { ref eq 'ARRAY' } @$reply;
+        }
+    }
+    return $reply;
+}
+
+# map the keys in the arguments and wrap the callback into a function that
+# maps keys in the reply back
+sub _apply {
+    my ( $self, $command, $callback, @args ) = @_;
+    @args = $self->_encode_args( $command, @args );
+    if ( $REPLY{$command} ) {
+        my $cb = $callback;
+        $callback = sub {
+            my ( $redis, $reply, @rest ) = @_;
+            $cb->( $redis, $self->_decode_reply( $command, $reply ), @rest );
+        };
+    }
+    return ( $callback, @args );
+}
+
+1;
+
+__END__
+
+=head1 SEE ALSO
+
+L<RedisDB>, L<RedisDB::Cluster>
+
+=head1 AUTHOR
+
+Pavel Shaydo, C<< <zwon at cpan.org> >>
+
+=head1 LICENSE AND COPYRIGHT
+
+Copyright 2011-2021 Pavel Shaydo.
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of either: the GNU General Public License as published
+by the Free Software Foundation; or the Artistic License.
+
+See http://dev.perl.org/licenses/ for more information.
+
+=cut
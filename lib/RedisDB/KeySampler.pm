@@ -0,0 +1,310 @@
+package RedisDB::KeySampler;
+
+use strict;
+use warnings;
+our $VERSION = "2.57";
+$VERSION = eval $VERSION;
+
+use Carp;
+use Digest::MD5 qw(md5);
+use Time::HiRes qw(time);
+
+=head1 NAME
+
+RedisDB::KeySampler - sample keys accessed by the client for cache simulation
+
+=head1 SYNOPSIS
+
+    my $sampler = RedisDB::KeySampler->new(
+        rate => 0.01,
+        file => '/tmp/redis-keys.sample',
+    );
+    my $redis = RedisDB->new( host => 'cache', key_sampler => $sampler );
+
+    ...;
+
+    # util/cache_sim.pl --target 0.95 /tmp/redis-keys.sample
+
+=head1 DESCRIPTION
+
+To choose I<maxmemory> and the eviction policy you need to know how the hit
+rate depends on the cache size, i.e. the miss ratio curve. The sampler
+records keys accessed by read and write commands sent through L<RedisDB>
+object, together with the sizes of the values, taken from the replies for
+reads and from the arguments for writes, and TTLs. The sample can be replayed
+by F<util/cache_sim.pl> through simulated caches of different sizes using
+LRU, LFU, and volatile TTL eviction, the same approximated algorithms redis
+uses.
+
+The keys are sampled spatially: a key is sampled if its hash is below the
+I<rate>, so either all accesses to the key are recorded or none. The sample
+preserves reuse distances of the keys, and a cache of size I<S> fed with the
+sample behaves as a cache of size I<S/rate> fed with the full traffic.
+Sampling by hash also means that all clients using the same rate sample the
+same keys, so samples from many processes may be merged.
+
+Keys are not recorded in the sample, only their hashes and lengths. Only
+commands with a single key or a list of keys are sampled: strings, whole
+hashes, sets, lists, and sorted sets, and DEL, EXPIRE, and PEXPIRE. Commands
+that read a part of the value record the access with unknown size.
+
+=head1 METHODS
+
+=cut
+
+# command => [ operation, key arguments, size ]
+#   operations: r - read, w - write with the absolute size, a - write that
+#   adds the size, d - delete, e - expire
+#   keys: first - first argument, all - all arguments, pairs - every other
+#   argument
+#   size: reply - size of the reply, part - unknown, or the index of the
+#   argument with the value, values - all arguments after the key
+my %COMMANDS = (
+    GET       => [ r => first => 'reply' ],
+    MGET      => [ r => all   => 'reply' ],
+    HGETALL   => [ r => first => 'reply' ],
+    SMEMBERS  => [ r => first => 'reply' ],
+    GETRANGE  => [ r => first => 'part' ],
+    STRLEN    => [ r => first => 'part' ],
+    HGET      => [ r => first => 'part' ],
+    HMGET     => [ r => first => 'part' ],
+    HEXISTS   => [ r => first => 'part' ],
+    HLEN      => [ r => first => 'part' ],
+    LINDEX    => [ r => first => 'part' ],
+    LLEN      => [ r => first => 'part' ],
+    LRANGE    => [ r => first => 'part' ],
+    SCARD     => [ r => first => 'part' ],
+    SISMEMBER => [ r => first => 'part' ],
+    ZCARD     => [ r => first => 'part' ],
+    ZRANGE    => [ r => first => 'part' ],
+    ZRANK     => [ r => first => 'part' ],
+    ZSCORE    => [ r => first => 'part' ],
+    SET       => [ w => first => 1 ],
+    SETNX     => [ w => first => 1 ],
+    GETSET    => [ w => first => 1 ],
+    SETEX     => [ w => first => 2 ],
+    PSETEX    => [ w => first => 2 ],
+    MSET      => [ w => pairs => 1 ],
+    INCR      => [ w => first => 'counter' ],
+    INCRBY    => [ w => first => 'counter' ],
+    DECR      => [ w => first => 'counter' ],
+    DECRBY    => [ w => first => 'counter' ],
+    APPEND    => [ a => first => 'values' ],
+    HSET      => [ a => first => 'values' ],
+    HMSET     => [ a => first => 'values' ],
+    LPUSH     => [ a => first => 'values' ],
+    RPUSH     => [ a => first => 'values' ],
+    SADD      => [ a => first => 'values' ],
+    ZADD      => [ a => first => 'values' ],
+    DEL       => [ d => all   => 'part' ],
+    UNLINK    => [ d => all   => 'part' ],
+    EXPIRE    => [ e => first => 'part' ],
+    PEXPIRE   => [ e => first => 'part' ],
+);
+
+=head2 $class->new(%params)
+
+create a new sampler. Accepts the following parameters:
+
+=over 4
+
+=item rate
+
+fraction of keys to sample, default is 0.01
+
+=item file
+
+if specified, accesses are appended to this file as they are recorded, and
+not kept in memory. Every access is written with a single system call, so
+forked processes may share the file.
+
+=item max_events
+
+maximum number of accesses kept in memory if I<file> is not specified,
+after that new accesses are not recorded. Default is 1000000.
+
+=back
+
+=cut
+
+sub new {
+    my ( $class, %params ) = @_;
+    my $rate = defined $params{rate} ? $params{rate} : 0.01;
+    croak "rate must be between 0 and 1" unless $rate > 0 and $rate <= 1;
+    my $self = bless {
+        rate       => $rate,
+        file       => $params{file},
+        max_events => $params{max_events} || 1_000_000,
+        _threshold => $rate * 4294967296,
+        _events    => [],
+    }, $class;
+    return $self;
+}
+
+sub _sampled {
+    my ( $self, $key ) = @_;
+    return unpack( 'N', md5($key) ) < $self->{_threshold};
+}
+
+# wrap the callback if the command accesses sampled keys
+sub _wrap {
+    my ( $self, $command, $args, $callback ) = @_;
+    my $spec = $COMMANDS{$command} or return $callback;
+    my ( $op, $keys, $size ) = @$spec;
+    my @keys =
+        $keys eq 'first' ? 0
+      : $keys eq 'all'   ? ( 0 .. $#$args )
+      :                    map { 2 * $_ } 0 .. $#$args / 2;
+    @keys = grep { defined $args->[$_] and $self->_sampled( $args->[$_] ) } @keys;
+    return $callback unless @keys;
+    $args = [@$args];
+
+    my $time = time;
+    my $ttl  = 0;
+    if ( $command eq 'SET' ) {
+        for my $i ( 2 .. $#$args - 1 ) {
+            $ttl = $args->[ $i + 1 ] * 1000 if uc $args->[$i] eq 'EX';
+            $ttl = $args->[ $i + 1 ]        if uc $args->[$i] eq 'PX';
+        }
+    }
+    elsif ( $command eq 'SETEX' or $command eq 'EXPIRE' ) {
+        $ttl = $args->[1] * 1000;
+    }
+    elsif ( $command eq 'PSETEX' or $command eq 'PEXPIRE' ) {
+        $ttl = $args->[1];
+    }
+
+    return sub {
+        my ( $redis, $reply ) = @_;
+        unless ( RedisDB::_is_redisdb_error($reply) ) {
+            for my $i (@keys) {
+                my $value;
+                if ( $size eq 'reply' ) {
+                    $value = $keys eq 'all' ? $reply->[$i] : $reply;
+
+                    # the key doesn't exist
+                    next if not defined $value or ref $value and not @$value;
+                    $value = _size($value);
+                }
+                elsif ( $size eq 'part' ) {
+                    next if $op eq 'r' and not defined $reply;
+                    $value = 0;
+                }
+                elsif ( $size eq 'counter' ) {
+                    $value = 8;
+                }
+                elsif ( $size eq 'values' ) {
+                    $value = 0;
+                    $value += length for @$args[ 1 .. $#$args ];
+                }
+                else {
+                    $value = length $args->[ $i + $size ];
+                }
+                $self->_record( $time, $op, $args->[$i], $value, $ttl );
+            }
+        }
+        $callback->(@_);
+    };
+}
+
+sub _size {
+    my $value = shift;
+    return length $value unless ref $value;
+    my $size = 0;
+    $size += defined $_ ? length : 0 for @$value;
+    return $size;
+}
+
+sub _record {
+    my ( $self, $time, $op, $key, $size, $ttl ) = @_;
+    my $event = sprintf "%.3f %s %s %d %d %d\n", $time, $op, unpack( 'H16', md5($key) ), length $key, $size,
+      $ttl;
+    if ( $self->{file} ) {
+        syswrite $self->_file_handle, $event;
+    }
+    elsif ( @{ $self->{_events} } < $self->{max_events} ) {
+        push @{ $self->{_events} }, $event;
+    }
+    return;
+}
+
+sub _header {
+    my $self = shift;
+    return "# RedisDB key sample rate=$self->{rate}\n";
+}
+
+# open the file in append mode, lines are written without buffering, so the
+# lines written by different processes are not mixed
+sub _file_handle {
+    my $self = shift;
+    return $self->{_fh} if $self->{_fh};
+    my $new = not -s $self->{file};
+    open my $fh, '>>', $self->{file} or croak "Couldn't open $self->{file}: $!";
+    syswrite $fh, $self->_header if $new;
+    return $self->{_fh} = $fh;
+}
+
+=head2 $self->events
+
+return the list of recorded accesses. Every access is a line containing time,
+operation, hash of the key, length of the key, size of the value, and TTL in
+milliseconds. Operation is I<r> for reads, I<w> for writes that set the value,
+I<a> for writes that add to the value, I<d> for deletes, and I<e> for setting
+TTL. Size is 0 if it is not known.
+
+=cut
+
+sub events {
+    return @{ shift->{_events} };
+}
+
+=head2 $self->save($file)
+
+write the recorded accesses to I<$file> in the format expected by
+F<util/cache_sim.pl>
+
+=cut
+
+sub save {
+    my ( $self, $file ) = @_;
+    open my $fh, '>', $file or croak "Couldn't open $file: $!";
+    print $fh $self->_header, @{ $self->{_events} };
+    close $fh or croak "Couldn't write $file: $!";
+    return;
+}
+
+=head2 $self->reset
+
+forget recorded accesses
+
+=cut
+
+sub reset {
+    my $self = shift;
+    $self->{_events} = [];
+    return;
+}
+
+1;
+
+__END__
+
+=head1 SEE ALSO
+
+L<RedisDB>, L<https://www.usenix.org/conference/atc17/technical-sessions/presentation/waldspurger>
+
+=head1 AUTHOR
+
+Pavel Shaydo, C<< <zwon at cpan.org> >>
+
+=head1 LICENSE AND COPYRIGHT
+
+Copyright 2011-2021 Pavel Shaydo.
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of either: the GNU General Public License as published
+by the Free Software Foundation; or the Artistic License.
+
+See http://dev.perl.org/licenses/ for more information.
+
+=cut
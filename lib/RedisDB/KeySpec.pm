@@ -0,0 +1,272 @@
+package RedisDB::KeySpec;
+
+use strict;
+use warnings;
+our $VERSION = "2.57";
+$VERSION = eval $VERSION;
+
+=head1 NAME
+
+RedisDB::KeySpec - positions of the keys in the arguments of the commands
+
+=head1 DESCRIPTION
+
+This module is used internally by L<RedisDB::Cluster> to find the key that
+determines the slot of the command, and by L<RedisDB::KeyMap> and the near
+cache of L<RedisDB> to find all keys of the command. It has no public
+interface.
+
+=cut
+
+# use util/generate_key_positions.pl to generate this
+# command / [ first key, last key, step ], positions include the command
+# name, negative last key position is counted from the end
+my %key_pos = (
+    append               => [ 1, 1, 1 ],
+    bitcount             => [ 1, 1, 1 ],
+    bitfield             => [ 1, 1, 1 ],
+    bitfield_ro          => [ 1, 1, 1 ],
+    bitop                => [ 2, -1, 1 ],
+    bitpos               => [ 1, 1, 1 ],
+    blmove               => [ 1, 2, 1 ],
+    blpop                => [ 1, -2, 1 ],
+    brpop                => [ 1, -2, 1 ],
+    brpoplpush           => [ 1, 2, 1 ],
+    bzpopmax             => [ 1, -2, 1 ],
+    bzpopmin             => [ 1, -2, 1 ],
+    copy                 => [ 1, 2, 1 ],
+    decr                 => [ 1, 1, 1 ],
+    decrby               => [ 1, 1, 1 ],
+    del                  => [ 1, -1, 1 ],
+    dump                 => [ 1, 1, 1 ],
+    exists               => [ 1, -1, 1 ],
+    expire               => [ 1, 1, 1 ],
+    expireat             => [ 1, 1, 1 ],
+    geoadd               => [ 1, 1, 1 ],
+    geodist              => [ 1, 1, 1 ],
+    geohash              => [ 1, 1, 1 ],
+    geopos               => [ 1, 1, 1 ],
+    georadius            => [ 1, 1, 1 ],
+    georadius_ro         => [ 1, 1, 1 ],
+    georadiusbymember    => [ 1, 1, 1 ],
+    georadiusbymember_ro => [ 1, 1, 1 ],
+    geosearch            => [ 1, 1, 1 ],
+    geosearchstore       => [ 1, 2, 1 ],
+    get                  => [ 1, 1, 1 ],
+    getbit               => [ 1, 1, 1 ],
+    getdel               => [ 1, 1, 1 ],
+    getex                => [ 1, 1, 1 ],
+    getrange             => [ 1, 1, 1 ],
+    getset               => [ 1, 1, 1 ],
+    hdel                 => [ 1, 1, 1 ],
+    hexists              => [ 1, 1, 1 ],
+    hget                 => [ 1, 1, 1 ],
+    hgetall              => [ 1, 1, 1 ],
+    hincrby              => [ 1, 1, 1 ],
+    hincrbyfloat         => [ 1, 1, 1 ],
+    hkeys                => [ 1, 1, 1 ],
+    hlen                 => [ 1, 1, 1 ],
+    hmget                => [ 1, 1, 1 ],
+    hmset                => [ 1, 1, 1 ],
+    hrandfield           => [ 1, 1, 1 ],
+    hscan                => [ 1, 1, 1 ],
+    hset                 => [ 1, 1, 1 ],
+    hsetnx               => [ 1, 1, 1 ],
+    hstrlen              => [ 1, 1, 1 ],
+    hvals                => [ 1, 1, 1 ],
+    incr                 => [ 1, 1, 1 ],
+    incrby               => [ 1, 1, 1 ],
+    incrbyfloat          => [ 1, 1, 1 ],
+    lindex               => [ 1, 1, 1 ],
+    linsert              => [ 1, 1, 1 ],
+    llen                 => [ 1, 1, 1 ],
+    lmove                => [ 1, 2, 1 ],
+    lpop                 => [ 1, 1, 1 ],
+    lpos                 => [ 1, 1, 1 ],
+    lpush                => [ 1, 1, 1 ],
+    lpushx               => [ 1, 1, 1 ],
+    lrange               => [ 1, 1, 1 ],
+    lrem                 => [ 1, 1, 1 ],
+    lset                 => [ 1, 1, 1 ],
+    ltrim                => [ 1, 1, 1 ],
+    mget                 => [ 1, -1, 1 ],
+    migrate              => [ 3, 3, 1 ],
+    move                 => [ 1, 1, 1 ],
+    mset                 => [ 1, -1, 2 ],
+    msetnx               => [ 1, -1, 2 ],
+    object               => [ 2, 2, 1 ],
+    persist              => [ 1, 1, 1 ],
+    pexpire              => [ 1, 1, 1 ],
+    pexpireat            => [ 1, 1, 1 ],
+    pfadd                => [ 1, 1, 1 ],
+    pfcount              => [ 1, -1, 1 ],
+    pfdebug              => [ 2, 2, 1 ],
+    pfmerge              => [ 1, -1, 1 ],
+    psetex               => [ 1, 1, 1 ],
+    pttl                 => [ 1, 1, 1 ],
+    rename               => [ 1, 2, 1 ],
+    renamenx             => [ 1, 2, 1 ],
+    restore              => [ 1, 1, 1 ],
+    'restore-asking'     => [ 1, 1, 1 ],
+    rpop                 => [ 1, 1, 1 ],
+    rpoplpush            => [ 1, 2, 1 ],
+    rpush                => [ 1, 1, 1 ],
+    rpushx               => [ 1, 1, 1 ],
+    sadd                 => [ 1, 1, 1 ],
+    scard                => [ 1, 1, 1 ],
+    sdiff                => [ 1, -1, 1 ],
+    sdiffstore           => [ 1, -1, 1 ],
+    set                  => [ 1, 1, 1 ],
+    setbit               => [ 1, 1, 1 ],
+    setex                => [ 1, 1, 1 ],
+    setnx                => [ 1, 1, 1 ],
+    setrange             => [ 1, 1, 1 ],
+    sinter               => [ 1, -1, 1 ],
+    sinterstore          => [ 1, -1, 1 ],
+    sismember            => [ 1, 1, 1 ],
+    smembers             => [ 1, 1, 1 ],
+    smismember           => [ 1, 1, 1 ],
+    smove                => [ 1, 2, 1 ],
+    sort                 => [ 1, 1, 1 ],
+    spop                 => [ 1, 1, 1 ],
+    srandmember          => [ 1, 1, 1 ],
+    srem                 => [ 1, 1, 1 ],
+    sscan                => [ 1, 1, 1 ],
+    strlen               => [ 1, 1, 1 ],
+    substr               => [ 1, 1, 1 ],
+    sunion               => [ 1, -1, 1 ],
+    sunionstore          => [ 1, -1, 1 ],
+    touch                => [ 1, -1, 1 ],
+    ttl                  => [ 1, 1, 1 ],
+    type                 => [ 1, 1, 1 ],
+    unlink               => [ 1, -1, 1 ],
+    watch                => [ 1, -1, 1 ],
+    xack                 => [ 1, 1, 1 ],
+    xadd                 => [ 1, 1, 1 ],
+    xautoclaim           => [ 1, 1, 1 ],
+    xclaim               => [ 1, 1, 1 ],
+    xdel                 => [ 1, 1, 1 ],
+    xgroup               => [ 2, 2, 1 ],
+    xinfo                => [ 2, 2, 1 ],
+    xlen                 => [ 1, 1, 1 ],
+    xpending             => [ 1, 1, 1 ],
+    xrange               => [ 1, 1, 1 ],
+    xrevrange            => [ 1, 1, 1 ],
+    xsetid               => [ 1, 1, 1 ],
+    xtrim                => [ 1, 1, 1 ],
+    zadd                 => [ 1, 1, 1 ],
+    zcard                => [ 1, 1, 1 ],
+    zcount               => [ 1, 1, 1 ],
+    zdiffstore           => [ 1, 1, 1 ],
+    zincrby              => [ 1, 1, 1 ],
+    zinterstore          => [ 1, 1, 1 ],
+    zlexcount            => [ 1, 1, 1 ],
+    zmscore              => [ 1, 1, 1 ],
+    zpopmax              => [ 1, 1, 1 ],
+    zpopmin              => [ 1, 1, 1 ],
+    zrandmember          => [ 1, 1, 1 ],
+    zrange               => [ 1, 1, 1 ],
+    zrangebylex          => [ 1, 1, 1 ],
+    zrangebyscore        => [ 1, 1, 1 ],
+    zrangestore          => [ 1, 2, 1 ],
+    zrank                => [ 1, 1, 1 ],
+    zrem                 => [ 1, 1, 1 ],
+    zremrangebylex       => [ 1, 1, 1 ],
+    zremrangebyrank      => [ 1, 1, 1 ],
+    zremrangebyscore     => [ 1, 1, 1 ],
+    zrevrange            => [ 1, 1, 1 ],
+    zrevrangebylex       => [ 1, 1, 1 ],
+    zrevrangebyscore     => [ 1, 1, 1 ],
+    zrevrank             => [ 1, 1, 1 ],
+    zscan                => [ 1, 1, 1 ],
+    zscore               => [ 1, 1, 1 ],
+    zunionstore          => [ 1, 1, 1 ],
+);
+
+# commands added in redis 7, and subcommands with a key that redis 6.2 doesn't
+# report, so generate_key_positions.pl doesn't output them
+my %more_key_pos = (
+    expiretime  => [ 1, 1, 1 ],
+    pexpiretime => [ 1, 1, 1 ],
+    sort_ro     => [ 1, 1, 1 ],
+    memory      => [ 2, 2, 1 ],
+);
+@key_pos{ keys %more_key_pos } = values %more_key_pos;
+
+# commands with movable keys, generate_key_positions.pl skips them: position
+# of the number of keys, keys follow the number. The STORE variants of ZUNION,
+# ZINTER, and ZDIFF also have the destination at the position from %key_pos
+my %numkeys_pos = (
+    ( map { $_ => 2 } qw(eval evalsha eval_ro evalsha_ro fcall fcall_ro blmpop bzmpop) ),
+    ( map { $_ => 1 } qw(zunion zinter zdiff zintercard sintercard lmpop zmpop) ),
+    ( map { $_ => 2 } qw(zunionstore zinterstore zdiffstore) ),
+);
+
+# return the list of the commands that have keys
+sub _commands {
+    my %commands = map { $_ => 1 } keys %key_pos, keys %numkeys_pos;
+    return keys %commands;
+}
+
+# return position of the first key of the command including the command name,
+# the key that is used to route the command in the cluster. Commands with
+# movable keys are routed by the destination or the first source key
+sub _first_key {
+    my $command = lc shift;
+    return $key_pos{$command}[0] if $key_pos{$command};
+    return $numkeys_pos{$command} + 1 if $numkeys_pos{$command};
+    return;
+}
+
+# return indexes of the keys in the arguments of the command
+sub _key_indexes {
+    my ( $command, $args ) = @_;
+    $command = lc $command;
+    my @idx;
+    if ( my $pos = $key_pos{$command} ) {
+        my ( $first, $last, $step ) = @$pos;
+        $last = $last < 0 ? @$args + $last : $last - 1;
+        $last = $#$args if $last > $#$args;
+        for ( my $i = $first - 1 ; $i <= $last ; $i += $step ) {
+            push @idx, $i;
+        }
+    }
+    if ( my $pos = $numkeys_pos{$command} ) {
+        my $numkeys = $args->[ $pos - 1 ];
+        return @idx unless defined $numkeys and $numkeys =~ /^[0-9]+$/;
+        my $last = $pos - 1 + $numkeys > $#$args ? $#$args : $pos - 1 + $numkeys;
+        push @idx, $pos .. $last;
+    }
+    if ( $command eq 'xread' or $command eq 'xreadgroup' ) {
+        for my $i ( 0 .. $#$args ) {
+            next unless uc $args->[$i] eq 'STREAMS';
+            my $count = int( ( $#$args - $i ) / 2 );
+            return $i + 1 .. $i + $count;
+        }
+    }
+    return @idx;
+}
+
+1;
+
+__END__
+
+=head1 SEE ALSO
+
+L<RedisDB::Cluster>, L<RedisDB::KeyMap>
+
+=head1 AUTHOR
+
+Pavel Shaydo, C<< <zwon at cpan.org> >>
+
+=head1 LICENSE AND COPYRIGHT
+
+Copyright 2011-2021 Pavel Shaydo.
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of either: the GNU General Public License as published
+by the Free Software Foundation; or the Artistic License.
+
+See http://dev.perl.org/licenses/ for more information.
+
+=cut
@@ -0,0 +1,297 @@
+package RedisDB::Loader;
+
+use strict;
+use warnings;
+our $VERSION = "2.57";
+$VERSION = eval $VERSION;
+
+use Carp;
+use RedisDB;
+use RedisDB::Cluster;
+
+=head1 NAME
+
+RedisDB::Loader - batch independent key lookups into MGET and HMGET
+
+=head1 SYNOPSIS
+
+    my $loader = RedisDB::Loader->new( redis => $redis );
+
+    # in different components handling the request
+    my $user     = $loader->get("user:$id");
+    my $settings = $loader->hget( "settings:$id", 'theme' );
+    $loader->get( "avatar:$id", sub { my ( $loader, $avatar ) = @_; ... } );
+
+    # one MGET for the keys and one HMGET for the hash fields
+    $loader->dispatch;
+    say $user->value;
+
+    # forget the loaded values at the end of the request
+    $loader->clear;
+
+=head1 DESCRIPTION
+
+If many independent parts of the code fetch their own keys, every part sends
+its own GET or HGET command, and even with pipelining the server has to
+process many small commands. The loader collects the lookups, and when
+I<dispatch> is invoked sends one MGET command for all requested keys and one
+HMGET command for every requested hash, then distributes the values from the
+replies to the callers. If the same key or field was requested several times,
+it is fetched only once.
+
+Lookup methods return a handle object for the value. Values are memoized
+until I<clear> is invoked, so repeated lookups during the same request return
+the same handle without sending anything to the server. The loader is meant
+to be request scoped, create a new one or clear it when the request is
+finished.
+
+With L<RedisDB::Cluster> the keys are grouped by slot and an MGET is sent for
+every slot. Commands for all slots and hashes are sent without waiting for
+replies, so a batch takes a single round trip.
+
+=head1 METHODS
+
+=cut
+
+=head2 $class->new(%params)
+
+create a new loader. Accepts the following parameters:
+
+=over 4
+
+=item redis
+
+L<RedisDB> object
+
+=item cluster
+
+L<RedisDB::Cluster> object. You must specify either I<redis> or I<cluster>.
+
+=item max_batch
+
+maximum number of keys or fields requested by a single command, larger
+batches are split into several commands. Default is 1000.
+
+=back
+
+=cut
+
+sub new {
+    my ( $class, %params ) = @_;
+    croak 'either "redis" or "cluster" parameter is required'
+      unless $params{redis} or $params{cluster};
+    my $self = {
+        redis     => $params{redis},
+        cluster   => $params{cluster},
+        max_batch => $params{max_batch} || 1000,
+        _memo     => {},
+        _queue    => {},
+    };
+    return bless $self, $class;
+}
+
+=head2 $self->get($key[, \&callback])
+
+request the value of the I<$key>. Returns L</"VALUE HANDLE"> object. If
+I<callback> is specified, it is invoked with the loader and the value as
+arguments when the value is loaded, or immediately if it was loaded before.
+
+=cut
+
+sub get {
+    my ( $self, $key, $callback ) = @_;
+    my $value = $self->{_memo}{get}{$key} ||= $self->{_queue}{get}{$key} =
+      RedisDB::Loader::Value->_new($self);
+    $value->_on_ready($callback) if $callback;
+    return $value;
+}
+
+=head2 $self->hget($hash, $field[, \&callback])
+
+request the value of the I<$field> in the I<$hash>. Returns L</"VALUE HANDLE">
+object. I<callback> is invoked the same way as for I<get>.
+
+=cut
+
+sub hget {
+    my ( $self, $hash, $field, $callback ) = @_;
+    my $value = $self->{_memo}{hget}{$hash}{$field} ||= $self->{_queue}{hget}{$hash}{$field} =
+      RedisDB::Loader::Value->_new($self);
+    $value->_on_ready($callback) if $callback;
+    return $value;
+}
+
+=head2 $self->pending
+
+return the number of requested values that have not been dispatched yet
+
+=cut
+
+sub pending {
+    my $self  = shift;
+    my $queue = $self->{_queue};
+    my $count = keys %{ $queue->{get} || {} };
+    $count += keys %$_ for values %{ $queue->{hget} || {} };
+    return $count;
+}
+
+=head2 $self->dispatch
+
+send all pending lookups to the server, wait for the replies, and resolve the
+handles. Returns the number of commands sent.
+
+=cut
+
+sub dispatch {
+    my $self  = shift;
+    my $queue = $self->{_queue};
+    $self->{_queue} = {};
+
+    my @commands;
+    if ( my $get = $queue->{get} ) {
+        my %groups;
+        if ( $self->{cluster} ) {
+
+            # the key map may move the key to another slot
+            my $cluster = $self->{cluster};
+            for ( sort keys %$get ) {
+                push @{ $groups{ RedisDB::Cluster::key_slot( $cluster->_stored_key($_) ) } }, $_;
+            }
+        }
+        else {
+            $groups{all} = [ sort keys %$get ];
+        }
+        for my $keys ( values %groups ) {
+            while ( my @batch = splice @$keys, 0, $self->{max_batch} ) {
+                push @commands, [ [ 'MGET', @batch ], [ @$get{@batch} ] ];
+            }
+        }
+    }
+    for my $hash ( sort keys %{ $queue->{hget} || {} } ) {
+        my $fields = $queue->{hget}{$hash};
+        my @names  = sort keys %$fields;
+        while ( my @batch = splice @names, 0, $self->{max_batch} ) {
+            push @commands, [ [ 'HMGET', $hash, @batch ], [ @$fields{@batch} ] ];
+        }
+    }
+    return 0 unless @commands;
+
+    my $conn = $self->{redis} || $self->{cluster};
+    for (@commands) {
+        my ( $args, $values ) = @$_;
+        $conn->send_command(
+            @$args,
+            sub {
+                my $reply = $_[1];
+                for my $i ( 0 .. $#$values ) {
+                    $values->[$i]->_resolve(
+                        RedisDB::_is_redisdb_error($reply) ? $reply : $reply->[$i] );
+                }
+            }
+        );
+    }
+    $conn->mainloop;
+    return scalar @commands;
+}
+
+=head2 $self->clear
+
+forget all loaded values. Values that were requested but not dispatched yet
+are dispatched first.
+
+=cut
+
+sub clear {
+    my $self = shift;
+    $self->dispatch if $self->pending;
+    $self->{_memo} = {};
+    return;
+}
+
+=head1 VALUE HANDLE
+
+I<get> and I<hget> return objects with the following methods:
+
+=head2 $value->value
+
+return the value. If it has not been loaded yet, dispatches all pending
+lookups of the loader. If the server returned an error for the command that
+included the value, throws the error.
+
+=head2 $value->ready
+
+return true if the value has been loaded
+
+=cut
+
+package RedisDB::Loader::Value;
+
+use Carp;
+use Scalar::Util qw(weaken);
+
+sub _new {
+    my ( $class, $loader ) = @_;
+    my $self = bless { ready => 0, callbacks => [] }, $class;
+    weaken( $self->{loader} = $loader );
+    return $self;
+}
+
+sub _on_ready {
+    my ( $self, $callback ) = @_;
+    if ( $self->{ready} ) {
+        $callback->( $self->{loader}, $self->{value} );
+    }
+    else {
+        push @{ $self->{callbacks} }, $callback;
+    }
+    return;
+}
+
+sub _resolve {
+    my ( $self, $value ) = @_;
+    $self->{value} = $value;
+    $self->{ready} = 1;
+    my $callbacks = $self->{callbacks};
+    $self->{callbacks} = [];
+    $_->( $self->{loader}, $value ) for @$callbacks;
+    return;
+}
+
+sub ready {
+    return shift->{ready};
+}
+
+sub value {
+    my $self = shift;
+    unless ( $self->{ready} ) {
+        my $loader = $self->{loader} or croak "Loader has been destroyed before dispatching";
+        $loader->dispatch;
+        croak "Value has not been loaded" unless $self->{ready};
+    }
+    croak $self->{value} if RedisDB::_is_redisdb_error( $self->{value} );
+    return $self->{value};
+}
+
+1;
+
+__END__
+
+=head1 SEE ALSO
+
+L<RedisDB>, L<RedisDB::Cluster>
+
+=head1 AUTHOR
+
+Pavel Shaydo, C<< <zwon at cpan.org> >>
+
+=head1 LICENSE AND COPYRIGHT
+
+Copyright 2011-2021 Pavel Shaydo.
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of either: the GNU General Public License as published
+by the Free Software Foundation; or the Artistic License.
+
+See http://dev.perl.org/licenses/ for more information.
+
+=cut
@@ -0,0 +1,580 @@
+package RedisDB::NearCache;
+
+use strict;
+use warnings;
+our $VERSION = "2.57";
+$VERSION = eval $VERSION;
+
+use Carp;
+use RedisDB;
+use Digest::MD5 qw(md5);
+use Fcntl qw(:DEFAULT :flock SEEK_SET);
+use Time::HiRes qw(time);
+use Try::Tiny;
+
+=head1 NAME
+
+RedisDB::NearCache - client side cache shared by processes on the host
+
+=head1 SYNOPSIS
+
+    # in every worker
+    my $cache = RedisDB::NearCache->new(
+        path  => '/dev/shm/redisdb-cache',
+        slots => 65536,
+        ttl   => 60,
+    );
+    my $redis = RedisDB->new( near_cache => $cache );
+    my $value = $redis->get('foo');    # may not hit the network
+
+    # in a single designated process
+    RedisDB::NearCache->new( path => '/dev/shm/redisdb-cache' )->listen(
+        redis    => RedisDB->new,
+        prefixes => ['user:'],
+    );
+
+=head1 DESCRIPTION
+
+This module implements a cache for replies to GET and HGET commands that is
+shared between all processes on the host, so preforked workers do not
+duplicate cached data, and restarted workers do not start with empty cache.
+The cache is a fixed size hash table stored in a file, normally on a tmpfs
+like F</dev/shm>, so it occupies the same page cache memory in all processes.
+Every entry has its own expiration time. Readers do not take any locks, every
+slot is protected by a sequence counter, if a reader finds that slot has been
+modified while it was reading it, it treats the slot as missing. Writers are
+serialized using an exclusive lock on the file.
+
+Entries are invalidated by a single listener process, see I<listen>. L<RedisDB>
+objects using the cache also remove the keys they modify, so a process always
+sees its own writes, but until the listener receives invalidation message
+other processes may get the old value, the cache is only eventually
+consistent.
+
+=head1 METHODS
+
+=cut
+
+my $MAGIC      = "RDBNC002";
+my $HEADER     = 64;
+my $WINDOW     = 8;
+my $SLOT_HDR   = 'N N Q> n n n N';
+my $SLOT_HDR_L = 26;
+
+=head2 $class->new(%params)
+
+open the cache file, create and initialize it if it doesn't exist. Accepts the
+following parameters:
+
+=over 4
+
+=item path
+
+path to the cache file, required
+
+=item slots
+
+number of slots in the hash table. Default is 65536
+
+=item slot_size
+
+size of the slot in bytes. Entries that don't fit into a slot are not cached.
+Default is 512
+
+=item ttl
+
+how long entries are kept in the cache in seconds. Default is 60
+
+=back
+
+If the file already exists, I<slots> and I<slot_size> must match the values
+used to create it.
+
+=cut
+
+sub new {
+    my ( $class, %params ) = @_;
+    croak '"path" parameter is required' unless $params{path};
+    my $self = bless {
+        path      => $params{path},
+        slots     => $params{slots} || 65536,
+        slot_size => $params{slot_size} || 512,
+        ttl       => $params{ttl} || 60,
+        stats     => { hits => 0, misses => 0, stores => 0, invalidations => 0 },
+    }, $class;
+    croak "slot_size is too small" if $self->{slot_size} < $SLOT_HDR_L + 8;
+    $self->_open;
+    return $self;
+}
+
+sub _open {
+    my $self = shift;
+
+    sysopen my $fh, $self->{path}, O_RDWR | O_CREAT
+      or croak "Couldn't open $self->{path}: $!";
+    binmode $fh;
+    flock $fh, LOCK_EX or croak "Couldn't lock $self->{path}: $!";
+    my $total = $self->{slots} + $WINDOW - 1;
+    my $size  = $HEADER + $total * $self->{slot_size};
+    if ( -s $fh ) {
+        sysseek $fh, 0, SEEK_SET;
+        sysread( $fh, my $hdr, $HEADER );
+        my ( $magic, $slots, $slot_size ) = unpack 'a8 N N', $hdr;
+        croak "$self->{path} is not a RedisDB::NearCache file" unless $magic eq $MAGIC;
+        croak "$self->{path} was created with different slots or slot_size"
+          unless $slots == $self->{slots} and $slot_size == $self->{slot_size};
+    }
+    else {
+        sysseek $fh, 0, SEEK_SET;
+        _write_all( $fh, pack( "a8 N N x$HEADER", $MAGIC, $self->{slots}, $self->{slot_size} ),
+            $HEADER );
+        truncate $fh, $size or croak "Couldn't resize $self->{path}: $!";
+    }
+    flock $fh, LOCK_UN;
+    $self->{_fh}  = $fh;
+    $self->{_pid} = $$;
+    return;
+}
+
+sub _write_all {
+    my ( $fh, $data, $len ) = @_;
+    $data = substr $data, 0, $len if defined $len;
+    my $off = 0;
+    while ( $off < length $data ) {
+        my $written = syswrite $fh, $data, length($data) - $off, $off;
+        croak "Couldn't write cache file: $!" unless defined $written;
+        $off += $written;
+    }
+    return;
+}
+
+# file offset is shared with the parent process, so children must reopen the file
+sub _fh {
+    my $self = shift;
+    $self->_open unless $self->{_pid} == $$;
+    return $self->{_fh};
+}
+
+sub _pread {
+    my ( $self, $offset, $len ) = @_;
+    my $fh = $self->_fh;
+    sysseek $fh, $offset, SEEK_SET or croak "Couldn't seek in cache file: $!";
+    my $buf = '';
+    while ( length $buf < $len ) {
+        my $read = sysread $fh, $buf, $len - length $buf, length $buf;
+        croak "Couldn't read cache file: $!" unless defined $read;
+        last unless $read;
+    }
+    return $buf;
+}
+
+sub _pwrite {
+    my ( $self, $offset, $data ) = @_;
+    my $fh = $self->_fh;
+    sysseek $fh, $offset, SEEK_SET or croak "Couldn't seek in cache file: $!";
+    _write_all( $fh, $data );
+    return;
+}
+
+sub _hash {
+    my ( $self, $key ) = @_;
+    my ( $h1, $h2 ) = unpack 'N N', md5($key);
+    return ( $h1 % $self->{slots}, $h2 );
+}
+
+sub _slot_offset {
+    my ( $self, $slot ) = @_;
+    return $HEADER + $slot * $self->{slot_size};
+}
+
+# read all slots of the window for the bucket. Returns list of hashes with
+# content of the slots, slots that were modified during reading are skipped.
+sub _read_window {
+    my ( $self, $bucket ) = @_;
+    my $size   = $self->{slot_size};
+    my $offset = $self->_slot_offset($bucket);
+    my $data   = $self->_pread( $offset, $size * $WINDOW );
+    my $check  = $self->_pread( $offset, $size * $WINDOW );
+    my @slots;
+    for my $i ( 0 .. $WINDOW - 1 ) {
+        my ( $seq, $tag, $expires, $nlen, $klen, $flen, $vlen ) =
+          unpack $SLOT_HDR, substr( $data, $i * $size, $SLOT_HDR_L );
+        next if $seq % 2;
+        next if $seq != unpack 'N', substr( $check, $i * $size, 4 );
+        push @slots,
+          {
+            index   => $bucket + $i,
+            seq     => $seq,
+            tag     => $tag,
+            expires => $expires,
+            nlen    => $nlen,
+            klen    => $klen,
+            flen    => $flen,
+            vlen    => $vlen,
+            data    => substr( $data, $i * $size + $SLOT_HDR_L, $nlen + $klen + $flen + $vlen ),
+          };
+    }
+    return @slots;
+}
+
+# entries are stored as namespace, key, field, and value. The slot is chosen
+# using the key only, so invalidation removes the key in all namespaces
+sub _lookup {
+    my ( $self, $key, $field, $ns ) = @_;
+    $ns = '' unless defined $ns;
+    my ( $bucket, $tag ) = $self->_hash($key);
+    my $now = int( time * 1000 );
+    my $flen = defined $field ? length($field) + 1 : 0;
+    my $name = $ns . $key . ( $flen ? "\0$field" : "" );
+    for my $slot ( $self->_read_window($bucket) ) {
+        next unless $slot->{tag} == $tag and $slot->{expires} > $now;
+        next unless $slot->{nlen} == length $ns and $slot->{klen} == length $key and $slot->{flen} == $flen;
+        next unless substr( $slot->{data}, 0, length $name ) eq $name;
+        my $value = substr $slot->{data}, length $name;
+        $self->{stats}{hits}++;
+        return ( 1, $value );
+    }
+    $self->{stats}{misses}++;
+    return;
+}
+
+=head2 $self->get($key)
+
+return a list containing one element -- the cached value of the key, or an
+empty list if the key is not in the cache. Value may be undefined if the key
+does not exist on the server.
+
+=cut
+
+sub get {
+    my ( $self, $key ) = @_;
+    return $self->_get( '', $key );
+}
+
+=head2 $self->hget($key, $field)
+
+same as I<get>, but for the field of the hash
+
+=cut
+
+sub hget {
+    my ( $self, $key, $field ) = @_;
+    return $self->_get( '', $key, $field );
+}
+
+# get and set in the namespace, RedisDB uses the address of the server and the
+# database number as the namespace
+sub _get {
+    my ( $self, $ns, $key, $field ) = @_;
+    my ( $found, $value ) = $self->_lookup( $key, $field, $ns );
+    return unless $found;
+    return _unpack_value($value);
+}
+
+sub _set {
+    my ( $self, $ns, $key, $field, $value, $generation ) = @_;
+    return $self->_store( $key, $field, _pack_value($value), $generation, $ns );
+}
+
+# the first byte of the stored value indicates if the value is defined
+sub _pack_value {
+    my $value = shift;
+    return defined $value ? "\001$value" : "\000";
+}
+
+sub _unpack_value {
+    my $value = shift;
+    return ( substr( $value, 0, 1 ) eq "\001" ? substr( $value, 1 ) : undef );
+}
+
+=head2 $self->generation
+
+return the number of invalidations processed by the cache. Pass this value to
+I<set> or I<hset> to make sure that the value you are storing was not
+invalidated while you were fetching it.
+
+=cut
+
+sub generation {
+    my $self = shift;
+    return unpack 'Q>', $self->_pread( 16, 8 );
+}
+
+=head2 $self->set($key, $value[, $generation])
+
+store I<$value> of the I<$key> in the cache. If I<$generation> is specified
+and there were invalidations after it has been obtained, value is not stored.
+
+=cut
+
+sub set {
+    my ( $self, $key, $value, $generation ) = @_;
+    return $self->_store( $key, undef, _pack_value($value), $generation );
+}
+
+=head2 $self->hset($key, $field, $value[, $generation])
+
+same as I<set>, but for the field of the hash
+
+=cut
+
+sub hset {
+    my ( $self, $key, $field, $value, $generation ) = @_;
+    return $self->_store( $key, $field, _pack_value($value), $generation );
+}
+
+sub _store {
+    my ( $self, $key, $field, $value, $generation, $ns ) = @_;
+    $ns = '' unless defined $ns;
+    my $flen = defined $field ? length($field) + 1 : 0;
+    my $name = $ns . $key . ( $flen ? "\0$field" : "" );
+    my $len = $SLOT_HDR_L + length($name) + length($value);
+    return if $len > $self->{slot_size};
+    my ( $bucket, $tag ) = $self->_hash($key);
+    my $now = int( time * 1000 );
+
+    my $fh = $self->_fh;
+    flock $fh, LOCK_EX or croak "Couldn't lock $self->{path}: $!";
+    my $stored = try {
+        return if defined $generation and $generation != $self->generation;
+
+        # replace the same entry, an expired or empty slot,
+        # or the slot that will expire first
+        my $victim;
+        for my $slot ( $self->_read_window($bucket) ) {
+            if (    $slot->{tag} == $tag
+                and $slot->{nlen} == length $ns
+                and $slot->{klen} == length $key
+                and $slot->{flen} == $flen
+                and substr( $slot->{data}, 0, length $name ) eq $name )
+            {
+                $victim = $slot;
+                last;
+            }
+            $victim = $slot if not $victim or $slot->{expires} < $victim->{expires};
+        }
+        return unless $victim;
+        my $data = pack( $SLOT_HDR,
+            $victim->{seq} + 2,
+            $tag, $now + $self->{ttl} * 1000,
+            length($ns), length($key), $flen, length($value) )
+          . $name
+          . $value;
+        $self->_write_slot( $victim->{index}, $victim->{seq}, $data );
+        $self->{stats}{stores}++;
+        return 1;
+    }
+    finally {
+        flock $fh, LOCK_UN;
+    };
+    return $stored;
+}
+
+# must be invoked with lock held. Marks slot as being modified, writes new
+# content, and then marks slot as consistent again
+sub _write_slot {
+    my ( $self, $index, $seq, $data ) = @_;
+    my $offset = $self->_slot_offset($index);
+    $self->_pwrite( $offset, pack( 'N', $seq + 1 ) );
+    $self->_pwrite( $offset + 4, substr( $data, 4 ) );
+    $self->_pwrite( $offset, substr( $data, 0, 4 ) );
+    return;
+}
+
+sub _bump_generation {
+    my $self = shift;
+    $self->_pwrite( 16, pack 'Q>', $self->generation + 1 );
+    return;
+}
+
+=head2 $self->invalidate(@keys)
+
+remove all entries for the specified I<@keys> from the cache, including
+cached fields of hashes, and entries stored by L<RedisDB> objects connected
+to other servers or databases
+
+=cut
+
+sub invalidate {
+    my ( $self, @keys ) = @_;
+    my $fh = $self->_fh;
+    flock $fh, LOCK_EX or croak "Couldn't lock $self->{path}: $!";
+    try {
+        $self->_bump_generation;
+        for my $key (@keys) {
+            my ( $bucket, $tag ) = $self->_hash($key);
+            for my $slot ( $self->_read_window($bucket) ) {
+                next unless $slot->{tag} == $tag and $slot->{klen} == length $key;
+                next unless substr( $slot->{data}, $slot->{nlen}, $slot->{klen} ) eq $key;
+                $self->_write_slot( $slot->{index}, $slot->{seq},
+                    pack( $SLOT_HDR, $slot->{seq} + 2, 0, 0, 0, 0, 0, 0 ) );
+                $self->{stats}{invalidations}++;
+            }
+        }
+    }
+    finally {
+        flock $fh, LOCK_UN;
+    };
+    return;
+}
+
+=head2 $self->flush
+
+remove all entries from the cache
+
+=cut
+
+sub flush {
+    my $self = shift;
+    my $fh   = $self->_fh;
+    my $size = $self->{slot_size};
+    my $total = $self->{slots} + $WINDOW - 1;
+    flock $fh, LOCK_EX or croak "Couldn't lock $self->{path}: $!";
+    try {
+        $self->_bump_generation;
+
+        # sequence numbers must be increased, otherwise
+        # a reader may not notice that the slot has changed
+        my $chunk = 4096;
+        for ( my $first = 0 ; $first < $total ; $first += $chunk ) {
+            my $count = $total - $first < $chunk ? $total - $first : $chunk;
+            my $data = $self->_pread( $self->_slot_offset($first), $count * $size );
+            my $new = '';
+            for my $i ( 0 .. $count - 1 ) {
+                my $seq = unpack 'N', substr( $data, $i * $size, 4 );
+                $new .= pack "N x" . ( $size - 4 ), $seq + 2;
+            }
+            $self->_pwrite( $self->_slot_offset($first), $new );
+        }
+    }
+    finally {
+        flock $fh, LOCK_UN;
+    };
+    return;
+}
+
+=head2 $self->stats
+
+return reference to a hash with the number of hits, misses, stores, and
+invalidations done by this process
+
+=cut
+
+sub stats {
+    return { %{ shift->{stats} } };
+}
+
+=head2 $self->listen(%params)
+
+receive invalidation messages from the server and remove invalidated keys from
+the cache. This method blocks forever, and it should be invoked in one
+designated process on the host. Before starting to listen the method flushes
+the cache, as some invalidations may have been lost while there was no
+listener. If connection to the server is lost, the method flushes the cache
+again and throws the error. It accepts the following parameters:
+
+=over 4
+
+=item redis
+
+L<RedisDB> object that will be used to receive invalidation messages. Required.
+
+=item mode
+
+either "tracking" or "keyspace". In tracking mode, which is the default, the
+method uses client side caching support of redis 6 in broadcasting mode: it
+opens an additional connection that redirects invalidation messages to the
+I<redis> connection. In keyspace mode it subscribes to keyspace notifications
+from the currently selected database, note, that notify-keyspace-events must
+be configured on the server.
+
+=item prefixes
+
+in tracking mode, list of key prefixes for which to receive invalidation
+messages. By default messages are received for all keys.
+
+=back
+
+=cut
+
+sub listen {
+    my ( $self, %params ) = @_;
+    my $redis = $params{redis} or croak '"redis" parameter is required';
+    my $mode = $params{mode} || 'tracking';
+
+    $self->flush;
+    my $tracker;
+    try {
+        if ( $mode eq 'tracking' ) {
+            my $id = $redis->client('ID');
+            $tracker = RedisDB->new(
+                (
+                    $redis->{path}
+                    ? ( path => $redis->{path} )
+                    : ( host => $redis->{host}, port => $redis->{port} )
+                ),
+                password => $redis->{password},
+                database => $redis->{database},
+            );
+            $tracker->client( 'TRACKING', 'on', 'REDIRECT', $id, 'BCAST',
+                map { ( PREFIX => $_ ) } @{ $params{prefixes} || [] } );
+            $redis->subscription_loop(
+                subscribe => [
+                    '__redis__:invalidate' => sub {
+                        my ( $redis, $channel, $pattern, $keys ) = @_;
+                        if ( ref $keys ) {
+                            $self->invalidate(@$keys);
+                        }
+                        else {
+                            $self->flush;
+                        }
+                    },
+                ],
+            );
+        }
+        elsif ( $mode eq 'keyspace' ) {
+            my $db = $redis->selected_database;
+            $redis->subscription_loop(
+                psubscribe => [
+                    "__keyspace\@${db}__:*" => sub {
+                        my ( $redis, $channel ) = @_;
+                        $channel =~ s/^__keyspace\@[0-9]+__://;
+                        $self->invalidate($channel);
+                    },
+                ],
+            );
+        }
+        else {
+            croak "Unknown invalidation mode $mode";
+        }
+    }
+    catch {
+        $self->flush;
+        die $_;
+    };
+    return;
+}
+
+1;
+
+__END__
+
+=head1 SEE ALSO
+
+L<RedisDB>
+
+=head1 AUTHOR
+
+Pavel Shaydo, C<< <zwon at cpan.org> >>
+
+=head1 LICENSE AND COPYRIGHT
+
+Copyright 2011-2021 Pavel Shaydo.
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of either: the GNU General Public License as published
+by the Free Software Foundation; or the Artistic License.
+
+See http://dev.perl.org/licenses/ for more information.
+
+=cut
@@ -0,0 +1,286 @@
+package RedisDB::Profiler;
+
+use strict;
+use warnings;
+our $VERSION = "2.57";
+$VERSION = eval $VERSION;
+
+use Carp;
+use Time::HiRes qw(time);
+
+=head1 NAME
+
+RedisDB::Profiler - attribute time spent in redis to the call sites
+
+=head1 SYNOPSIS
+
+    my $profiler = RedisDB::Profiler->new(
+        depth    => 3,
+        file     => '/tmp/redis.folded',
+        interval => 60,
+    );
+    my $redis = RedisDB->new( host => 'master', profiler => $profiler );
+
+    ...;
+
+    # the slowest call sites
+    for ( ( $profiler->report )[ 0 .. 9 ] ) {
+        printf "%s %s: %d calls, %.3fs total, p99 %.1fms\n", $_->{command},
+          $_->{site}[-1], $_->{count}, $_->{total}, 1000 * $_->{p99};
+    }
+
+    # flamegraph.pl /tmp/redis.folded > redis.svg
+    $profiler->dump;
+
+=head1 DESCRIPTION
+
+If the application sends commands to redis from many places, the latency
+reported by the server doesn't tell which code is responsible for the load.
+The profiler records for every command sent through L<RedisDB> object the
+perl call site that sent it, skipping frames of RedisDB modules, and
+aggregates the number of commands, the time till the reply was received, and
+the number of bytes sent and received per call site and command.
+
+The results can be retrieved with I<report>, or in the folded stack format
+understood by flamegraph.pl and similar tools, in which every line contains
+the frames of the call site from the outermost to the innermost, followed by
+the command name and the value. By default the value is the time in
+microseconds, so the width of a frame in the flame graph is proportional to
+the time spent waiting for redis by the code below it.
+
+Time is measured from the moment the command is sent till the moment the
+reply is processed, so for pipelined commands it includes time spent waiting
+for the replies to the preceding commands. Size of the replies is estimated
+from the decoded reply, it doesn't include protocol overhead exactly.
+
+=head1 METHODS
+
+=cut
+
+=head2 $class->new(%params)
+
+create a new profiler. Accepts the following parameters:
+
+=over 4
+
+=item depth
+
+number of frames of the call site to record, default is 1. Deeper call sites
+make flame graphs more informative, but split statistics into more entries.
+
+=item file
+
+file to which results in the folded format are written by I<dump>
+
+=item interval
+
+if specified together with I<file>, the results are written to the file
+automatically every I<interval> seconds. The file contains cumulative results
+since the profiler was created or reset.
+
+=item metric
+
+value written in the folded format: I<time> in microseconds, which is the
+default, I<count>, I<sent>, or I<received> bytes.
+
+=back
+
+=cut
+
+my %METRIC = (
+    time     => sub { int( $_[0]{total} * 1e6 + 0.5 ) },
+    count    => sub { $_[0]{count} },
+    sent     => sub { $_[0]{sent} },
+    received => sub { $_[0]{received} },
+);
+
+# latency histogram buckets grow by 10%
+my $BUCKET = log 1.1;
+
+sub new {
+    my ( $class, %params ) = @_;
+    my $metric = $params{metric} || 'time';
+    croak "Unknown metric $metric" unless $METRIC{$metric};
+    my $self = bless {
+        depth      => $params{depth} || 1,
+        file       => $params{file},
+        interval   => $params{interval},
+        metric     => $metric,
+        _stats     => {},
+        _dumped_at => time,
+    }, $class;
+    return $self;
+}
+
+# return the list of frames of the call site, the outermost first
+sub _call_site {
+    my $self = shift;
+    my $level = 1;
+    while ( my ($package) = caller($level) ) {
+        last unless $package =~ /^RedisDB(?:::|$)/;
+        $level++;
+    }
+    my @frames;
+    for my $i ( $level .. $level + $self->{depth} - 1 ) {
+        my ( undef, $file, $line ) = caller($i) or last;
+        my $sub = ( caller( $i + 1 ) )[3] || 'main';
+        unshift @frames, "$sub($file:$line)";
+    }
+    return \@frames;
+}
+
+# wrap the callback, so the reply is recorded for the current call site
+sub _wrap {
+    my ( $self, $command, $sent, $callback ) = @_;
+    my $site  = $self->_call_site;
+    my $start = time;
+    return sub {
+        $self->_record( $site, $command, time - $start, $sent, _reply_size( $_[1] ) );
+        $callback->(@_);
+    };
+}
+
+sub _reply_size {
+    my $reply = shift;
+    return 5 unless defined $reply;
+    if ( ref $reply eq 'ARRAY' ) {
+        my $size = 3 + length scalar @$reply;
+        $size += _reply_size($_) for @$reply;
+        return $size;
+    }
+    return 3 + length "$reply";
+}
+
+sub _record {
+    my ( $self, $site, $command, $latency, $sent, $received ) = @_;
+    my $key = join ';', @$site, $command;
+    my $stats = $self->{_stats}{$key} ||= {
+        site     => $site,
+        command  => $command,
+        count    => 0,
+        total    => 0,
+        max      => 0,
+        sent     => 0,
+        received => 0,
+        hist     => {},
+    };
+    $stats->{count}++;
+    $stats->{total} += $latency;
+    $stats->{max} = $latency if $latency > $stats->{max};
+    $stats->{sent}     += $sent;
+    $stats->{received} += $received;
+    $stats->{hist}{ int( log( 1 + $latency * 1e6 ) / $BUCKET ) }++;
+
+    $self->dump
+      if $self->{interval} and $self->{file} and time - $self->{_dumped_at} >= $self->{interval};
+    return;
+}
+
+# return upper bound of the bucket containing the given percentile
+sub _percentile {
+    my ( $stats, $percentile ) = @_;
+    my $need = $stats->{count} * $percentile / 100;
+    my $seen = 0;
+    for my $bucket ( sort { $a <=> $b } keys %{ $stats->{hist} } ) {
+        $seen += $stats->{hist}{$bucket};
+        if ( $seen >= $need ) {
+            my $bound = ( exp( ( $bucket + 1 ) * $BUCKET ) - 1 ) / 1e6;
+            return $bound < $stats->{max} ? $bound : $stats->{max};
+        }
+    }
+    return $stats->{max};
+}
+
+=head2 $self->report
+
+return the list of statistics for every call site and command, sorted by the
+total time in descending order. Every element is a hash with the following
+elements: I<site> is a reference to the array of frames, the outermost first,
+I<command>, I<count> of the commands, I<total> and I<max> time in seconds,
+I<p50> and I<p99> percentiles of the time, which are accurate to 10%, and the
+number of bytes I<sent> and I<received>.
+
+=cut
+
+sub report {
+    my $self = shift;
+    my @report;
+    for my $stats ( values %{ $self->{_stats} } ) {
+        push @report, {
+            ( map { $_ => $stats->{$_} } qw(site command count total max sent received) ),
+            p50 => _percentile( $stats, 50 ),
+            p99 => _percentile( $stats, 99 ),
+        };
+    }
+    return sort { $b->{total} <=> $a->{total} } @report;
+}
+
+=head2 $self->folded([$metric])
+
+return the statistics in the folded stack format. I<$metric> is the same as
+the parameter of the constructor.
+
+=cut
+
+sub folded {
+    my ( $self, $metric ) = @_;
+    $metric ||= $self->{metric};
+    my $value = $METRIC{$metric} or croak "Unknown metric $metric";
+    my $stats = $self->{_stats};
+    return join '', map { "$_ " . $value->( $stats->{$_} ) . "\n" } sort keys %$stats;
+}
+
+=head2 $self->dump([$file])
+
+write the statistics in the folded format into I<$file> or into the file
+specified in the constructor. The file is replaced atomically.
+
+=cut
+
+sub dump {
+    my ( $self, $file ) = @_;
+    $file ||= $self->{file} or croak "File is not specified";
+    $self->{_dumped_at} = time;
+    my $tmp = "$file.$$";
+    open my $fh, '>', $tmp or croak "Couldn't open $tmp: $!";
+    print $fh $self->folded;
+    close $fh or croak "Couldn't write $tmp: $!";
+    rename $tmp, $file or croak "Couldn't rename $tmp to $file: $!";
+    return;
+}
+
+=head2 $self->reset
+
+forget collected statistics
+
+=cut
+
+sub reset {
+    my $self = shift;
+    $self->{_stats} = {};
+    return;
+}
+
+1;
+
+__END__
+
+=head1 SEE ALSO
+
+L<RedisDB>, L<https://github.com/brendangregg/FlameGraph>
+
+=head1 AUTHOR
+
+Pavel Shaydo, C<< <zwon at cpan.org> >>
+
+=head1 LICENSE AND COPYRIGHT
+
+Copyright 2011-2021 Pavel Shaydo.
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of either: the GNU General Public License as published
+by the Free Software Foundation; or the Artistic License.
+
+See http://dev.perl.org/licenses/ for more information.
+
+=cut
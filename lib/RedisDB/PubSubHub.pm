@@ -0,0 +1,267 @@
+package RedisDB::PubSubHub;
+
+use strict;
+use warnings;
+our $VERSION = "2.57";
+$VERSION = eval $VERSION;
+
+use Carp;
+use RedisDB;
+use Scalar::Util qw(weaken);
+
+=head1 NAME
+
+RedisDB::PubSubHub - share one subscription connection between many listeners
+
+=head1 SYNOPSIS
+
+    my $hub = RedisDB::PubSubHub->new( redis => RedisDB->new( raise_error => 0 ) );
+
+    # in one module
+    my $sub = $hub->subscribe(
+        'news',
+        sub {
+            my ( $hub, $channel, $pattern, $message ) = @_;
+            ...;
+        }
+    );
+
+    # in another module
+    my $psub = $hub->psubscribe( 'news.*', \&on_news );
+
+    # wait for messages and dispatch them
+    $hub->listen;
+
+    # or, with an event loop
+    my $w = AnyEvent->io(
+        fh   => $hub->socket,
+        poll => 'r',
+        cb   => sub { $hub->process_messages },
+    );
+
+    $hub->unsubscribe($sub);
+
+=head1 DESCRIPTION
+
+Every RedisDB object in subscription mode holds a connection to the server.
+If different parts of the application subscribe to channels independently,
+the process ends up with many subscriber connections, and the server sends
+every message to every one of them. The hub owns a single subscription
+connection and keeps track of the local listeners of every channel and
+pattern. SUBSCRIBE or PSUBSCRIBE is sent to the server only when the first
+listener subscribes to the channel, and UNSUBSCRIBE or PUNSUBSCRIBE when the
+last listener unsubscribes. Every message received from the server is
+dispatched to all listeners of the channel or pattern.
+
+Callbacks are invoked with the same arguments as the subscription callbacks
+of L<RedisDB>, except that the first argument is the hub object: the hub, the
+channel, the pattern if the message was received because of a pattern
+subscription, and the message.
+
+=head1 METHODS
+
+=cut
+
+=head2 $class->new(%params)
+
+create a new hub. Accepts the following parameters:
+
+=over 4
+
+=item redis
+
+L<RedisDB> object that will be used for subscriptions. The object should not
+be used for anything else. If it has I<raise_error> disabled, subscriptions
+are restored automatically after reconnect.
+
+=item cluster
+
+L<RedisDB::Cluster> object. Messages published to any node are delivered by
+redis cluster to all nodes, so the hub opens a single connection to one of the
+nodes. You must specify either I<redis> or I<cluster>.
+
+=back
+
+=cut
+
+sub new {
+    my ( $class, %params ) = @_;
+    my $redis = $params{redis};
+    if ( my $cluster = $params{cluster} ) {
+        my $node = $cluster->random_connection
+          or croak "Couldn't connect to any cluster node";
+        $redis = RedisDB->new(
+            host        => $node->{host},
+            port        => $node->{port},
+            password    => $cluster->{_node_options}{password},
+            raise_error => 0,
+        );
+    }
+    croak 'either "redis" or "cluster" parameter is required' unless $redis;
+    my $self = bless {
+        redis    => $redis,
+        channels => {},
+        patterns => {},
+        _next_id => 0,
+    }, $class;
+    return $self;
+}
+
+=head2 $self->subscribe($channel, \&callback)
+
+add a listener for the I<$channel>. Returns a subscription object that should
+be passed to I<unsubscribe> to remove the listener.
+
+=cut
+
+sub subscribe {
+    my ( $self, $channel, $callback ) = @_;
+    return $self->_add( channels => $channel, $callback );
+}
+
+=head2 $self->psubscribe($pattern, \&callback)
+
+add a listener for the channels matching I<$pattern>. Returns a subscription
+object that should be passed to I<unsubscribe> to remove the listener.
+
+=cut
+
+sub psubscribe {
+    my ( $self, $pattern, $callback ) = @_;
+    return $self->_add( patterns => $pattern, $callback );
+}
+
+sub _add {
+    my ( $self, $type, $name, $callback ) = @_;
+    croak "Subscribe to what channel?" unless defined $name and length $name;
+    croak "Callback is required" unless ref $callback eq 'CODE';
+
+    my $listeners = $self->{$type}{$name};
+    unless ($listeners) {
+        $listeners = $self->{$type}{$name} = {};
+        weaken( my $hub = $self );
+        my $dispatch = sub {
+            my ( undef, $channel, $pattern, $message ) = @_;
+            return unless $hub;
+            my $current = $hub->{$type}{$name} or return;
+            $_->( $hub, $channel, $pattern, $message )
+              for map { $current->{$_} } sort { $a <=> $b } keys %$current;
+        };
+        if ( $type eq 'channels' ) {
+            $self->{redis}->subscribe( $name, $dispatch );
+        }
+        else {
+            $self->{redis}->psubscribe( $name, $dispatch );
+        }
+    }
+    my $id = ++$self->{_next_id};
+    $listeners->{$id} = $callback;
+    return bless { type => $type, name => $name, id => $id },
+      'RedisDB::PubSubHub::Subscription';
+}
+
+=head2 $self->unsubscribe($subscription)
+
+remove the listener. I<$subscription> is the object returned by I<subscribe>
+or I<psubscribe>.
+
+=cut
+
+sub unsubscribe {
+    my ( $self, $subscription ) = @_;
+    my ( $type, $name, $id ) = @$subscription{qw(type name id)};
+    my $listeners = $self->{$type}{$name} or return;
+    delete $listeners->{$id} or return;
+    return 1 if %$listeners;
+
+    delete $self->{$type}{$name};
+    if ( $type eq 'channels' ) {
+        $self->{redis}->unsubscribe($name);
+    }
+    else {
+        $self->{redis}->punsubscribe($name);
+    }
+    return 1;
+}
+
+=head2 $self->listeners($channel)
+
+return the number of local listeners of the I<$channel>, not including
+pattern listeners
+
+=cut
+
+sub listeners {
+    my ( $self, $channel ) = @_;
+    return scalar keys %{ $self->{channels}{$channel} || {} };
+}
+
+=head2 $self->process_messages
+
+dispatch all messages that have already been received from the server. This
+method does not block. Returns the number of replies processed.
+
+=cut
+
+sub process_messages {
+    my $self  = shift;
+    my $redis = $self->{redis};
+    return 0 unless $redis->{_subscription_loop};
+    my $processed = 0;
+    while ( $redis->reply_ready ) {
+        $redis->get_reply;
+        $processed++;
+    }
+    return $processed;
+}
+
+=head2 $self->listen
+
+wait for messages and dispatch them. The method returns when all listeners
+have unsubscribed.
+
+=cut
+
+sub listen {
+    my $self = shift;
+    while ( %{ $self->{channels} } or %{ $self->{patterns} } ) {
+        $self->{redis}->get_reply;
+    }
+    return;
+}
+
+=head2 $self->socket
+
+return the socket of the subscription connection, so you can watch it in your
+event loop and call I<process_messages> when it becomes readable. Note, that
+the socket changes if the connection was reestablished.
+
+=cut
+
+sub socket {
+    return shift->{redis}{_socket};
+}
+
+1;
+
+__END__
+
+=head1 SEE ALSO
+
+L<RedisDB>
+
+=head1 AUTHOR
+
+Pavel Shaydo, C<< <zwon at cpan.org> >>
+
+=head1 LICENSE AND COPYRIGHT
+
+Copyright 2011-2021 Pavel Shaydo.
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of either: the GNU General Public License as published
+by the Free Software Foundation; or the Artistic License.
+
+See http://dev.perl.org/licenses/ for more information.
+
+=cut
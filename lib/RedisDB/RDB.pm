@@ -0,0 +1,866 @@
+package RedisDB::RDB;
+
+use strict;
+use warnings;
+our $VERSION = "2.57";
+$VERSION = eval $VERSION;
+
+use Carp;
+
+=head1 NAME
+
+RedisDB::RDB - streaming parser for redis RDB files
+
+=head1 SYNOPSIS
+
+    my $rdb = RedisDB::RDB->new( file => 'dump.rdb' );
+    while ( my $key = $rdb->next_key ) {
+        printf "%d %s %s %s %d\n", $key->{db}, $key->{key}, $key->{type},
+          $key->{encoding}, $key->{size};
+    }
+
+    # restore the dataset into another server
+    my $rdb = RedisDB::RDB->new( file => 'dump.rdb', values => 1 );
+    my $restore = sub {
+        $redis->send_command( @$_, RedisDB::IGNORE_REPLY ) for @_;
+    };
+    while (
+        my $key = $rdb->next_key(
+            sub { $restore->( RedisDB::RDB::chunk_commands(@_) ) }
+        )
+      )
+    {
+        $restore->( RedisDB::RDB::commands($key) );
+    }
+
+=head1 DESCRIPTION
+
+This module reads RDB files produced by redis BGSAVE or by replication, e.g.
+backups, so you can analyse the dataset without loading the server. The file
+is read sequentially and keys are returned one by one, so the memory used
+doesn't depend on the size of the file. Unless values are requested, long
+strings are skipped without reading them into memory, compact encodings
+(ziplist, listpack, intset, and quicklist nodes) are always decoded, but they
+are small by design.
+
+All RDB versions up to 12 are supported, including zipmap, ziplist, intset,
+quicklist, listpack, and stream encodings, and LZF compressed strings. Module
+values are skipped, hashes with field expiration are not supported.
+
+=head1 METHODS
+
+=cut
+
+# RDB type => [ type, encoding ], encodings are the same as reported by
+# OBJECT ENCODING
+my %TYPE = (
+    0  => [ string => 'raw' ],
+    1  => [ list   => 'linkedlist' ],
+    2  => [ set    => 'hashtable' ],
+    3  => [ zset   => 'skiplist' ],
+    4  => [ hash   => 'hashtable' ],
+    5  => [ zset   => 'skiplist' ],
+    7  => [ module => 'module' ],
+    9  => [ hash   => 'zipmap' ],
+    10 => [ list   => 'ziplist' ],
+    11 => [ set    => 'intset' ],
+    12 => [ zset   => 'ziplist' ],
+    13 => [ hash   => 'ziplist' ],
+    14 => [ list   => 'quicklist' ],
+    15 => [ stream => 'stream' ],
+    16 => [ hash   => 'listpack' ],
+    17 => [ zset   => 'listpack' ],
+    18 => [ list   => 'quicklist' ],
+    19 => [ stream => 'stream' ],
+    20 => [ set    => 'listpack' ],
+    21 => [ stream => 'stream' ],
+);
+
+my $CHUNK = 65536;
+
+# number of items in the value for one element of the collection
+my %STEP = ( list => 1, set => 1, zset => 2, hash => 2, stream => 1 );
+
+=head2 $class->new(%params)
+
+open the RDB file and read the header. Accepts the following parameters:
+
+=over 4
+
+=item file
+
+path to the RDB file
+
+=item fh
+
+file handle to read the RDB from, e.g. a pipe. You must specify either I<file>
+or I<fh>.
+
+=item values
+
+if set, I<next_key> returns values of the keys
+
+=back
+
+=cut
+
+sub new {
+    my ( $class, %params ) = @_;
+    my $fh = $params{fh};
+    unless ($fh) {
+        croak 'either "file" or "fh" parameter is required' unless defined $params{file};
+        open $fh, '<', $params{file} or croak "Couldn't open $params{file}: $!";
+    }
+    binmode $fh;
+    my $self = bless {
+        fh     => $fh,
+        values => $params{values},
+        db     => 0,
+        aux    => {},
+        offset => 0,
+        _buf   => '',
+        _pos   => 0,
+    }, $class;
+    my $magic = $self->_read(9);
+    $magic =~ /^REDIS([0-9]{4})$/ or croak "Not an RDB file";
+    $self->{version} = $1 + 0;
+    croak "Unsupported RDB version $self->{version}" if $self->{version} > 12;
+    return $self;
+}
+
+=head2 $self->version
+
+return the version of the RDB format
+
+=cut
+
+sub version {
+    return shift->{version};
+}
+
+=head2 $self->aux
+
+return reference to a hash of auxiliary fields read so far, like
+I<redis-ver>, I<ctime>, or I<used-mem>. Auxiliary fields are normally stored
+at the beginning of the file, so they are available after the first key has
+been read.
+
+=cut
+
+sub aux {
+    return shift->{aux};
+}
+
+sub _fill {
+    my ( $self, $n ) = @_;
+    while ( length( $self->{_buf} ) - $self->{_pos} < $n ) {
+        if ( $self->{_pos} ) {
+            substr( $self->{_buf}, 0, $self->{_pos}, '' );
+            $self->{_pos} = 0;
+        }
+        my $got = read $self->{fh}, $self->{_buf}, $CHUNK + $n, length $self->{_buf};
+        croak "Couldn't read RDB file: $!" unless defined $got;
+        croak "Unexpected end of RDB file" unless $got;
+    }
+    return;
+}
+
+sub _read {
+    my ( $self, $n ) = @_;
+    return '' unless $n;
+    $self->_fill($n);
+    my $data = substr $self->{_buf}, $self->{_pos}, $n;
+    $self->{_pos}   += $n;
+    $self->{offset} += $n;
+    return $data;
+}
+
+# skip $n bytes without keeping them in memory
+sub _skip {
+    my ( $self, $n ) = @_;
+    $self->{offset} += $n;
+    my $avail = length( $self->{_buf} ) - $self->{_pos};
+    if ( $n <= $avail ) {
+        $self->{_pos} += $n;
+        return;
+    }
+    $n -= $avail;
+    $self->{_buf} = '';
+    $self->{_pos} = 0;
+    while ( $n > 0 ) {
+        my $got = read $self->{fh}, my $chunk, $n > $CHUNK ? $CHUNK : $n;
+        croak "Couldn't read RDB file: $!" unless defined $got;
+        croak "Unexpected end of RDB file" unless $got;
+        $n -= $got;
+    }
+    return;
+}
+
+# read length. In list context also returns true if it is a special encoding
+sub _length {
+    my $self = shift;
+    my $byte = ord $self->_read(1);
+    my $type = $byte >> 6;
+    return $byte & 0x3f if $type == 0;
+    return ( ( $byte & 0x3f ) << 8 ) | ord $self->_read(1) if $type == 1;
+    if ( $type == 2 ) {
+        return unpack 'N',  $self->_read(4) if $byte == 0x80;
+        return unpack 'Q>', $self->_read(8) if $byte == 0x81;
+        croak "Unknown length encoding $byte";
+    }
+    return ( $byte & 0x3f, 1 );
+}
+
+sub _len {
+    my $self = shift;
+    my ( $len, $special ) = $self->_length;
+    croak "Expected length, got special encoding" if $special;
+    return $len;
+}
+
+# read string. If $skip is true, the string is skipped and undef returned,
+# integer encoded strings are always returned
+sub _string {
+    my ( $self, $skip ) = @_;
+    my ( $len, $special ) = $self->_length;
+    $self->{_int} = 0;
+    if ($special) {
+        $self->{_int} = 1;
+        return unpack 'c',  $self->_read(1) if $len == 0;
+        return unpack 's<', $self->_read(2) if $len == 1;
+        return unpack 'l<', $self->_read(4) if $len == 2;
+        croak "Unknown string encoding $len" unless $len == 3;
+        $self->{_int} = 0;
+        my $clen = $self->_len;
+        my $ulen = $self->_len;
+        $self->{_length} = $ulen;
+        return $self->_skip($clen) if $skip;
+        return lzf_decompress( $self->_read($clen), $ulen );
+    }
+    $self->{_length} = $len;
+    return $self->_skip($len) if $skip;
+    return $self->_read($len);
+}
+
+=head2 $self->next_key([$callback[, $batch]])
+
+read the next key from the file and return it as a hash with the following
+elements, or undef if the end of the file has been reached:
+
+=over 4
+
+=item db
+
+database number
+
+=item key
+
+the key
+
+=item type
+
+type of the value: string, list, set, zset, hash, stream, or module
+
+=item encoding
+
+encoding of the value in the file: raw, int, linkedlist, ziplist, quicklist,
+hashtable, intset, listpack, skiplist, zipmap, stream, or module
+
+=item expire
+
+expiration time in milliseconds since the epoch, undef if the key doesn't
+expire
+
+=item size
+
+number of bytes the key and the value take in the file
+
+=item elements
+
+number of elements in the value, number of entries for streams, and the
+length for strings
+
+=item value
+
+only if I<values> parameter was set. For strings it is the string, for
+lists and sets it is a reference to array of elements, for sorted sets it is
+a reference to array of member, score pairs, for hashes a reference to array
+of field, value pairs. For streams it is a hash with I<entries> element
+containing reference to array of ID, fields pairs, where fields is a reference
+to array of field, value pairs, and I<last_id>, I<length>, I<first_id>,
+I<max_deleted_id>, I<entries_added>, and I<groups> elements. Every group is a
+hash with I<name>, I<last_id>, and I<entries_read> elements, pending entries
+lists and consumers are not returned. Module values are undef.
+
+=back
+
+If I<values> parameter was set and I<$callback> is specified, elements of
+lists, sets, sorted sets, and hashes, and entries of streams are not
+collected, but passed to the callback in chunks of at most I<$batch>
+elements, default is 1000, as soon as they are read, so the memory used
+doesn't depend on the size of the collections. The callback gets the hash
+describing the key without I<size>, I<elements>, and I<value>, and the
+reference to array of elements in the same format as in I<value>. In this
+case the returned hash contains I<chunks> element with the number of chunks
+passed to the callback, and the I<value> without elements. Use
+I<chunk_commands> in the callback and I<commands> for the returned hash to
+restore such keys.
+
+=cut
+
+sub next_key {
+    my ( $self, $callback, $batch ) = @_;
+    return if $self->{eof};
+    my $expire;
+    while (1) {
+        my $start = $self->{offset};
+        my $op    = ord $self->_read(1);
+        if ( $op == 0xFF ) {
+            $self->{eof} = 1;
+            return;
+        }
+        elsif ( $op == 0xFE ) {
+            $self->{db} = $self->_len;
+        }
+        elsif ( $op == 0xFD ) {
+            $expire = 1000 * unpack 'V', $self->_read(4);
+        }
+        elsif ( $op == 0xFC ) {
+            $expire = unpack 'Q<', $self->_read(8);
+        }
+        elsif ( $op == 0xFB ) {
+            $self->{db_size}{ $self->{db} } = [ $self->_len, $self->_len ];
+        }
+        elsif ( $op == 0xFA ) {
+            my $name = $self->_string;
+            $self->{aux}{$name} = $self->_string;
+        }
+        elsif ( $op == 0xF9 ) {
+            $self->_read(1);    # LFU frequency
+        }
+        elsif ( $op == 0xF8 ) {
+            $self->_len;        # LRU idle time
+        }
+        elsif ( $op == 0xF7 ) {
+            $self->_skip_module;
+        }
+        elsif ( $op == 0xF6 ) {
+            $self->_string(1);    # function library
+        }
+        elsif ( $op == 0xF4 ) {
+            $self->_len for 1 .. 3;    # slot info
+        }
+        elsif ( my $type = $TYPE{$op} ) {
+            my %entry = (
+                db       => $self->{db},
+                key      => $self->_string,
+                type     => $type->[0],
+                encoding => $type->[1],
+                expire   => $expire,
+            );
+            local $self->{_on_chunk};
+            if ( $callback and $self->{values} and $STEP{ $type->[0] } ) {
+                $entry{chunks} = 0;
+                $self->{_chunk_size} = ( $batch || 1000 ) * $STEP{ $type->[0] };
+                $self->{_on_chunk} = sub {
+                    $entry{chunks}++;
+                    $callback->( \%entry, @_ );
+                };
+            }
+            my ( $value, $elements ) = $self->_value($op);
+            $self->_flush( $type->[0] eq 'stream' ? $value->{entries} : $value, 1 )
+              if $self->{_on_chunk};
+            $entry{encoding} = 'int' if $op == 0 && $self->{_int};
+            $entry{size}     = $self->{offset} - $start;
+            $entry{elements} = $elements;
+            $entry{value}    = $value if $self->{values};
+            return \%entry;
+        }
+        else {
+            croak "Unsupported RDB type or opcode $op at offset $start";
+        }
+    }
+}
+
+# skip module value or auxiliary data
+sub _skip_module {
+    my $self = shift;
+    $self->_len;    # module id
+    while ( my $opcode = $self->_len ) {
+        if ( $opcode == 1 or $opcode == 2 ) {
+            $self->_len;
+        }
+        elsif ( $opcode == 3 ) {
+            $self->_read(4);
+        }
+        elsif ( $opcode == 4 ) {
+            $self->_read(8);
+        }
+        elsif ( $opcode == 5 ) {
+            $self->_string(1);
+        }
+        else {
+            croak "Unknown module opcode $opcode";
+        }
+    }
+    return;
+}
+
+# read value of the given type, return the value if values were requested
+# and the number of elements
+sub _value {
+    my ( $self, $type ) = @_;
+    my $keep = $self->{values};
+    my @items;
+
+    if ( $type == 0 ) {
+        my $value = $self->_string( !$keep );
+        return ( $value, $self->{_int} ? length $value : $self->{_length} );
+    }
+    elsif ( $type == 1 or $type == 2 ) {
+        my $len = $self->_len;
+        for ( 1 .. $len ) {
+            my $value = $self->_string( !$keep );
+            $self->_add( \@items, $value ) if $keep;
+        }
+        return ( \@items, $len );
+    }
+    elsif ( $type == 3 or $type == 5 ) {
+        my $len = $self->_len;
+        for ( 1 .. $len ) {
+            my $member = $self->_string( !$keep );
+            my $score  = $type == 5 ? unpack( 'd<', $self->_read(8) ) : $self->_double;
+            $self->_add( \@items, $member, $score ) if $keep;
+        }
+        return ( \@items, $len );
+    }
+    elsif ( $type == 4 ) {
+        my $len = $self->_len;
+        for ( 1 .. 2 * $len ) {
+            my $value = $self->_string( !$keep );
+            $self->_add( \@items, $value ) if $keep;
+        }
+        return ( \@items, $len );
+    }
+    elsif ( $type == 9 ) {
+        my $items = _zipmap( $self->_string );
+        return ( $items, @$items / 2 );
+    }
+    elsif ( $type == 10 ) {
+        my $items = _ziplist( $self->_string );
+        return ( $items, scalar @$items );
+    }
+    elsif ( $type == 11 ) {
+        my $items = _intset( $self->_string );
+        return ( $items, scalar @$items );
+    }
+    elsif ( $type == 12 or $type == 13 ) {
+        my $items = _ziplist( $self->_string );
+        return ( $items, @$items / 2 );
+    }
+    elsif ( $type == 14 or $type == 18 ) {
+        my $count = 0;
+        for ( 1 .. $self->_len ) {
+            my $container = $type == 18 ? $self->_len : 2;
+            my $node;
+            if ( $container == 1 ) {
+
+                # plain node contains a single large element
+                $node = [ scalar $self->_string( !$keep ) ];
+            }
+            else {
+                $node = $type == 18 ? _listpack( $self->_string ) : _ziplist( $self->_string );
+            }
+            $count += @$node;
+            $self->_add( \@items, @$node ) if $keep;
+        }
+        return ( \@items, $count );
+    }
+    elsif ( $type == 16 or $type == 17 or $type == 20 ) {
+        my $items = _listpack( $self->_string );
+        return ( $items, $type == 20 ? scalar @$items : @$items / 2 );
+    }
+    elsif ( $type == 15 or $type == 19 or $type == 21 ) {
+        return $self->_stream($type);
+    }
+    elsif ( $type == 7 ) {
+        $self->_skip_module;
+        return ( undef, undef );
+    }
+    croak "Unsupported RDB type $type";
+}
+
+# add elements to the value, if the chunk callback is set, pass them to it as
+# soon as there are enough of them
+sub _add {
+    my ( $self, $items, @elements ) = @_;
+    push @$items, @elements;
+    $self->_flush($items) if $self->{_on_chunk};
+    return;
+}
+
+# pass complete chunks of the elements to the chunk callback, if $all is set
+# pass also the rest of the elements
+sub _flush {
+    my ( $self, $items, $all ) = @_;
+    my $size = $self->{_chunk_size};
+    while ( @$items >= $size or $all && @$items ) {
+        $self->{_on_chunk}->( [ splice @$items, 0, $size ] );
+    }
+    return;
+}
+
+# score of the old zset encoding
+sub _double {
+    my $self = shift;
+    my $len  = ord $self->_read(1);
+    return 'nan'  if $len == 253;
+    return 'inf'  if $len == 254;
+    return '-inf' if $len == 255;
+    return $self->_read($len);
+}
+
+sub _stream {
+    my ( $self, $type ) = @_;
+    my $keep = $self->{values};
+    my @entries;
+    for ( 1 .. $self->_len ) {
+        my ( $master_ms, $master_seq ) = unpack 'Q>Q>', $self->_string;
+        my $items = _listpack( $self->_string );
+        my $i     = 2;                             # skip count and deleted
+        my $nf    = $items->[ $i++ ];
+        my @master_fields = @$items[ $i .. $i + $nf - 1 ];
+        $i += $nf + 1;                             # fields and terminator
+        while ( $i < @$items ) {
+            my $flags = $items->[ $i++ ];
+            my $id    = ( $master_ms + $items->[$i] ) . '-' . ( $master_seq + $items->[ $i + 1 ] );
+            $i += 2;
+            my @fields;
+            if ( $flags & 2 ) {
+                @fields = map { $master_fields[$_], $items->[ $i + $_ ] } 0 .. $nf - 1;
+                $i += $nf;
+            }
+            else {
+                my $count = $items->[ $i++ ];
+                @fields = @$items[ $i .. $i + 2 * $count - 1 ];
+                $i += 2 * $count;
+            }
+            $i++;    # number of items in the entry
+            $self->_add( \@entries, [ $id, \@fields ] ) if $keep and not $flags & 1;
+        }
+    }
+
+    my %stream = ( length => $self->_len );
+    $stream{last_id} = $self->_len . '-' . $self->_len;
+    if ( $type >= 19 ) {
+        $stream{first_id}       = $self->_len . '-' . $self->_len;
+        $stream{max_deleted_id} = $self->_len . '-' . $self->_len;
+        $stream{entries_added}  = $self->_len;
+    }
+    my @groups;
+    for ( 1 .. $self->_len ) {
+        my %group = ( name => $self->_string );
+        $group{last_id} = $self->_len . '-' . $self->_len;
+        $group{entries_read} = $self->_len if $type >= 19;
+        for ( 1 .. $self->_len ) {
+            $self->_read(24);    # ID and delivery time
+            $self->_len;         # delivery count
+        }
+        for ( 1 .. $self->_len ) {
+            $self->_string(1);
+            $self->_read( $type >= 21 ? 16 : 8 );    # seen and active time
+            $self->_skip( 16 * $self->_len );        # pending entries
+        }
+        push @groups, \%group;
+    }
+    return ( undef, $stream{length} ) unless $keep;
+    return ( { %stream, entries => \@entries, groups => \@groups }, $stream{length} );
+}
+
+=head1 FUNCTIONS
+
+=head2 commands($key[, $batch])
+
+return the list of commands that recreate the I<$key> returned by
+I<next_key> with values. Every command is a reference to array. Collections
+are written by commands adding I<$batch> elements at a time, default is 1000,
+and are deleted first. Module values are not supported, for them an empty
+list is returned. Stream consumer groups are created, but their pending
+entries lists and consumers are not restored. If elements of the key were
+passed to the callback of I<next_key>, only the commands that follow them,
+like setting the expiration time, are returned.
+
+=cut
+
+sub commands {
+    my ( $entry, $batch ) = @_;
+    $batch ||= 1000;
+    my ( $key, $type, $value ) = @$entry{qw(key type value)};
+    return if $type eq 'module';
+    croak "Key was read without value" unless exists $entry->{value};
+
+    my @commands;
+    if ( $type eq 'string' ) {
+        push @commands, [ 'SET', $key, $value ];
+    }
+    else {
+        my %chunk = ( %$entry, chunks => $entry->{chunks} || 0 );
+        my @items = @{ $type eq 'stream' ? $value->{entries} : $value };
+        while ( my @chunk = splice @items, 0, $batch * $STEP{$type} ) {
+            $chunk{chunks}++;
+            push @commands, chunk_commands( \%chunk, \@chunk );
+        }
+        if ( $type eq 'stream' ) {
+            push @commands, [ 'DEL', $key ], [ 'XADD', $key, '0-1', '', '' ], [ 'XDEL', $key, '0-1' ]
+              unless $chunk{chunks};
+            push @commands, [ 'XSETID', $key, $value->{last_id} ];
+            for ( @{ $value->{groups} } ) {
+                push @commands, [
+                    'XGROUP', 'CREATE', $key, $_->{name}, $_->{last_id},
+                    ( defined $_->{entries_read} ? ( 'ENTRIESREAD', $_->{entries_read} ) : () )
+                ];
+            }
+        }
+    }
+    push @commands, [ 'PEXPIREAT', $key, $entry->{expire} ] if defined $entry->{expire};
+    return @commands;
+}
+
+=head2 chunk_commands($key, $chunk)
+
+return the list of commands that add elements in I<$chunk> passed to the
+callback of I<next_key> to the I<$key>. For the first chunk of the key the
+command deleting it goes first.
+
+=cut
+
+sub chunk_commands {
+    my ( $entry, $chunk ) = @_;
+    my ( $key, $type ) = @$entry{qw(key type)};
+    my @commands;
+    push @commands, [ 'DEL', $key ] if $entry->{chunks} == 1;
+    if ( $type eq 'stream' ) {
+        push @commands, [ 'XADD', $key, $_->[0], @{ $_->[1] } ] for @$chunk;
+    }
+    else {
+        my @items = @$chunk;
+        @items = map { @items[ 2 * $_ + 1, 2 * $_ ] } 0 .. @items / 2 - 1 if $type eq 'zset';
+        my $command = { list => 'RPUSH', set => 'SADD', zset => 'ZADD', hash => 'HSET' }->{$type};
+        push @commands, [ $command, $key, @items ];
+    }
+    return @commands;
+}
+
+=head2 lzf_decompress($data, $length)
+
+decompress LZF compressed I<$data>, I<$length> is the length of the
+uncompressed data
+
+=cut
+
+sub lzf_decompress {
+    my ( $in, $length ) = @_;
+    my $out = '';
+    my $ip  = 0;
+    my $end = length $in;
+    while ( $ip < $end ) {
+        my $ctrl = ord substr $in, $ip++, 1;
+        if ( $ctrl < 32 ) {
+            $out .= substr $in, $ip, $ctrl + 1;
+            $ip += $ctrl + 1;
+            next;
+        }
+        my $len = $ctrl >> 5;
+        $len += ord substr $in, $ip++, 1 if $len == 7;
+        my $ref = length($out) - ( ( $ctrl & 0x1f ) << 8 ) - ord( substr $in, $ip++, 1 ) - 1;
+        croak "Invalid LZF data" if $ref < 0;
+        $len += 2;
+
+        # the reference may overlap with the data being copied
+        while ( $len > 0 ) {
+            my $chunk = substr $out, $ref, $len;
+            $out .= $chunk;
+            $ref += length $chunk;
+            $len -= length $chunk;
+        }
+    }
+    croak "Invalid LZF data" unless length $out == $length;
+    return $out;
+}
+
+# decode ziplist into the list of elements
+sub _ziplist {
+    my $zl  = shift;
+    my $pos = 10;
+    my @items;
+    while (1) {
+        my $prev = ord substr $zl, $pos, 1;
+        last if $prev == 0xFF;
+        $pos += $prev == 0xFE ? 5 : 1;
+        my $enc = ord substr $zl, $pos, 1;
+        if ( $enc >> 6 == 0 ) {
+            my $len = $enc & 0x3f;
+            push @items, substr $zl, $pos + 1, $len;
+            $pos += 1 + $len;
+        }
+        elsif ( $enc >> 6 == 1 ) {
+            my $len = ( ( $enc & 0x3f ) << 8 ) | ord substr $zl, $pos + 1, 1;
+            push @items, substr $zl, $pos + 2, $len;
+            $pos += 2 + $len;
+        }
+        elsif ( $enc >> 6 == 2 ) {
+            my $len = unpack 'N', substr $zl, $pos + 1, 4;
+            push @items, substr $zl, $pos + 5, $len;
+            $pos += 5 + $len;
+        }
+        elsif ( $enc == 0xC0 ) {
+            push @items, unpack 's<', substr $zl, $pos + 1, 2;
+            $pos += 3;
+        }
+        elsif ( $enc == 0xD0 ) {
+            push @items, unpack 'l<', substr $zl, $pos + 1, 4;
+            $pos += 5;
+        }
+        elsif ( $enc == 0xE0 ) {
+            push @items, unpack 'q<', substr $zl, $pos + 1, 8;
+            $pos += 9;
+        }
+        elsif ( $enc == 0xF0 ) {
+            push @items, _int24( substr $zl, $pos + 1, 3 );
+            $pos += 4;
+        }
+        elsif ( $enc == 0xFE ) {
+            push @items, unpack 'c', substr $zl, $pos + 1, 1;
+            $pos += 2;
+        }
+        elsif ( $enc > 0xF0 and $enc < 0xFE ) {
+            push @items, ( $enc & 0x0f ) - 1;
+            $pos += 1;
+        }
+        else {
+            croak "Invalid ziplist encoding $enc";
+        }
+    }
+    return \@items;
+}
+
+# decode listpack into the list of elements
+sub _listpack {
+    my $lp  = shift;
+    my $pos = 6;
+    my @items;
+    while (1) {
+        my $enc = ord substr $lp, $pos, 1;
+        last if $enc == 0xFF;
+        my $len;
+        if ( $enc < 0x80 ) {
+            push @items, $enc;
+            $len = 1;
+        }
+        elsif ( ( $enc & 0xC0 ) == 0x80 ) {
+            my $size = $enc & 0x3f;
+            push @items, substr $lp, $pos + 1, $size;
+            $len = 1 + $size;
+        }
+        elsif ( ( $enc & 0xE0 ) == 0xC0 ) {
+            my $value = ( ( $enc & 0x1f ) << 8 ) | ord substr $lp, $pos + 1, 1;
+            push @items, $value >= 1 << 12 ? $value - ( 1 << 13 ) : $value;
+            $len = 2;
+        }
+        elsif ( ( $enc & 0xF0 ) == 0xE0 ) {
+            my $size = ( ( $enc & 0x0f ) << 8 ) | ord substr $lp, $pos + 1, 1;
+            push @items, substr $lp, $pos + 2, $size;
+            $len = 2 + $size;
+        }
+        elsif ( $enc == 0xF0 ) {
+            my $size = unpack 'V', substr $lp, $pos + 1, 4;
+            push @items, substr $lp, $pos + 5, $size;
+            $len = 5 + $size;
+        }
+        elsif ( $enc == 0xF1 ) {
+            push @items, unpack 's<', substr $lp, $pos + 1, 2;
+            $len = 3;
+        }
+        elsif ( $enc == 0xF2 ) {
+            push @items, _int24( substr $lp, $pos + 1, 3 );
+            $len = 4;
+        }
+        elsif ( $enc == 0xF3 ) {
+            push @items, unpack 'l<', substr $lp, $pos + 1, 4;
+            $len = 5;
+        }
+        elsif ( $enc == 0xF4 ) {
+            push @items, unpack 'q<', substr $lp, $pos + 1, 8;
+            $len = 9;
+        }
+        else {
+            croak "Invalid listpack encoding $enc";
+        }
+
+        # every entry is followed by its length encoded in 1 to 5 bytes
+        $pos += $len + ( $len < 128 ? 1 : $len < 16384 ? 2 : $len < 2097152 ? 3 : $len < 268435456 ? 4 : 5 );
+    }
+    return \@items;
+}
+
+sub _int24 {
+    my $value = unpack 'V', shift() . "\0";
+    return $value >= 1 << 23 ? $value - ( 1 << 24 ) : $value;
+}
+
+sub _intset {
+    my $is = shift;
+    my ( $size, $count ) = unpack 'VV', $is;
+    my $template = { 2 => 's<', 4 => 'l<', 8 => 'q<' }->{$size}
+      or croak "Invalid intset encoding $size";
+    return [ unpack "$template$count", substr $is, 8 ];
+}
+
+sub _zipmap {
+    my $zm  = shift;
+    my $pos = 1;
+    my @items;
+    my $len = sub {
+        my $byte = ord substr $zm, $pos, 1;
+        if ( $byte < 254 ) {
+            $pos += 1;
+            return $byte;
+        }
+        $pos += 5;
+        return unpack 'V', substr $zm, $pos - 4, 4;
+    };
+    while ( ord substr( $zm, $pos, 1 ) != 0xFF ) {
+        my $klen = $len->();
+        push @items, substr $zm, $pos, $klen;
+        $pos += $klen;
+        my $vlen = $len->();
+        my $free = ord substr $zm, $pos++, 1;
+        push @items, substr $zm, $pos, $vlen;
+        $pos += $vlen + $free;
+    }
+    return \@items;
+}
+
+1;
+
+__END__
+
+=head1 SEE ALSO
+
+L<RedisDB>, L<https://github.com/sripathikrishnan/redis-rdb-tools/wiki/Redis-RDB-Dump-File-Format>
+
+=head1 AUTHOR
+
+Pavel Shaydo, C<< <zwon at cpan.org> >>
+
+=head1 LICENSE AND COPYRIGHT
+
+Copyright 2011-2021 Pavel Shaydo.
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of either: the GNU General Public License as published
+by the Free Software Foundation; or the Artistic License.
+
+See http://dev.perl.org/licenses/ for more information.
+
+=cut
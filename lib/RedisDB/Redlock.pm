@@ -0,0 +1,329 @@
+package RedisDB::Redlock;
+
+use strict;
+use warnings;
+our $VERSION = "2.57";
+$VERSION = eval $VERSION;
+
+use Carp;
+use Digest::SHA qw(sha1_hex);
+use Time::HiRes qw(time sleep);
+use Try::Tiny;
+
+=head1 NAME
+
+RedisDB::Redlock - distributed locks on multiple independent redis servers
+
+=head1 SYNOPSIS
+
+    my $redlock = RedisDB::Redlock->new(
+        servers => [ map { RedisDB->new( host => $_, raise_error => 0 ) } @hosts ],
+    );
+
+    if ( my $lock = $redlock->lock( 'report:daily', 30 ) ) {
+        ...;    # we have $lock->{validity} seconds to do the work
+        $redlock->unlock($lock);
+    }
+
+    # extend many locks at once
+    my @lost = grep { not $_->{validity} } $redlock->extend( 30, @locks );
+
+=head1 DESCRIPTION
+
+This module implements the Redlock algorithm. To acquire a lock it sends
+C<SET resource token NX PX ttl> to all servers, and the lock is acquired if
+the majority of the servers accepted the command. Commands are sent to all
+servers before waiting for any reply, so acquiring takes about one round trip
+to the slowest server, not the sum of round trips. Validity time of the lock
+is the TTL minus the time spent acquiring the lock and minus allowed clock
+drift. If the lock could not be acquired, it is released on all servers, and
+after a random delay acquiring is retried.
+
+Locks are released and extended by server side scripts that check that the
+key still contains the token of the lock, so a lock that has expired and was
+acquired by another client is never released or extended. Extending many
+locks sends all scripts to every server in a single pipelined batch.
+
+The servers must be independent masters, not replicas of each other or nodes
+of the same cluster.
+
+=head1 METHODS
+
+=cut
+
+my $UNLOCK = <<'LUA';
+if redis.call('GET', KEYS[1]) == ARGV[1] then
+    return redis.call('DEL', KEYS[1])
+end
+return 0
+LUA
+
+my $EXTEND = <<'LUA';
+if redis.call('GET', KEYS[1]) == ARGV[1] then
+    return redis.call('PEXPIRE', KEYS[1], ARGV[2])
+end
+return 0
+LUA
+
+my %SHA = (
+    unlock => sha1_hex($UNLOCK),
+    extend => sha1_hex($EXTEND),
+);
+my %LUA = (
+    unlock => $UNLOCK,
+    extend => $EXTEND,
+);
+
+=head2 $class->new(%params)
+
+create a new lock manager. Accepts the following parameters:
+
+=over 4
+
+=item servers
+
+reference to array of L<RedisDB> objects connected to independent servers,
+required. Objects should have I<raise_error> disabled, otherwise a server that
+is not available causes an exception.
+
+=item retry_count
+
+number of attempts to acquire the lock. Default is 3.
+
+=item retry_delay
+
+maximum delay in seconds between attempts, actual delay is random between
+zero and this value. Default is 0.2.
+
+=item drift_factor
+
+expected clock drift between servers as a fraction of the lock TTL. Default is
+0.01. Additionally 2 milliseconds are always subtracted from the validity.
+
+=back
+
+=cut
+
+sub new {
+    my ( $class, %params ) = @_;
+    croak '"servers" parameter is required'
+      unless $params{servers} and @{ $params{servers} };
+    my $self = bless {
+        servers      => $params{servers},
+        retry_count  => defined $params{retry_count} ? $params{retry_count} : 3,
+        retry_delay  => defined $params{retry_delay} ? $params{retry_delay} : 0.2,
+        drift_factor => defined $params{drift_factor} ? $params{drift_factor} : 0.01,
+    }, $class;
+    $self->{quorum} = int( @{ $self->{servers} } / 2 ) + 1;
+    return $self;
+}
+
+# send commands to all servers and wait for replies. $commands is a reference
+# to array of commands that are sent to every server. Returns reference to
+# array that contains array of replies for every server.
+sub _broadcast {
+    my ( $self, $commands ) = @_;
+    my @replies;
+    my @servers = @{ $self->{servers} };
+    for my $i ( 0 .. $#servers ) {
+        my $redis = $servers[$i];
+        $replies[$i] = [];
+        try {
+            for my $j ( 0 .. $#$commands ) {
+                $redis->send_command( @{ $commands->[$j] }, sub { $replies[$i][$j] = $_[1] } );
+            }
+        }
+        catch {
+            my $error = $_;
+            $replies[$i][$_] ||= "$error" for 0 .. $#$commands;
+        };
+    }
+    for my $i ( 0 .. $#servers ) {
+        try {
+            $servers[$i]->mainloop;
+        }
+        catch {
+            my $error = $_;
+            $replies[$i][$_] ||= "$error" for 0 .. $#$commands;
+        };
+    }
+    return \@replies;
+}
+
+# the same as _broadcast, but the commands are scripts. If a server doesn't
+# have the script in the cache, send it again using EVAL
+sub _broadcast_scripts {
+    my ( $self, $name, $commands ) = @_;
+    my $replies = $self->_broadcast(
+        [ map { [ 'EVALSHA', $SHA{$name}, 1, @$_ ] } @$commands ] );
+    for my $i ( 0 .. $#$replies ) {
+        my @noscript =
+          grep { defined $replies->[$i][$_] and "$replies->[$i][$_]" =~ /^NOSCRIPT/ } 0 .. $#$commands;
+        next unless @noscript;
+        my $redis = $self->{servers}[$i];
+        try {
+            for my $j (@noscript) {
+                $redis->send_command( 'EVAL', $LUA{$name}, 1, @{ $commands->[$j] },
+                    sub { $replies->[$i][$j] = $_[1] } );
+            }
+            $redis->mainloop;
+        }
+        catch {
+            my $error = $_;
+            $replies->[$i][$_] = "$error" for @noscript;
+        };
+    }
+    return $replies;
+}
+
+sub _validity {
+    my ( $self, $ttl, $started ) = @_;
+    my $validity = $ttl - ( time - $started ) - $ttl * $self->{drift_factor} - 0.002;
+    return $validity > 0 ? $validity : 0;
+}
+
+# return a random token for the lock. Forked processes inherit the state of
+# rand, so the token is read from /dev/urandom, or if it is not available is
+# derived from the process ID, the time, and a counter
+my $counter = 0;
+
+sub _token {
+    if ( open my $fh, '<:raw', '/dev/urandom' ) {
+        my $read = sysread $fh, my $bytes, 16;
+        return unpack 'H*', $bytes if $read and $read == 16;
+    }
+    return substr sha1_hex( join ':', $$, time, ++$counter, rand ), 0, 32;
+}
+
+=head2 $self->lock($resource, $ttl)
+
+try to acquire the lock on I<$resource> for I<$ttl> seconds. I<$ttl> may be
+fractional, but is rounded to milliseconds. Returns a lock object if the lock
+has been acquired or undef otherwise. Lock object is a hash with the
+following elements:
+
+=over 4
+
+=item resource
+
+name of the resource, it is the key that is set on the servers
+
+=item token
+
+random value that identifies the owner of the lock
+
+=item validity
+
+number of seconds for which the lock is valid, counting from the moment when
+it was acquired
+
+=item expires
+
+time when the lock expires as returned by L<Time::HiRes/time>
+
+=back
+
+=cut
+
+sub lock {
+    my ( $self, $resource, $ttl ) = @_;
+    my $ttl_ms = int( $ttl * 1000 );
+    croak "TTL must be at least 1 millisecond" unless $ttl_ms > 0;
+    for my $attempt ( 1 .. $self->{retry_count} || 1 ) {
+        my $token   = _token();
+        my $started = time;
+        my $replies = $self->_broadcast( [ [ 'SET', $resource, $token, 'NX', 'PX', $ttl_ms ] ] );
+        my $locked  = grep { defined $_->[0] and not ref $_->[0] and $_->[0] eq 'OK' } @$replies;
+        my $validity = $self->_validity( $ttl_ms / 1000, $started );
+        my $lock = {
+            resource => $resource,
+            token    => $token,
+            validity => $validity,
+            expires  => $started + $validity,
+        };
+        return $lock if $locked >= $self->{quorum} and $validity > 0;
+
+        # release the lock on the servers that accepted it
+        $self->unlock($lock);
+        sleep rand $self->{retry_delay} if $attempt < $self->{retry_count};
+    }
+    return;
+}
+
+=head2 $self->unlock(@locks)
+
+release the locks on all servers. Returns the number of locks released on
+the majority of the servers.
+
+=cut
+
+sub unlock {
+    my ( $self, @locks ) = @_;
+    return 0 unless @locks;
+    my $replies = $self->_broadcast_scripts( unlock => [ map { [ @$_{qw(resource token)} ] } @locks ] );
+    my $released = 0;
+    for my $j ( 0 .. $#locks ) {
+        $locks[$j]{validity} = 0;
+        my $count = grep { defined $_->[$j] and not ref $_->[$j] and $_->[$j] eq '1' } @$replies;
+        $released++ if $count >= $self->{quorum};
+    }
+    return $released;
+}
+
+=head2 $self->extend($ttl, @locks)
+
+extend the locks so they expire in I<$ttl> seconds. Scripts for all locks are
+sent to every server in one pipelined batch. Updates I<validity> and
+I<expires> of the lock objects, a lock that could not be extended on the
+majority of the servers gets zero validity, and you should assume that the
+lock is lost. Returns the list of locks.
+
+=cut
+
+sub extend {
+    my ( $self, $ttl, @locks ) = @_;
+    my $ttl_ms = int( $ttl * 1000 );
+    croak "TTL must be at least 1 millisecond" unless $ttl_ms > 0;
+    return unless @locks;
+    my $started = time;
+    my $replies =
+      $self->_broadcast_scripts( extend => [ map { [ @$_{qw(resource token)}, $ttl_ms ] } @locks ] );
+    my $validity = $self->_validity( $ttl_ms / 1000, $started );
+    for my $j ( 0 .. $#locks ) {
+        my $count = grep { defined $_->[$j] and not ref $_->[$j] and $_->[$j] eq '1' } @$replies;
+        my $lock = $locks[$j];
+        if ( $count >= $self->{quorum} and $validity > 0 ) {
+            $lock->{validity} = $validity;
+            $lock->{expires}  = $started + $validity;
+        }
+        else {
+            $lock->{validity} = 0;
+            $lock->{expires}  = $started;
+        }
+    }
+    return @locks;
+}
+
+1;
+
+__END__
+
+=head1 SEE ALSO
+
+L<RedisDB>, L<https://redis.io/docs/manual/patterns/distributed-locks/>
+
+=head1 AUTHOR
+
+Pavel Shaydo, C<< <zwon at cpan.org> >>
+
+=head1 LICENSE AND COPYRIGHT
+
+Copyright 2011-2021 Pavel Shaydo.
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of either: the GNU General Public License as published
+by the Free Software Foundation; or the Artistic License.
+
+See http://dev.perl.org/licenses/ for more information.
+
+=cut
@@ -0,0 +1,433 @@
+package RedisDB::Scheduler;
+
+use strict;
+use warnings;
+our $VERSION = "2.57";
+$VERSION = eval $VERSION;
+
+use Carp;
+use Digest::SHA qw(sha1_hex);
+use RedisDB::Cluster;
+use Time::HiRes qw(time sleep);
+
+=head1 NAME
+
+RedisDB::Scheduler - delayed tasks queue on top of redis sorted sets
+
+=head1 SYNOPSIS
+
+    my $scheduler = RedisDB::Scheduler->new(
+        redis              => RedisDB->new,
+        name               => 'mail',
+        visibility_timeout => 60,
+    );
+
+    # producer
+    $scheduler->schedule( $task, time + 3600 );
+
+    # worker
+    while (1) {
+        my @tasks = $scheduler->claim(100);
+        unless (@tasks) {
+            $scheduler->wait_for_tasks(10);
+            next;
+        }
+        my ( @done, @failed );
+        for (@tasks) {
+            if ( process($_) ) { push @done, $_ } else { push @failed, $_ }
+        }
+        $scheduler->ack(@done);
+        $scheduler->retry( 60, @failed );
+    }
+
+=head1 DESCRIPTION
+
+This module implements a queue of delayed tasks. Tasks are strings, they are
+stored in a sorted set with the time when the task is due as the score. Workers
+claim due tasks in batches, claiming is done atomically by a server side
+script, so every task is given to only one worker. Claimed tasks are moved into
+the processing set, and if the worker does not acknowledge the task before
+visibility timeout expires, the task is returned into the schedule and may be
+claimed by another worker. Acknowledgements and retries are sent to the server
+in pipelined batches.
+
+Schedule may be split into several partitions, every partition uses its own
+hash tag, so in redis cluster partitions are distributed between nodes. The
+partition of the task is determined from the task itself. Note, that the same
+task string can be scheduled only once, scheduling it again changes its due
+time.
+
+=head1 METHODS
+
+=cut
+
+# move tasks whose visibility timeout has expired back into the schedule and
+# then move up to ARGV[2] due tasks into the processing set
+my $CLAIM = <<'LUA';
+local expired = redis.call('ZRANGEBYSCORE', KEYS[2], '-inf', ARGV[1], 'LIMIT', 0, ARGV[2])
+for _, task in ipairs(expired) do
+    redis.call('ZREM', KEYS[2], task)
+    redis.call('ZADD', KEYS[1], ARGV[1], task)
+end
+local tasks = redis.call('ZRANGEBYSCORE', KEYS[1], '-inf', ARGV[1], 'LIMIT', 0, ARGV[2])
+for _, task in ipairs(tasks) do
+    redis.call('ZREM', KEYS[1], task)
+    redis.call('ZADD', KEYS[2], ARGV[3], task)
+end
+return tasks
+LUA
+
+# move claimed task back into the schedule
+my $RETRY = <<'LUA';
+if redis.call('ZREM', KEYS[2], ARGV[1]) == 1 then
+    redis.call('ZADD', KEYS[1], ARGV[2], ARGV[1])
+    return 1
+end
+return 0
+LUA
+
+my %SHA = (
+    claim => sha1_hex($CLAIM),
+    retry => sha1_hex($RETRY),
+);
+my %LUA = (
+    claim => $CLAIM,
+    retry => $RETRY,
+);
+
+=head2 $class->new(%params)
+
+create a new scheduler object. Accepts the following parameters:
+
+=over 4
+
+=item redis
+
+L<RedisDB> or L<RedisDB::Cluster> object, required
+
+=item name
+
+name of the queue, all keys used by the queue start with this name. Required.
+
+=item partitions
+
+number of partitions. Default is 1
+
+=item visibility_timeout
+
+time in seconds after which claimed but not acknowledged task is returned into
+the schedule. Default is 30
+
+=item durability
+
+if specified, every batch of commands that modifies the queue is followed by a
+single WAIT or WAITAOF command, and methods croak if the changes were not acknowledged by the
+requested number of replicas. The value is a hash as described for
+I<send_durable> method of L<RedisDB>.
+
+=back
+
+=cut
+
+sub new {
+    my ( $class, %params ) = @_;
+    my $self = {
+        redis              => $params{redis} || croak('"redis" parameter is required'),
+        name               => $params{name}  || croak('"name" parameter is required'),
+        partitions         => $params{partitions} || 1,
+        visibility_timeout => $params{visibility_timeout} || 30,
+        durability         => $params{durability},
+        _next_partition    => 0,
+    };
+    return bless $self, $class;
+}
+
+sub _partition {
+    my ( $self, $task ) = @_;
+    return 0 if $self->{partitions} == 1;
+    return RedisDB::Cluster::crc16($task) % $self->{partitions};
+}
+
+sub _due_key {
+    my ( $self, $partition ) = @_;
+    return "{$self->{name}:$partition}:due";
+}
+
+sub _processing_key {
+    my ( $self, $partition ) = @_;
+    return "{$self->{name}:$partition}:processing";
+}
+
+sub _notify_key {
+    my $self = shift;
+    return "{$self->{name}}:notify";
+}
+
+sub _ms {
+    return int( 1000 * shift );
+}
+
+# same as _pipeline, but for commands that do not modify the queue, so they
+# are not followed by WAIT even if durability is requested
+sub _read {
+    my ( $self, @commands ) = @_;
+    local $self->{durability};
+    return $self->_pipeline(@commands);
+}
+
+# send all commands to the server, wait for all replies and return them.
+# Commands are pipelined if redis object supports send_command.
+sub _pipeline {
+    my ( $self, @commands ) = @_;
+    my $redis = $self->{redis};
+    my @replies;
+    if ( my $durability = $self->{durability} ) {
+        my $required = defined $durability->{replicas} ? $durability->{replicas} : 1;
+        my $failed;
+        for my $i ( 0 .. $#commands ) {
+            $redis->send_durable(
+                $durability,
+                @{ $commands[$i] },
+                sub {
+                    my ( undef, $reply, $achieved ) = @_;
+                    $replies[$i] = $reply;
+                    if ( ref($achieved) =~ /^RedisDB::Error/ ) {
+                        $failed ||= "$achieved";
+                    }
+                    elsif ( $achieved->{replicas} < $required ) {
+                        $failed ||= "Changes were acknowledged by $achieved->{replicas}"
+                          . " replicas out of $required";
+                    }
+                    elsif ( $durability->{aof} and not $achieved->{local} ) {
+                        $failed ||= "Changes were not written to the local AOF";
+                    }
+                }
+            );
+        }
+        $redis->mainloop;
+        croak $failed if $failed;
+    }
+    elsif ( $redis->can('send_command') ) {
+        for my $i ( 0 .. $#commands ) {
+            $redis->send_command( @{ $commands[$i] }, sub { $replies[$i] = $_[1] } );
+        }
+        $redis->mainloop;
+    }
+    else {
+        @replies = map { $redis->execute(@$_) } @commands;
+    }
+
+    # if script is not in the cache, load it and repeat the command
+    my @noscript = grep { ref $replies[$_] and "$replies[$_]" =~ /^NOSCRIPT/ } 0 .. $#replies;
+    if (@noscript) {
+        my @retry = $self->_pipeline(
+            map {
+                my ( undef, $sha, @args ) = @{ $commands[$_] };
+                my ($script) = grep { $SHA{$_} eq $sha } keys %SHA;
+                [ 'EVAL', $LUA{$script}, @args ]
+            } @noscript
+        );
+        @replies[@noscript] = @retry;
+    }
+    for (@replies) {
+        croak "$_" if ref $_ and ref($_) =~ /^RedisDB::Error/;
+    }
+    return @replies;
+}
+
+sub _script {
+    my ( $self, $name, $keys, @args ) = @_;
+    return [ 'EVALSHA', $SHA{$name}, scalar(@$keys), @$keys, @args ];
+}
+
+=head2 $self->schedule($task, $time)
+
+schedule I<$task> to be due at I<$time>. Time is specified in seconds since
+the epoch and may be fractional.
+
+=cut
+
+sub schedule {
+    my ( $self, $task, $time ) = @_;
+    return $self->schedule_many( [ $task, $time ] );
+}
+
+=head2 $self->schedule_many([$task, $time], ...)
+
+schedule multiple tasks sending all commands in a single batch
+
+=cut
+
+sub schedule_many {
+    my ( $self, @tasks ) = @_;
+    return unless @tasks;
+    my @commands =
+      map { [ 'ZADD', $self->_due_key( $self->_partition( $_->[0] ) ), _ms( $_->[1] ), $_->[0] ] }
+      @tasks;
+    $self->_pipeline( @commands, [ 'LPUSH', $self->_notify_key, 1 ],
+        [ 'LTRIM', $self->_notify_key, 0, 0 ] );
+    return scalar @tasks;
+}
+
+=head2 $self->claim($count)
+
+atomically claim up to I<$count> due tasks and return them. Claimed tasks
+should be acknowledged using I<ack> before visibility timeout expires,
+otherwise they will be returned into the schedule. If there are multiple
+partitions, the method checks them in round-robin order till it claims
+I<$count> tasks.
+
+=cut
+
+sub claim {
+    my ( $self, $count ) = @_;
+    $count ||= 1;
+    my @tasks;
+    for ( 1 .. $self->{partitions} ) {
+        my $partition = $self->{_next_partition}++ % $self->{partitions};
+        my $now       = time;
+        my ($claimed) = $self->_pipeline(
+            $self->_script(
+                'claim',
+                [ $self->_due_key($partition), $self->_processing_key($partition) ],
+                _ms($now), $count - @tasks, _ms( $now + $self->{visibility_timeout} ),
+            )
+        );
+        push @tasks, @$claimed;
+        last if @tasks >= $count;
+    }
+    return @tasks;
+}
+
+=head2 $self->ack(@tasks)
+
+acknowledge that I<@tasks> have been processed and remove them from the
+processing set
+
+=cut
+
+sub ack {
+    my ( $self, @tasks ) = @_;
+    return 0 unless @tasks;
+    my $removed = 0;
+    $removed += $_
+      for $self->_pipeline(
+        map { [ 'ZREM', $self->_processing_key( $self->_partition($_) ), $_ ] } @tasks );
+    return $removed;
+}
+
+=head2 $self->retry($delay, @tasks)
+
+return claimed I<@tasks> into the schedule, tasks will be due after I<$delay>
+seconds. Returns the number of tasks that were rescheduled, tasks that were
+not in the processing set, e.g. because their visibility timeout has already
+expired, are ignored.
+
+=cut
+
+sub retry {
+    my ( $self, $delay, @tasks ) = @_;
+    return 0 unless @tasks;
+    my $due = _ms( time + $delay );
+    my $retried = 0;
+    $retried += $_ for $self->_pipeline(
+        map {
+            my $partition = $self->_partition($_);
+            $self->_script( 'retry',
+                [ $self->_due_key($partition), $self->_processing_key($partition) ],
+                $_, $due )
+        } @tasks
+    );
+    $self->_pipeline( [ 'LPUSH', $self->_notify_key, 1 ], [ 'LTRIM', $self->_notify_key, 0, 0 ] )
+      if $retried;
+    return $retried;
+}
+
+=head2 $self->requeue(@tasks)
+
+return claimed I<@tasks> into the schedule making them due immediately. Same
+as I<retry> with zero delay.
+
+=cut
+
+sub requeue {
+    my ( $self, @tasks ) = @_;
+    return $self->retry( 0, @tasks );
+}
+
+=head2 $self->next_due
+
+return the time when the next task in the schedule is due, or undef if the
+schedule is empty. Tasks that are being processed are not taken into account.
+
+=cut
+
+sub next_due {
+    my $self = shift;
+    my $next;
+    for my $reply (
+        $self->_read(
+            map { [ 'ZRANGE', $self->_due_key($_), 0, 0, 'WITHSCORES' ] }
+              0 .. $self->{partitions} - 1
+        )
+      )
+    {
+        next unless @$reply;
+        $next = $reply->[1] if not defined $next or $reply->[1] < $next;
+    }
+    return defined $next ? $next / 1000 : undef;
+}
+
+=head2 $self->wait_for_tasks($max_wait)
+
+block until the next task in the schedule is due, or until a new task is
+scheduled, but no longer than I<$max_wait> seconds. Instead of polling the
+server, the method blocks on a list to which I<schedule> pushes a notification.
+Returns immediately if there are due tasks already. Note, that if you are
+using I<timeout> option of the L<RedisDB> object, it should be longer than
+I<$max_wait>. Only one of the workers waiting for tasks is woken up by the
+notification.
+
+=cut
+
+sub wait_for_tasks {
+    my ( $self, $max_wait ) = @_;
+    croak "maximum wait time is not specified" unless $max_wait;
+    my $next = $self->next_due;
+    my $wait = defined $next ? $next - time : $max_wait;
+    $wait = $max_wait if $wait > $max_wait;
+    return if $wait <= 0;
+
+    # BLPOP timeout has one second resolution on older servers
+    if ( $wait < 1 ) {
+        sleep $wait;
+    }
+    else {
+        $self->_read( [ 'BLPOP', $self->_notify_key, int $wait ] );
+    }
+    return;
+}
+
+1;
+
+__END__
+
+=head1 SEE ALSO
+
+L<RedisDB>, L<RedisDB::Cluster>
+
+=head1 AUTHOR
+
+Pavel Shaydo, C<< <zwon at cpan.org> >>
+
+=head1 LICENSE AND COPYRIGHT
+
+Copyright 2011-2021 Pavel Shaydo.
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of either: the GNU General Public License as published
+by the Free Software Foundation; or the Artistic License.
+
+See http://dev.perl.org/licenses/ for more information.
+
+=cut
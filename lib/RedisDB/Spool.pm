@@ -0,0 +1,292 @@
+package RedisDB::Spool;
+
+use strict;
+use warnings;
+our $VERSION = "2.57";
+$VERSION = eval $VERSION;
+
+use Carp;
+use Fcntl qw(:DEFAULT :flock SEEK_SET);
+use IO::Handle;
+use Time::HiRes qw(time);
+
+=head1 NAME
+
+RedisDB::Spool - local store-and-forward spool for writes
+
+=head1 SYNOPSIS
+
+    my $spool = RedisDB::Spool->new(
+        path      => '/var/spool/myapp/redis.spool',
+        commands  => [qw(SET HSET LPUSH RPUSH SADD ZADD INCRBY)],
+        max_bytes => 512 * 1024 * 1024,
+    );
+    my $redis = RedisDB->new( host => 'master', spool => $spool );
+
+    # returns "SPOOLED" if the server is not available
+    $redis->lpush( events => $event );
+
+    # somewhere in the main loop
+    $redis->drain_spool;
+
+=head1 DESCRIPTION
+
+If L<RedisDB> object has a spool and it fails to connect to the server,
+instead of throwing the error it appends eligible commands to the spool file
+and returns "SPOOLED" status as the reply. Eligible commands are the ones you
+listed in I<commands> parameter, normally these are writes that don't require
+the reply and that may be safely delayed. While the spool is not empty, all
+eligible commands are appended to the spool without trying to send them to
+the server, so the commands reach the server in the same order as they were
+issued. Other commands are sent to the server as usual, note, that until the
+spool is drained they may see the state of the database without spooled
+writes.
+
+The spool is replayed by I<drain_spool> method of L<RedisDB> in pipelined
+batches. It is invoked automatically when an eligible command is sent and
+I<drain_interval> seconds passed since the last attempt, you can also invoke
+it explicitly. The position up to which the spool was replayed is stored in a
+separate file with ".pos" suffix after every batch, so if the process was
+restarted, replaying continues from the last acknowledged batch. If
+connection was lost in the middle of a batch, the batch is replayed again, so
+delivery is at least once. Commands to which the server replied with an error
+are not retried, they are counted in I<stats>.
+
+The spool file should be used by only one process at a time, the file is
+locked when opened.
+
+=head1 METHODS
+
+=cut
+
+=head2 $class->new(%params)
+
+open the spool file, create it if it doesn't exist. Accepts the following
+parameters:
+
+=over 4
+
+=item path
+
+path to the spool file, required
+
+=item commands
+
+list of commands that may be spooled, required
+
+=item max_bytes
+
+maximum size of the spool file. If appending a command would exceed this
+size, the command is not spooled, and the error is returned or thrown instead.
+Default is 100MB.
+
+=item batch
+
+number of commands replayed in one pipelined batch. Default is 1000.
+
+=item drain_interval
+
+minimum interval in seconds between automatic attempts to drain the spool.
+Default is 1.
+
+=item sync
+
+if set, the spool file is synced to disk after every append
+
+=back
+
+=cut
+
+sub new {
+    my ( $class, %params ) = @_;
+    croak '"path" parameter is required' unless $params{path};
+    croak '"commands" parameter is required' unless $params{commands};
+    my $self = bless {
+        path           => $params{path},
+        commands       => { map { uc($_) => 1 } @{ $params{commands} } },
+        max_bytes      => $params{max_bytes} || 100 * 1024 * 1024,
+        batch          => $params{batch} || 1000,
+        drain_interval => defined $params{drain_interval} ? $params{drain_interval} : 1,
+        sync           => $params{sync},
+        stats          => { spooled => 0, replayed => 0, errors => 0, rejected => 0 },
+        _last_drain    => 0,
+    }, $class;
+    $self->_open;
+    return $self;
+}
+
+sub _open {
+    my $self = shift;
+    sysopen my $fh, $self->{path}, O_RDWR | O_CREAT | O_APPEND
+      or croak "Couldn't open $self->{path}: $!";
+    binmode $fh;
+    flock $fh, LOCK_EX | LOCK_NB or croak "Couldn't lock $self->{path}: $!";
+    sysopen my $pos_fh, "$self->{path}.pos", O_RDWR | O_CREAT
+      or croak "Couldn't open $self->{path}.pos: $!";
+    binmode $pos_fh;
+    sysread $pos_fh, my $pos, 8;
+    $self->{_fh}     = $fh;
+    $self->{_pos_fh} = $pos_fh;
+    $self->{_pos}    = $pos && length $pos == 8 ? unpack( 'Q>', $pos ) : 0;
+    $self->{_size}   = -s $fh;
+    $self->{_pos}    = $self->{_size} if $self->{_pos} > $self->{_size};
+
+    # the last record may be incomplete if the process was killed during
+    # append, cut it off, so new records are appended after complete ones
+    my $end = $self->{_pos};
+    while ( $end + 4 <= $self->{_size} ) {
+        sysseek $fh, $end, SEEK_SET or croak "Couldn't seek in spool file: $!";
+        my $len = unpack 'N', $self->_read(4);
+        last if $end + 4 + $len > $self->{_size};
+        $end += 4 + $len;
+    }
+    if ( $end < $self->{_size} ) {
+
+        # lengths are read from the file, so the offset is tainted
+        ($end) = $end =~ /^([0-9]+)$/;
+        truncate $fh, $end or croak "Couldn't truncate spool file: $!";
+        $self->{_size} = $end;
+    }
+    return;
+}
+
+=head2 $self->eligible($command)
+
+return true if I<$command> may be spooled
+
+=cut
+
+sub eligible {
+    my ( $self, $command ) = @_;
+    return $self->{commands}{ uc $command };
+}
+
+=head2 $self->pending
+
+return the number of bytes in the spool that have not been replayed yet
+
+=cut
+
+sub pending {
+    my $self = shift;
+    return $self->{_size} - $self->{_pos};
+}
+
+=head2 $self->append($request)
+
+append serialized request to the spool. Returns false if the spool is full.
+
+=cut
+
+sub append {
+    my ( $self, $request ) = @_;
+    my $record = pack( 'N', length $request ) . $request;
+    if ( $self->{_size} + length($record) > $self->{max_bytes} ) {
+        $self->{stats}{rejected}++;
+        return;
+    }
+    my $off = 0;
+    while ( $off < length $record ) {
+        my $written = syswrite $self->{_fh}, $record, length($record) - $off, $off;
+        croak "Couldn't write spool file: $!" unless defined $written;
+        $off += $written;
+    }
+    $self->{_fh}->sync if $self->{sync};
+    $self->{_size} += length $record;
+    $self->{stats}{spooled}++;
+    return 1;
+}
+
+# return the next batch of requests and the position after it, or an empty
+# list if there is nothing to replay
+sub _read_batch {
+    my $self = shift;
+    return unless $self->pending;
+    my $fh  = $self->{_fh};
+    my $pos = $self->{_pos};
+    my @requests;
+    while ( @requests < $self->{batch} and $pos + 4 <= $self->{_size} ) {
+        sysseek $fh, $pos, SEEK_SET or croak "Couldn't seek in spool file: $!";
+        my $len = unpack 'N', $self->_read(4);
+        last if $pos + 4 + $len > $self->{_size};
+        push @requests, $self->_read($len);
+        $pos += 4 + $len;
+    }
+
+    # skip incomplete record at the end of the file
+    $pos = $self->{_size} unless @requests;
+    return ( \@requests, $pos );
+}
+
+sub _read {
+    my ( $self, $len ) = @_;
+    my $buf = '';
+    while ( length $buf < $len ) {
+        my $read = sysread $self->{_fh}, $buf, $len - length $buf, length $buf;
+        croak "Couldn't read spool file: $!" unless defined $read;
+        croak "Unexpected end of spool file" unless $read;
+    }
+    return $buf;
+}
+
+# remember that requests up to $pos have been replayed. Truncate the file if
+# the whole spool has been replayed.
+sub _commit {
+    my ( $self, $pos, $replayed ) = @_;
+    $self->{stats}{replayed} += $replayed;
+    if ( $pos >= $self->{_size} ) {
+        truncate $self->{_fh}, 0 or croak "Couldn't truncate spool file: $!";
+        $self->{_size} = $pos = 0;
+    }
+    $self->{_pos} = $pos;
+    sysseek $self->{_pos_fh}, 0, SEEK_SET or croak "Couldn't seek in position file: $!";
+    defined syswrite( $self->{_pos_fh}, pack( 'Q>', $pos ) )
+      or croak "Couldn't write position file: $!";
+    return;
+}
+
+sub _drain_due {
+    my $self = shift;
+    return time - $self->{_last_drain} >= $self->{drain_interval};
+}
+
+sub _drain_started {
+    shift->{_last_drain} = time;
+}
+
+=head2 $self->stats
+
+return reference to a hash with the number of spooled, replayed, rejected
+commands, number of replayed commands to which the server returned an error,
+and the number of pending bytes
+
+=cut
+
+sub stats {
+    my $self = shift;
+    return { %{ $self->{stats} }, pending_bytes => $self->pending };
+}
+
+1;
+
+__END__
+
+=head1 SEE ALSO
+
+L<RedisDB>
+
+=head1 AUTHOR
+
+Pavel Shaydo, C<< <zwon at cpan.org> >>
+
+=head1 LICENSE AND COPYRIGHT
+
+Copyright 2011-2021 Pavel Shaydo.
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of either: the GNU General Public License as published
+by the Free Software Foundation; or the Artistic License.
+
+See http://dev.perl.org/licenses/ for more information.
+
+=cut
@@ -0,0 +1,108 @@
+use Test::Most 0.22;
+use RedisDB;
+use RedisDB::Admission;
+use lib 't/lib';
+use MockServer;
+
+# replies +OK to every command with a delay, LOG returns the list of received
+# commands
+my @log;
+my $server = MockServer->new(
+    sub {
+        my ( $conn, @args ) = @_;
+        if ( $args[0] eq 'LOG' ) {
+            my $reply = MockServer::bulk(@log);
+            @log = ();
+            return $reply;
+        }
+        push @log, join ' ', @args;
+        return "+OK\015\012";
+    },
+    delay => 0.2,
+);
+plan skip_all => "Can't start server" unless $server;
+my $port = $server->port;
+
+my $admission = RedisDB::Admission->new(
+    initial_limit => 2,
+    max_limit     => 2,
+    low_priority  => ['SCAN'],
+);
+my $redis = RedisDB->new( host => '127.0.0.1', port => $port, raise_error => 0, admission => $admission );
+my $other = RedisDB->new( host => '127.0.0.1', port => $port, raise_error => 0, admission => $admission );
+
+subtest "shed and queue" => sub {
+    my @replies;
+    my $cb = sub { push @replies, "$_[1]" };
+    $redis->set( 'a', 1, $cb );
+    $redis->set( 'b', 1, $cb );
+    my $res = $redis->set( 'c', 1, $cb );
+    isa_ok $res, 'RedisDB::Error::OVERLOADED', "command exceeding the limit";
+    is $redis->scan( 0, $cb ), 1, "low priority command was queued";
+    isa_ok $other->get('a'), 'RedisDB::Error::OVERLOADED', "limit is shared by connections";
+    $redis->mainloop;
+    like $replies[0], qr/^Too many commands in flight/, "callback got the error";
+    eq_or_diff [ @replies[ 1 .. 3 ] ], [qw(OK OK OK)], "got replies";
+    eq_or_diff $redis->execute('LOG'), [ 'SET a 1', 'SET b 1', 'SCAN 0' ],
+      "queued command was sent after replies";
+    my $stats = $admission->stats->{"127.0.0.1:$port"};
+    is $stats->{shed},     2, "two commands were shed";
+    is $stats->{queued},   1, "one command was queued";
+    is $stats->{admitted}, 4, "four commands were admitted";
+    is $stats->{inflight}, 0, "nothing is in flight";
+};
+
+subtest "queued command is processed once" => sub {
+    {
+
+        package PrefixCodec;
+        sub new    { bless {}, shift }
+        sub encode { "x$_[1]" }
+        sub decode { substr $_[1], 1 }
+    }
+    my $redis = RedisDB->new(
+        host        => '127.0.0.1',
+        port        => $port,
+        value_codec => PrefixCodec->new,
+        admission   => RedisDB::Admission->new( initial_limit => 1, max_limit => 1, low_priority => ['SET'] ),
+    );
+    $redis->set( 'a', 1, RedisDB::IGNORE_REPLY );
+    my $reply;
+    $redis->set( 'b', 2, sub { $reply = $_[1] } );
+    $redis->mainloop;
+    is $reply, 'OK', "queued command got the reply";
+    eq_or_diff $redis->execute('LOG'), [ 'SET a x1', 'SET b x2' ], "value was encoded once";
+};
+
+subtest "reset" => sub {
+    $redis->set( 'a', 1, RedisDB::IGNORE_REPLY );
+    is $admission->stats->{"127.0.0.1:$port"}{inflight}, 1, "one command is in flight";
+    $redis->reset_connection;
+    is $admission->stats->{"127.0.0.1:$port"}{inflight}, 0, "reset connection forgot it";
+
+    $redis->set( $_, 1, RedisDB::IGNORE_REPLY ) for qw(a b);
+    my $reply;
+    is $redis->scan( 0, sub { $reply = $_[1] } ), 1, "command was queued";
+    $redis->reset_connection;
+    isa_ok $reply, 'RedisDB::Error::DISCONNECTED', "queued command got the error";
+    is $admission->stats->{"127.0.0.1:$port"}{inflight}, 0, "nothing is in flight";
+};
+
+subtest "limit adjustment" => sub {
+    my $aimd = RedisDB::Admission->new( initial_limit => 10, smoothing => 0.5 );
+    my $node = { host => 'node', port => 1 };
+    my $server = $aimd->_server($node);
+    $aimd->_observe( $server, 0.001, 'OK' ) for 1 .. 10;
+    ok $server->{limit} > 10.9 && $server->{limit} < 11, "limit grows by one per limit replies"
+      or diag $server->{limit};
+    $aimd->_observe( $server, 0.01, 'OK' ) for 1 .. 3;
+    ok $server->{limit} < 10 && $server->{limit} > 9.5, "limit decreased once per round trip"
+      or diag $server->{limit};
+    is $server->{late}, 3, "late replies were counted";
+    $server->{_decreased_at} = 0;
+    $aimd->_observe( $server, 0.001, RedisDB::Error::EAGAIN->new("timeout") );
+    ok $server->{limit} < 9, "timeout decreased the limit";
+    is $server->{errors}, 1, "timeout was counted";
+};
+
+done_testing;
@@ -0,0 +1,102 @@
+use Test::Most 0.22;
+use RedisDB;
+use RedisDB::Bitmap;
+
+# stores strings in memory and replies to commands in mainloop
+{
+    package FakeRedis;
+    sub new { bless { db => {}, pending => [], commands => 0 }, shift }
+
+    sub send_command {
+        my $self     = shift;
+        my $callback = pop;
+        push @{ $self->{pending} }, [ [@_], $callback ];
+        $self->{commands}++;
+        return 1;
+    }
+
+    sub mainloop {
+        my $self = shift;
+        my $db   = $self->{db};
+        while ( my $req = shift @{ $self->{pending} } ) {
+            my ( $command, $key, @args ) = @{ $req->[0] };
+            my $value = defined $db->{$key} ? $db->{$key} : '';
+            my $reply;
+            if ( $command eq 'STRLEN' ) {
+                $reply = length $value;
+            }
+            elsif ( $command eq 'GETRANGE' ) {
+                $reply = substr $value, $args[0], $args[1] - $args[0] + 1;
+            }
+            elsif ( $command eq 'SETRANGE' ) {
+                $value .= "\0" x ( $args[0] - length $value ) if $args[0] > length $value;
+                substr( $value, $args[0], length $args[1] ) = $args[1];
+                $reply = length( $db->{$key} = $value );
+            }
+            elsif ( $command eq 'DEL' ) {
+                $reply = delete $db->{$key} ? 1 : 0;
+            }
+            $req->[1]->( $self, $reply );
+        }
+    }
+}
+
+sub random_bitmap {
+    return join '', map { chr int rand 256 } 1 .. shift;
+}
+
+sub count_bits {
+    my $bitmap = shift;
+    return scalar grep { vec $bitmap, $_, 1 } 0 .. 8 * length($bitmap) - 1;
+}
+
+subtest "functions" => sub {
+    my ( $x, $y ) = ( random_bitmap(1000), random_bitmap(700) );
+    my $padded = $y . "\0" x 300;
+    my $and    = RedisDB::Bitmap::bitop( AND => $x, $y );
+    my $or     = RedisDB::Bitmap::bitop( or  => $x, $y );
+    my $xor    = RedisDB::Bitmap::bitop( XOR => $x, $y );
+    is length $and, 1000, "result has the size of the longest bitmap";
+    my @errors = grep {
+        ( ord( substr $and, $_, 1 ) != ( ord( substr $x, $_, 1 ) & ord( substr $padded, $_, 1 ) ) )
+          or ( ord( substr $or, $_, 1 ) != ( ord( substr $x, $_, 1 ) | ord( substr $padded, $_, 1 ) ) )
+          or ( ord( substr $xor, $_, 1 ) != ( ord( substr $x, $_, 1 ) ^ ord( substr $padded, $_, 1 ) ) )
+    } 0 .. 999;
+    eq_or_diff \@errors, [], "AND, OR, and XOR are correct";
+    is RedisDB::Bitmap::bitop( NOT => "\x0f\xf0" ), "\xf0\x0f", "NOT";
+    is RedisDB::Bitmap::bitop( AND => "12", "3" ), "\x31\x00", "numeric strings are not numbers";
+
+    my $big = random_bitmap(200_000);
+    is RedisDB::Bitmap::bitcount($big), count_bits($big), "bitcount";
+    is RedisDB::Bitmap::bitcount( "\xff\x01\x03", 1 ), 3, "bitcount with start";
+    is RedisDB::Bitmap::bitcount( "\xff\x01\x03", -3, -2 ), 9, "bitcount with negative range";
+    is RedisDB::Bitmap::bitcount( "\xff\x01\x03", 2, 1 ), 0, "bitcount with empty range";
+
+    is RedisDB::Bitmap::bitpos( "\x00\x00\x20", 1 ), 18, "bitpos of set bit";
+    is RedisDB::Bitmap::bitpos( "\xff\xf0", 0 ), 12, "bitpos of clear bit";
+    is RedisDB::Bitmap::bitpos( "\xff\xff", 0 ), 16, "clear bit past the end";
+    is RedisDB::Bitmap::bitpos( "\xff\xff", 0, 0, -1 ), -1, "no clear bit in the range";
+    is RedisDB::Bitmap::bitpos( "\x80\x00\x01", 1, 1 ), 23, "bitpos with start";
+    is RedisDB::Bitmap::bitpos( "", 1 ), -1, "no set bits in empty bitmap";
+};
+
+subtest "fetch and store" => sub {
+    my $redis  = FakeRedis->new;
+    my $bitmap = RedisDB::Bitmap->new( redis => $redis, chunk_size => 100 );
+    my ( $x, $y ) = ( random_bitmap(1050), random_bitmap(300) );
+    is $bitmap->store( x => $x ), 1050, "stored x";
+    is $redis->{commands}, 12, "stored in chunks";
+    $bitmap->store( y => $y );
+    $redis->{commands} = 0;
+    my @got = $bitmap->fetch(qw(x y z));
+    is $redis->{commands}, 3 + 11 + 3, "fetched in chunks";
+    ok $got[0] eq $x && $got[1] eq $y, "fetched bitmaps";
+    is $got[2], '', "missing bitmap is empty";
+
+    is $bitmap->combine( XOR => 'xy', 'x', 'y' ), 1050, "stored XOR of x and y";
+    ok $redis->{db}{xy} eq RedisDB::Bitmap::bitop( XOR => $x, $y ), "stored the right value";
+    is $bitmap->store( x => 'abc' ), 3, "replaced x with a shorter value";
+    is $redis->{db}{x}, 'abc', "old value was deleted";
+};
+
+done_testing;
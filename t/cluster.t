@@ -1,5 +1,8 @@
 use Test::Most;
 use RedisDB::Cluster;
+use IO::Select;
+use lib 't/lib';
+use MockServer;
 
 subtest crc16 => sub {
     is RedisDB::Cluster::crc16("123456789"), 0x31c3,
@@ -19,4 +22,52 @@ subtest "key slot" => sub {
       "if hash tag is empty whole key is hashed";
 };
 
+# start a server that replies to every command with the reply from %replies
+sub mock_node {
+    my %replies = @_;
+    return MockServer->new(
+        sub {
+            my ( $conn, $command ) = @_;
+            return $replies{$command} || "-ERR unknown command\015\012";
+        }
+    );
+}
+
+subtest "asynchronous commands" => sub {
+    my $slot = RedisDB::Cluster::key_slot("foo");
+    my $node_b = mock_node(
+        GET    => "\$3\015\012bar\015\012",
+        ASKING => "+OK\015\012",
+        SET    => "+OK\015\012",
+    ) or plan skip_all => "Can't start server";
+    my $port_b = $node_b->port;
+    my $node_a = mock_node(
+        GET => "-MOVED $slot 127.0.0.1:$port_b\015\012",
+        SET => "-ASK 1 127.0.0.1:$port_b\015\012",
+    ) or plan skip_all => "Can't start server";
+    my $port_a = $node_a->port;
+    my $cluster = RedisDB::Cluster->new(
+        startup_nodes           => [ { host => '127.0.0.1', port => $port_a } ],
+        no_slots_initialization => 1,
+    );
+
+    my ( $get, $set );
+    $cluster->get( "foo", sub { $get = $_[1] } );
+    $cluster->set( "baz", 1, sub { $set = $_[1] } );
+    $cluster->mainloop;
+    is $get, "bar", "MOVED redirection was followed";
+    is $cluster->{_slots}[$slot], "127.0.0.1:$port_b", "slots table was updated";
+    is $set, "OK", "ASK redirection was followed";
+
+    undef $get;
+    $cluster->get( "foo", sub { $get = $_[1] } );
+    my $sel = IO::Select->new( $cluster->sockets );
+    is $sel->count, 2, "two sockets";
+    while ( $cluster->process_replies ) {
+        $sel->can_read(1);
+    }
+    is $get, "bar", "got the reply using process_replies";
+    dies_ok { $cluster->send_command( "get", "foo" ) } "callback is required";
+};
+
 done_testing;
@@ -0,0 +1,50 @@
+use Test::Most 0.22;
+use Test::RedisDB;
+
+BEGIN {
+    plan skip_all => "This test requires Coro and AnyEvent"
+      unless eval { require Coro; require Coro::AnyEvent; 1 };
+}
+use Coro;
+use RedisDB::Coro;
+
+my $server = Test::RedisDB->new;
+plan( skip_all => "Can't start redis-server" ) unless $server;
+
+my $redis = RedisDB::Coro->new( host => $server->host, port => $server->port );
+$redis->set( "key:$_", "value:$_" ) for 1 .. 20;
+
+subtest "coroutines share connection" => sub {
+    my %got;
+    my @coros = map {
+        my $id = $_;
+        async {
+            my $value = $redis->get("key:$id");
+            Coro::cede;
+            $got{$id} = [ $value, $redis->incr("counter") > 0 ];
+        };
+    } 1 .. 20;
+    $_->join for @coros;
+    eq_or_diff \%got, { map { $_ => [ "value:$_", 1 ] } 1 .. 20 }, "every coroutine got its reply";
+    is $redis->get("counter"), 20, "counter was incremented by every coroutine";
+};
+
+subtest "callbacks and errors" => sub {
+    my @replies;
+    $redis->set( "cb:$_", $_, sub { push @replies, $_[1] } ) for 1 .. 5;
+    my $blocker = async { $redis->blpop( "empty_list", 1 ) };
+    my $pinger  = async { $redis->ping };
+    is $pinger->join, "PONG", "ping was not blocked by callbacks";
+    $redis->mainloop;
+    is @replies, 5, "callbacks were invoked";
+    is $blocker->join, undef, "blpop timed out";
+    my $failed = async { eval { $redis->hget( "key:1", "field" ); 1 } ? "" : "$@" };
+    like $failed->join, qr/WRONGTYPE/, "error is thrown in the coroutine";
+    dies_ok { $redis->subscribe("channel") } "subscriptions are not supported";
+    for (qw(near_cache retry spool endpoints read_from_replicas deferred_callbacks admission)) {
+        dies_ok { RedisDB::Coro->new( host => $server->host, port => $server->port, $_ => 1 ) }
+        "$_ option is not supported";
+    }
+};
+
+done_testing;
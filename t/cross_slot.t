@@ -0,0 +1,155 @@
+use Test::Most 0.22;
+use RedisDB;
+use RedisDB::Cluster;
+
+# emulates cluster storing sets and sorted sets in memory. Only commands used
+# by cross-slot operations are supported, SSCAN and ZSCAN return COUNT elements
+# per page, and the last element of the previous page again
+{
+    package FakeCluster;
+    our @ISA = qw(RedisDB::Cluster);
+    sub new { bless { data => {}, pending => [], commands => [] }, shift }
+
+    sub send_command {
+        my $self     = shift;
+        my $callback = pop;
+        push @{ $self->{pending} }, [ [@_], $callback ];
+        return 1;
+    }
+
+    sub mainloop {
+        my $self = shift;
+        while ( my $req = shift @{ $self->{pending} } ) {
+            $req->[1]->( $self, $self->execute( @{ $req->[0] } ) );
+        }
+    }
+
+    sub execute {
+        my ( $self, $command, $key, @args ) = @_;
+        $command = uc $command;
+        push @{ $self->{commands} }, $command;
+        my $data = $self->{data};
+        my $val  = $data->{$key};
+        if ( $command =~ /^[SZ]SCAN$/ ) {
+            my ( $cursor, undef, $count ) = @args;
+            my @all = sort keys %{ $val || {} };
+            my @page = grep { defined } @all[ ( $cursor ? $cursor - 1 : 0 ) .. $cursor + $count - 1 ];
+            my $next = $cursor + $count >= @all ? 0 : $cursor + $count;
+            return [ $next, $command eq 'SSCAN' ? \@page : [ map { $_, $val->{$_} } @page ] ];
+        }
+        return scalar keys %{ $val || {} } if $command =~ /^[SZ]CARD$/;
+        return [ map { exists $val->{$_} ? 1 : 0 } @args ] if $command eq 'SMISMEMBER';
+        return [ map { $val->{$_} } @args ] if $command eq 'ZMSCORE';
+        if ( $command eq 'SADD' ) {
+            $data->{$key}{$_} = 1 for @args;
+            return 1;
+        }
+        if ( $command eq 'ZINCRBY' ) {
+            return $data->{$key}{ $args[1] } += $args[0];
+        }
+        if ( $command eq 'ZADD' ) {
+            my $flag = $args[0] =~ /^(?:GT|LT)$/ ? shift @args : '';
+            while ( my ( $score, $member ) = splice @args, 0, 2 ) {
+                my $old = $data->{$key}{$member};
+                next if defined $old and ( $flag eq 'GT' && $score <= $old or $flag eq 'LT' && $score >= $old );
+                $data->{$key}{$member} = $score;
+            }
+            return 1;
+        }
+        if ( $command eq 'RENAME' ) {
+            return RedisDB::Error->new("ERR no such key") unless $val;
+            $data->{ $args[0] } = delete $data->{$key};
+            return 'OK';
+        }
+        if ( $command eq 'ZUNIONSTORE' ) {
+            my ( $numkeys, @rest ) = @args;
+            my @keys    = splice @rest, 0, $numkeys;
+            my @weights = $rest[0] && $rest[0] eq 'WEIGHTS' ? @rest[ 1 .. $numkeys ] : (1) x $numkeys;
+            my %union;
+            for my $i ( 0 .. $#keys ) {
+                my $src = $data->{ $keys[$i] } or next;
+                $union{$_} += $src->{$_} * $weights[$i] for keys %$src;
+            }
+            delete $data->{$key};
+            $data->{$key} = \%union if %union;
+            return scalar keys %union;
+        }
+        if ( $command eq 'DEL' ) {
+            return scalar grep { delete $data->{$_} } $key, @args;
+        }
+        return RedisDB::Error->new("ERR unexpected command $command");
+    }
+}
+
+$RedisDB::Cluster::SCAN_COUNT = 2;
+
+# keys a, b, and c are in different slots
+my $cluster = FakeCluster->new;
+$cluster->{data} = {
+    a  => { map { $_ => 1 } qw(1 2 3 4 5) },
+    b  => { map { $_ => 1 } qw(4 5 6 7) },
+    c  => { map { $_ => 1 } qw(5 7 9) },
+    za => { x => 1, y => 2, z => 3 },
+    zb => { y => 10, z => 1, w => 5 },
+};
+
+subtest "sets" => sub {
+    eq_or_diff [ sort @{ $cluster->sunion(qw(a b c)) } ], [qw(1 2 3 4 5 6 7 9)], "sunion";
+    eq_or_diff [ sort @{ $cluster->sinter(qw(a b c)) } ], [qw(5)], "sinter";
+    eq_or_diff [ sort @{ $cluster->sdiff(qw(a b c)) } ], [qw(1 2 3)], "sdiff";
+    eq_or_diff [ sort @{ $cluster->sinter(qw(a missing)) } ], [], "sinter with missing key";
+
+    is $cluster->sunionstore(qw(dest a b)), 7, "sunionstore";
+    eq_or_diff [ sort keys %{ $cluster->{data}{dest} } ], [qw(1 2 3 4 5 6 7)], "stored union";
+    is $cluster->sinterstore(qw(dest a b)), 2, "sinterstore";
+    eq_or_diff [ sort keys %{ $cluster->{data}{dest} } ], [qw(4 5)], "stored intersection";
+    is $cluster->sdiffstore(qw(dest c a)), 2, "sdiffstore";
+    eq_or_diff [ sort keys %{ $cluster->{data}{dest} } ], [qw(7 9)], "stored difference";
+    is $cluster->sinterstore(qw(dest a missing)), 0, "empty result";
+    ok !exists $cluster->{data}{dest}, "destination was deleted";
+    is scalar( grep { /:tmp:/ } keys %{ $cluster->{data} } ), 0, "no temporary keys left";
+};
+
+subtest "sorted sets" => sub {
+    eq_or_diff $cluster->zunion( 2, qw(za zb WITHSCORES) ), [qw(x 1 z 4 w 5 y 12)], "zunion";
+    eq_or_diff $cluster->zunion( 2, qw(za zb WEIGHTS 2 1 AGGREGATE MAX) ), [qw(x w z y)],
+      "zunion with weights and aggregate";
+    eq_or_diff $cluster->zinter( 2, qw(za zb AGGREGATE MIN WITHSCORES) ), [qw(z 1 y 2)], "zinter";
+    eq_or_diff $cluster->zdiff( 2, qw(za zb WITHSCORES) ), [qw(x 1)], "zdiff";
+    throws_ok { $cluster->zdiff( 2, qw(za zb WEIGHTS 1 2) ) } qr/Unsupported option WEIGHTS for zdiff/,
+      "zdiff doesn't accept weights";
+    throws_ok { $cluster->zdiffstore( 'dest', 2, qw(za zb AGGREGATE MAX) ) }
+    qr/Unsupported option AGGREGATE for zdiffstore/, "zdiffstore doesn't accept aggregate";
+
+    is $cluster->zunionstore( 'dest', 2, qw(za zb WEIGHTS 1 2) ), 4, "zunionstore";
+    eq_or_diff $cluster->{data}{dest}, { x => 1, y => 22, z => 5, w => 10 }, "stored union";
+    is $cluster->zunionstore( 'dest', 2, qw(za zb AGGREGATE MAX) ), 4, "zunionstore with MAX";
+    eq_or_diff $cluster->{data}{dest}, { x => 1, y => 10, z => 3, w => 5 }, "stored union";
+    is $cluster->zinterstore( 'dest', 2, qw(za zb) ), 2, "zinterstore";
+    eq_or_diff $cluster->{data}{dest}, { y => 12, z => 4 }, "stored intersection";
+    is $cluster->zdiffstore( 'dest', 2, qw(zb za) ), 1, "zdiffstore";
+    eq_or_diff $cluster->{data}{dest}, { w => 5 }, "stored difference";
+    is $cluster->zunionstore( 'dest', 2, qw(zempty zmissing) ), 0, "empty zunionstore";
+    ok !exists $cluster->{data}{dest}, "destination was deleted";
+    is scalar( grep { /:tmp:/ } keys %{ $cluster->{data} } ), 0, "no temporary keys left";
+
+    $cluster->{commands} = [];
+    $cluster->zunionstore( 'dest', 2, qw(za zb) );
+    is scalar( grep { $_ eq 'ZINCRBY' } @{ $cluster->{commands} } ), 0, "scores are not added one by one";
+};
+
+subtest "same slot" => sub {
+    $cluster->{commands} = [];
+    $cluster->{data}{'{t}a'} = { 1 => 1 };
+    my $res = $cluster->sunion(qw({t}a {t}b));
+    eq_or_diff $cluster->{commands}, ['SUNION'], "sent the command to the server";
+};
+
+subtest "temporary key" => sub {
+    for my $key ( 'dest', '{tag}dest', 'a}b', 'x{' ) {
+        is RedisDB::Cluster::key_slot( RedisDB::Cluster::_temp_key($key) ),
+          RedisDB::Cluster::key_slot($key), "temporary key for $key is in the same slot";
+    }
+};
+
+done_testing;
@@ -0,0 +1,88 @@
+use Test::Most 0.22;
+use RedisDB;
+use Time::HiRes qw(sleep);
+use lib 't/lib';
+use MockServer;
+
+# replies to ECHO with the argument, and +OK to other commands. Reply to
+# ECHO A1 is delayed, so A2 is sent before the reply arrives
+my $server = MockServer->new(
+    sub {
+        my ( $conn, $command, @args ) = @_;
+        return "+OK\015\012" unless $command eq 'ECHO';
+        sleep 0.1 if $args[0] eq 'A1';
+        return MockServer::string( $args[0] );
+    }
+) or plan skip_all => "Can't start server";
+my $port = $server->port;
+
+# the first callback sends a command and waits till the reply arrives, the
+# second one sends a command, which reads the reply to the first one
+sub nesting {
+    my $redis = shift;
+    my @log;
+    my $cb = sub {
+        my ( $redis, $reply ) = @_;
+        push @log, "start $reply";
+        if ( $reply eq 'A1' ) {
+            $redis->send_command( ECHO => 'B1', sub { push @log, "B1" } );
+            sleep 0.2;
+        }
+        elsif ( $reply eq 'A2' ) {
+            $redis->send_command( ECHO => 'B2', sub { push @log, "B2" } );
+        }
+        push @log, "end $reply";
+    };
+    $redis->send_command( ECHO => $_, $cb ) for qw(A1 A2);
+    sleep 0.2;
+    $redis->mainloop;
+    return \@log;
+}
+
+my $redis = RedisDB->new( host => '127.0.0.1', port => $port );
+eq_or_diff nesting($redis), [ 'start A1', 'end A1', 'start A2', 'B1', 'end A2', 'B2' ],
+  "callbacks are nested by default";
+
+my @batches;
+my $deferred = RedisDB->new(
+    host     => '127.0.0.1',
+    port     => $port,
+    on_batch => sub { push @batches, $_[1] },
+);
+ok $deferred->{deferred_callbacks}, "on_batch implies deferred_callbacks";
+eq_or_diff nesting($deferred), [ 'start A1', 'end A1', 'start A2', 'end A2', 'B1', 'B2' ],
+  "deferred callbacks are not nested";
+eq_or_diff \@batches, [ [qw(A1 A2)], ['B1'], ['B2'] ], "replies passed to on_batch";
+
+@batches = ();
+my @replies;
+$deferred->send_command( ECHO => $_, sub { push @replies, $_[1] } ) for 'A1', 2 .. 5;
+sleep 0.3;
+$deferred->send_command( ECHO => 6, sub { push @replies, $_[1] } );
+$deferred->mainloop;
+eq_or_diff \@replies, [ 'A1', 2 .. 6 ], "replies are processed in order";
+eq_or_diff \@batches, [ [ 'A1', 2 .. 5 ], [6] ],
+  "replies received together are passed to on_batch together";
+
+@batches = ();
+is $deferred->echo('sync'), 'sync', "synchronous command";
+my $nested;
+$deferred->send_command( ECHO => 'outer', sub { $nested = $_[0]->echo('inner') } );
+$deferred->mainloop;
+is $nested, 'inner', "synchronous command inside a callback";
+
+# the chain of commands issued by callbacks doesn't grow the stack
+my ( $count, $max_depth ) = ( 0, 0 );
+my $chain;
+$chain = sub {
+    my $depth = 0;
+    $depth++ while caller($depth);
+    $max_depth = $depth if $depth > $max_depth;
+    $_[0]->send_command( ECHO => $count, $chain ) if ++$count < 500;
+};
+$deferred->send_command( ECHO => 'start', $chain ) for 1 .. 20;
+$deferred->mainloop;
+cmp_ok $count, '>=', 500, "all commands were processed";
+cmp_ok $max_depth, '<', 20, "stack depth doesn't grow";
+
+done_testing;
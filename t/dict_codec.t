@@ -0,0 +1,102 @@
+use Test::Most 0.22;
+use RedisDB;
+use RedisDB::DictCodec;
+use lib 't/lib';
+use MockServer;
+
+# minimal in-memory replacement for redis used to store dictionaries
+{
+    package FakeRedis;
+    sub new  { bless {}, shift }
+    sub get  { $_[0]{ $_[1] } }
+    sub set  { $_[0]{ $_[1] } = $_[2]; 'OK' }
+    sub incr { ++$_[0]{ $_[1] } }
+}
+
+sub sample_value {
+    my $i = shift;
+    return sprintf '{"user_id":%d,"name":"user%d","email":"user%d@example.com",'
+      . '"created_at":"2021-%02d-%02dT10:%02d:30Z","status":"%s","roles":["user"]}',
+      $i, $i, $i, 1 + $i % 12, 1 + $i % 28, $i % 60, $i % 3 ? "active" : "pending";
+}
+
+subtest "encode and decode" => sub {
+    my $storage = FakeRedis->new;
+    my $codec   = RedisDB::DictCodec->new(
+        redis       => $storage,
+        name        => 'test',
+        sample_rate => 1,
+    );
+    is $codec->current_dict, 0, "no dictionary yet";
+    my @values = map { sample_value($_) } 1 .. 200;
+    my @plain  = map { $codec->encode($_) } @values;
+    eq_or_diff [ map { $codec->decode($_) } @plain ], \@values, "decoded values without dictionary";
+
+    my $id = $codec->train;
+    is $id, 1, "trained the first dictionary";
+    ok length $storage->get('test:dict:1'), "dictionary was stored";
+    is $storage->get('test:dict:current'), 1, "dictionary is current";
+
+    my @more = map { sample_value($_) } 201 .. 400;
+    my @compressed = map { $codec->encode($_) } @more;
+    my ( $in, $out ) = ( 0, 0 );
+    $in  += length for @more;
+    $out += length for @compressed;
+    cmp_ok $out * 2, '<', $in, "values are compressed at least twice";
+    eq_or_diff [ map { $codec->decode($_) } @compressed ], \@more, "decoded values";
+
+    my $other = RedisDB::DictCodec->new( redis => $storage, name => 'test' );
+    eq_or_diff [ map { $other->decode($_) } @compressed, @plain ], [ @more, @values ],
+      "another codec loaded the dictionary";
+    is $other->current_dict, 1, "another codec uses the current dictionary";
+
+    is $codec->encode("short"), "short", "short value is not compressed";
+    is $codec->decode( $codec->encode("\xffZD") ), "\xffZD", "value with the tag is escaped";
+    dies_ok { $codec->encode("\x{431}") } "wide characters are not allowed";
+};
+
+subtest "value_codec option" => sub {
+    my %db;
+    my $server = MockServer->new(
+        sub {
+            my ( $conn, $command, @args ) = @_;
+            if ( $command eq 'SET' ) {
+                my $old = $db{ $args[0] };
+                $db{ $args[0] } = $args[1];
+                return grep( { uc eq 'GET' } @args ) ? MockServer::string($old) : "+OK\015\012";
+            }
+            elsif ( $command eq 'MSET' ) {
+                %db = ( %db, @args );
+                return "+OK\015\012";
+            }
+            elsif ( $command eq 'MGET' ) {
+                return MockServer::bulk( @db{@args} );
+            }
+            return MockServer::string( $db{ $args[0] } );
+        }
+    );
+    plan skip_all => "Can't start server" unless $server;
+
+    my $codec = RedisDB::DictCodec->new( redis => FakeRedis->new, name => 'test' );
+    $codec->train( [ map { sample_value($_) } 1 .. 100 ] );
+    my $redis = RedisDB->new(
+        host        => '127.0.0.1',
+        port        => $server->port,
+        value_codec => $codec,
+    );
+    my @values = map { sample_value($_) } 101 .. 103;
+    is $redis->set( foo => $values[0] ), 'OK', "set value";
+    is $redis->mset( bar => $values[1], baz => $values[2] ), 'OK', "mset values";
+    is $redis->get('foo'), $values[0], "got the value";
+    eq_or_diff $redis->mget(qw(foo bar baz)), \@values, "got values using mget";
+    is $redis->set( foo => $values[1], 'GET' ), $values[0], "SET with GET returns decoded old value";
+    is $redis->set( new => $values[2], EX => 10, 'GET' ), undef, "SET with GET of a new key";
+    is $redis->get('foo'), $values[1], "value was replaced";
+    my $stored = do { local $redis->{value_codec}; $redis->get('bar') };
+    like $stored, qr/^\xffZD\x00\x00\x00\x01/, "stored value is compressed";
+    cmp_ok length $stored, '<', length $values[1], "stored value is shorter";
+    dies_ok { RedisDB->new( value_codec => $codec, utf8 => 1, lazy => 1 ) }
+    "value_codec can't be used with utf8";
+};
+
+done_testing;
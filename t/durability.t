@@ -0,0 +1,78 @@
+use Test::Most 0.22;
+use RedisDB;
+use RedisDB::Scheduler;
+use lib 't/lib';
+use MockServer;
+
+# WAIT replies that one replica acknowledged the writes, WAITAOF that writes
+# were fsynced locally, LOG returns the list of received commands
+my @log;
+my $server = MockServer->new(
+    sub {
+        my ( $conn, @args ) = @_;
+        my $command = $args[0];
+        if ( $command eq 'LOG' ) {
+            my $reply = MockServer::bulk(@log);
+            @log = ();
+            return $reply;
+        }
+        push @log, join ' ', @args;
+        return ":1\015\012" if $command eq 'WAIT';
+        return "*2\015\012:1\015\012:0\015\012" if $command eq 'WAITAOF';
+        return "*0\015\012" if $command eq 'ZRANGE';
+        return ":1\015\012" if $command eq 'ZADD';
+        return "*-1\015\012" if $command eq 'BLPOP';
+        return "+OK\015\012";
+    }
+);
+plan skip_all => "Can't start server" unless $server;
+
+my $redis = RedisDB->new( host => '127.0.0.1', port => $server->port );
+
+subtest "WAIT" => sub {
+    my @replies;
+    my $cb = sub { push @replies, [ @_[ 1, 2 ] ] };
+    $redis->send_durable( { timeout => 100 }, SET => 'a', 1, $cb );
+    $redis->send_durable( { replicas => 2, timeout => 500 }, SET => 'b', 2, $cb );
+    $redis->send_command( SET => 'c', 3, RedisDB::IGNORE_REPLY );
+    $redis->send_durable( { replicas => 1, timeout => 200 }, SET => 'd', 4, $cb );
+    is scalar @replies, 0, "callbacks are not invoked before WAIT";
+    $redis->mainloop;
+    eq_or_diff \@replies, [ map { [ 'OK', { replicas => 1 } ] } 1 .. 3 ],
+      "callbacks got replies and durability";
+    eq_or_diff $redis->execute('LOG'), [ 'SET a 1', 'SET b 2', 'SET c 3', 'SET d 4', 'WAIT 2 500' ],
+      "sent a single WAIT after the writes";
+};
+
+subtest "WAITAOF" => sub {
+    my @replies;
+    $redis->send_durable( { aof => 1, replicas => 0 }, SET => 'a', 1, sub { push @replies, $_[2] } );
+    $redis->send_durable( { timeout => 0 }, SET => 'b', 1, sub { push @replies, $_[2] } );
+    $redis->flush_durable;
+    $redis->send_durable( {}, SET => 'c', 1, sub { push @replies, $_[2] } );
+    is $redis->set( 'd', 1 ), 'OK', "execute";
+    eq_or_diff $redis->execute('LOG'),
+      [ 'SET a 1', 'SET b 1', 'WAITAOF 1 1 0', 'SET c 1', 'SET d 1', 'WAIT 1 1000' ],
+      "groups were flushed explicitly and when waiting for reply";
+    eq_or_diff \@replies, [ { local => 1, replicas => 0 }, { local => 1, replicas => 0 }, { replicas => 1 } ],
+      "callbacks got durability";
+};
+
+subtest "scheduler" => sub {
+    my $scheduler = RedisDB::Scheduler->new(
+        redis      => $redis,
+        name       => 'q',
+        durability => { replicas => 1 },
+    );
+    is $scheduler->next_due, undef, "next_due";
+    $scheduler->wait_for_tasks(1);
+    eq_or_diff $redis->execute('LOG'),
+      [ ( 'ZRANGE {q:0}:due 0 0 WITHSCORES' ) x 2, 'BLPOP {q}:notify 1' ],
+      "reads are not followed by WAIT";
+    is $scheduler->schedule( 'task', 1000 ), 1, "schedule";
+    eq_or_diff $redis->execute('LOG'),
+      [ 'ZADD {q:0}:due 1000000 task', 'LPUSH {q}:notify 1', 'LTRIM {q}:notify 0 0', 'WAIT 1 1000' ],
+      "writes are followed by WAIT";
+};
+
+done_testing;
@@ -0,0 +1,107 @@
+use Test::Most 0.22;
+use RedisDB;
+use IO::Socket::IP;
+use lib 't/lib';
+use MockServer;
+
+# start a server that pretends to be a master or a replica. FAILOVER command
+# switches the role, writes to the replica return READONLY error, GET returns
+# the role of the server that received it
+sub mock_server {
+    my $role = shift;
+    return MockServer->new(
+        sub {
+            my ( $conn, $command ) = @_;
+            if ( $command eq 'ROLE' ) {
+                return $role eq 'master'
+                  ? "*3\015\012\$6\015\012master\015\012:100\015\012*1\015\012"
+                  . MockServer::bulk( '127.0.0.1', 6380, 100 )
+                  : "*5\015\012\$5\015\012slave\015\012\$9\015\012127.0.0.1\015\012"
+                  . ":6379\015\012\$9\015\012connected\015\012:100\015\012";
+            }
+            elsif ( $command eq 'FAILOVER' ) {
+                $role = $role eq 'master' ? 'slave' : 'master';
+                return "+OK\015\012";
+            }
+            elsif ( $command eq 'GET' ) {
+                return MockServer::string($role);
+            }
+            elsif ( $role eq 'master' ) {
+                return "+OK\015\012";
+            }
+            return "-READONLY You can't write against a read only replica.\015\012";
+        },
+        timeout => 20,
+    );
+}
+
+my $master  = mock_server('master');
+my $replica = mock_server('slave');
+plan skip_all => "Can't start server" unless $master and $replica;
+my ( $master_port, $replica_port ) = ( $master->port, $replica->port );
+
+subtest "master discovery" => sub {
+    my $redis = RedisDB->new(
+        endpoints          => [ "127.0.0.1:$replica_port", { host => '127.0.0.1', port => $master_port } ],
+        read_from_replicas => 1,
+    );
+    is $redis->{port}, $master_port, "connected to the master";
+    is $redis->set( foo => 'bar' ), 'OK', "write went to the master";
+    is $redis->get('foo'), 'slave', "read went to the replica";
+
+    for ( $master_port, $replica_port ) {
+        my $ctl = RedisDB->new( host => '127.0.0.1', port => $_ );
+        is $ctl->execute('FAILOVER'), 'OK', "switched role of the server on port $_";
+    }
+    is $redis->set( foo => 'bar' ), 'OK', "write was resent to the new master";
+    is $redis->{port}, $replica_port, "connected to the new master";
+    is $redis->get('foo'), 'slave', "read went to the new replica";
+
+    my @replies;
+    $redis->send_command( 'FAILOVER', sub { push @replies, $_[1] } );
+    $redis->mainloop;
+    RedisDB->new( host => '127.0.0.1', port => $master_port )->execute('FAILOVER');
+    $redis->send_command( 'SET', 'foo', 'bar', sub { push @replies, $_[1] } );
+    $redis->send_command( 'SET', 'foo', 'bar', sub { push @replies, $_[1] } );
+    $redis->mainloop;
+    is "$replies[1]", "READONLY You can't write against a read only replica.",
+      "send_command got READONLY error";
+    $redis->send_command( 'SET', 'foo', 'bar', sub { push @replies, $_[1] } );
+    $redis->mainloop;
+    is $replies[3], 'OK', "next command went to the new master";
+    is $redis->{port}, $master_port, "reconnected to the new master";
+};
+
+subtest "no master" => sub {
+    my $srv = IO::Socket::IP->new(
+        LocalAddr => '127.0.0.1',
+        Proto     => 'tcp',
+        Listen    => 1,
+    );
+    my $port = $srv->sockport;
+    close $srv;
+    throws_ok {
+        RedisDB->new( endpoints => ["127.0.0.1:$port"], timeout => 0.5 );
+    }
+    qr/no master found/, "croaks if there is no master";
+    dies_ok { RedisDB->new( endpoints => ["127.0.0.1:$port"], port => 6379 ) }
+    "endpoints can't be used together with port";
+};
+
+subtest "options of the replica connection" => sub {
+    my $redis = RedisDB->new(
+        endpoints          => [ "127.0.0.1:$master_port", "127.0.0.1:$replica_port" ],
+        read_from_replicas => 1,
+        database           => 2,
+        timeout            => 3,
+        keepalive          => 30,
+        tcp_user_timeout   => 20,
+        heartbeat          => 10,
+        connection_name    => 'test',
+    );
+    my $replica = $redis->_replica;
+    is $replica->{$_}, $redis->{$_}, "$_ is passed to the replica"
+      for qw(database timeout keepalive tcp_user_timeout heartbeat connection_name);
+};
+
+done_testing;
@@ -0,0 +1,103 @@
+use Test::Most 0.22;
+use RedisDB::HealthSampler;
+use lib 't/lib';
+use MockServer;
+
+my $info = join "\r\n", "# Server", "redis_version:6.2.1", "uptime_in_seconds:100", "",
+  "# Stats", "total_commands_processed:1000", "keyspace_hits:10", "instantaneous_ops_per_sec:5",
+  "mem_fragmentation_ratio:1.25", "", "# Commandstats",
+  "cmdstat_get:calls=100,usec=200,usec_per_call=2.00", "", "# Keyspace",
+  "db0:keys=3,expires=1,avg_ttl=1000", "";
+
+subtest "parse info" => sub {
+    my $parsed = RedisDB::HealthSampler::_parse_info_sections($info);
+    eq_or_diff [ sort keys %$parsed ], [qw(commandstats keyspace server stats)], "got all sections";
+    is $parsed->{server}{redis_version}, '6.2.1', "version is a string";
+    is $parsed->{stats}{mem_fragmentation_ratio}, 1.25, "float field";
+    eq_or_diff $parsed->{keyspace}{db0}, { keys => 3, expires => 1, avg_ttl => 1000 },
+      "keyspace is parsed into a hash";
+    eq_or_diff $parsed->{commandstats}{cmdstat_get},
+      { calls => 100, usec => 200, usec_per_call => 2 }, "commandstats are parsed into a hash";
+};
+
+subtest "rates" => sub {
+    my $sampler = RedisDB::HealthSampler->new( redis => {} );
+    my $prev = { time => 10, info => RedisDB::HealthSampler::_parse_info_sections($info) };
+    ( my $info2 = $info ) =~ s/total_commands_processed:1000/total_commands_processed:1500/;
+    $info2 =~ s/calls=100,usec=200/calls=150,usec=300/;
+    $info2 =~ s/instantaneous_ops_per_sec:5/instantaneous_ops_per_sec:50/;
+    my $cur = { time => 15, info => RedisDB::HealthSampler::_parse_info_sections($info2) };
+    my $rates = $sampler->_rates( $prev, $cur );
+    is $rates->{total_commands_processed}, 100, "commands rate";
+    is $rates->{keyspace_hits}, 0, "hits rate";
+    is $rates->{'cmdstat_get.calls'}, 10, "calls rate for GET";
+    is $rates->{'cmdstat_get.usec'}, 20, "usec rate for GET";
+    ok !exists $rates->{instantaneous_ops_per_sec}, "no rate for gauge";
+};
+
+subtest "gauges and non-numeric fields" => sub {
+    my $sampler = RedisDB::HealthSampler->new( redis => {} );
+    my $memory = join "\r\n", "# Memory", "total_system_memory:%d", "total_system_memory_human:%s", "",
+      "# Stats", "total_net_input_bytes:%d", "total_blocking_keys:%d", "";
+    my $prev = { time => 10, info => RedisDB::HealthSampler::_parse_info_sections(
+        sprintf $memory, 16578822144, '15.44G', 1000, 2 ) };
+    my $cur = { time => 12, info => RedisDB::HealthSampler::_parse_info_sections(
+        sprintf $memory, 16578822145, '15.45G', 3000, 4 ) };
+    my @warnings;
+    local $SIG{__WARN__} = sub { push @warnings, @_ };
+    my $rates = $sampler->_rates( $prev, $cur );
+    eq_or_diff \@warnings, [], "no warnings";
+    eq_or_diff $rates, { total_net_input_bytes => 1000 }, "rates only for counters";
+};
+
+subtest "latency, slowlog, and clients" => sub {
+    eq_or_diff RedisDB::HealthSampler::_parse_latency( [ [ 'command', 1600000000, 250, 1000 ] ] ),
+      { command => { time => 1600000000, latest => 250, max => 1000 } }, "latency";
+    my $slowlog = RedisDB::HealthSampler::_parse_slowlog(
+        [ [ 14, 1600000000, 15000, [qw(KEYS *)], '127.0.0.1:5000', 'worker' ] ] );
+    is $slowlog->[0]{duration}, 15000, "slowlog duration";
+    eq_or_diff $slowlog->[0]{command}, [qw(KEYS *)], "slowlog command";
+    my $clients = RedisDB::HealthSampler::_summarize_clients(
+        [
+            { flags => 'N', idle => 5,  qbuf => 0,   omem => 0,   sub => 0, psub => 0 },
+            { flags => 'b', idle => 50, qbuf => 100, omem => 10,  sub => 0, psub => 0 },
+            { flags => 'P', idle => 1,  qbuf => 0,   omem => 100, sub => 2, psub => 0 },
+        ]
+    );
+    eq_or_diff $clients,
+      {
+        count    => 3,
+        blocked  => 1,
+        pubsub   => 1,
+        max_idle => 50,
+        max_qbuf => 100,
+        max_omem => 100,
+        omem     => 110,
+      },
+      "clients summary";
+};
+
+subtest "round trip time of every node" => sub {
+    my $handler = sub {
+        my ( $conn, $command ) = @_;
+        return MockServer::string($info) if $command eq 'INFO';
+        return MockServer::string("id=1 flags=N idle=0\n") if $command eq 'CLIENT';
+        return "*0\015\012";
+    };
+    my $slow = MockServer->new( $handler, delay => 0.5 );
+    my $fast = MockServer->new($handler);
+    plan skip_all => "Can't start server" unless $slow and $fast;
+
+    no warnings 'redefine';
+    my %nodes = map { ( $_ => RedisDB->new( host => '127.0.0.1', port => $_->port ) ) } $slow, $fast;
+    local *RedisDB::HealthSampler::_nodes = sub { return { slow => $nodes{$slow}, fast => $nodes{$fast} } };
+    my $sampler = RedisDB::HealthSampler->new( redis => $nodes{$fast} );
+    for ( 1 .. 2 ) {
+        my $sample = $sampler->sample;
+        ok $sample->{slow}{rtt} >= 0.5, "slow node";
+        ok $sample->{fast}{rtt} < 0.4, "fast node doesn't wait for the slow one";
+        eq_or_diff $sample->{fast}{errors}, {}, "no errors";
+    }
+};
+
+done_testing;
@@ -0,0 +1,56 @@
+use Test::Most 0.22;
+use RedisDB;
+use lib 't/lib';
+use MockServer;
+use Socket qw(SOL_SOCKET SO_KEEPALIVE IPPROTO_TCP);
+
+# the server replies to SLOW command only after it received PING, LOG returns
+# the list of received commands
+my ( $slow, @log );
+my $server = MockServer->new(
+    sub {
+        my ( $conn, $command ) = @_;
+        if ( $command eq 'LOG' ) {
+            my $reply = MockServer::bulk(@log);
+            @log = ();
+            return $reply;
+        }
+        push @log, $command;
+        if ( $command eq 'SLOW' ) {
+            $slow = 1;
+            return;
+        }
+        elsif ( $command eq 'PING' ) {
+            my $reply = $slow ? "+DONE\015\012+PONG\015\012" : "+PONG\015\012";
+            undef $slow;
+            return $reply;
+        }
+        return "+OK\015\012";
+    }
+);
+plan skip_all => "Can't start server" unless $server;
+
+my $redis = RedisDB->new(
+    host             => '127.0.0.1',
+    port             => $server->port,
+    heartbeat        => 0.2,
+    keepalive        => 3,
+    tcp_user_timeout => 1.5,
+);
+
+is unpack( 'i', getsockopt( $redis->{_socket}, SOL_SOCKET, SO_KEEPALIVE ) ), 1, "keepalive is enabled";
+if ( $^O eq 'linux' ) {
+    is unpack( 'i', getsockopt( $redis->{_socket}, IPPROTO_TCP, 4 ) ),  1,    "keepalive idle time";
+    is unpack( 'i', getsockopt( $redis->{_socket}, IPPROTO_TCP, 6 ) ),  2,    "number of keepalive probes";
+    is unpack( 'i', getsockopt( $redis->{_socket}, IPPROTO_TCP, 18 ) ), 1500, "user timeout";
+}
+
+is $redis->execute('SLOW'), 'DONE', "sent PING while waiting for reply";
+is $redis->send_heartbeat, 0, "no heartbeat on recently used connection";
+sleep 1;
+is $redis->send_heartbeat, 1, "heartbeat on idle connection";
+is $redis->send_heartbeat, 0, "only one heartbeat at a time";
+$redis->mainloop;
+eq_or_diff $redis->execute('LOG'), [qw(SLOW PING PING)], "server got heartbeats";
+
+done_testing;
@@ -0,0 +1,107 @@
+use Test::Most 0.22;
+use RedisDB;
+use RedisDB::Cluster;
+use RedisDB::KeyMap;
+use lib 't/lib';
+use MockServer;
+
+my $map = RedisDB::KeyMap->new(
+    prefixes => {
+        'production:service:user:' => 'u:',
+        'production:service:'      => 's:',
+    }
+);
+is $map->encode('production:service:user:1'), 'u:1',  "the longest prefix is replaced";
+is $map->encode('production:service:x'),      's:x',  "shorter prefix";
+is $map->encode('other:1'),                   'other:1', "key without prefix";
+is $map->encode('u:1'),                       'u:1',  "mapped key is not changed";
+is $map->decode('u:1'),                       'production:service:user:1', "decode";
+is $map->decode('production:service:user:1'), 'production:service:user:1', "decoded key is not changed";
+
+my $p = 'production:service:';
+my @tests = (
+    [ [ GET => "${p}a" ], ['s:a'] ],
+    [ [ SET => "${p}a", "${p}b" ], [ 's:a', "${p}b" ] ],
+    [ [ MSET => "${p}a", "${p}b", "${p}c", 1 ], [ 's:a', "${p}b", 's:c', 1 ] ],
+    [ [ DEL => "${p}a", "${p}b" ], [ 's:a', 's:b' ] ],
+    [ [ BLPOP => "${p}a", "${p}b", 0 ], [ 's:a', 's:b', 0 ] ],
+    [ [ BITOP => 'AND', "${p}a", "${p}b" ], [ 'AND', 's:a', 's:b' ] ],
+    [ [ OBJECT => 'ENCODING', "${p}a" ], [ 'ENCODING', 's:a' ] ],
+    [ [ RENAME => "${p}a", "${p}b" ], [ 's:a', 's:b' ] ],
+    [ [ MIGRATE => 'host', 6379, "${p}a", 0, 1000 ], [ 'host', 6379, 's:a', 0, 1000 ] ],
+    [ [ MEMORY => 'USAGE', "${p}a" ], [ 'USAGE', 's:a' ] ],
+    [ [ EXPIRETIME => "${p}a" ], ['s:a'] ],
+    [ [ BLMPOP => 0, 2, "${p}a", "${p}b", 'LEFT' ], [ 0, 2, 's:a', 's:b', 'LEFT' ] ],
+    [ [ EVAL => 'return 1', 1, "${p}a", "${p}b" ], [ 'return 1', 1, 's:a', "${p}b" ] ],
+    [ [ ZUNIONSTORE => "${p}d", 2, "${p}a", "${p}b", WEIGHTS => 1, 2 ], [ 's:d', 2, 's:a', 's:b', WEIGHTS => 1, 2 ] ],
+    [ [ XREAD => COUNT => 1, STREAMS => "${p}a", "${p}b", 0, 0 ], [ COUNT => 1, STREAMS => 's:a', 's:b', 0, 0 ] ],
+    [ [ KEYS => "${p}*" ], ['s:*'] ],
+    [ [ SCAN => 0, MATCH => "${p}user:*", COUNT => 10 ], [ 0, MATCH => 'u:*', COUNT => 10 ] ],
+    [ [ PING => "${p}a" ], ["${p}a"] ],
+);
+for (@tests) {
+    my ( $command, @args ) = @{ $_->[0] };
+    eq_or_diff [ $map->_encode_args( $command, @args ) ], $_->[1], "arguments of $command";
+}
+
+dies_ok { RedisDB::KeyMap->new( prefixes => { 'prefix:{tag}:' => 'p:' } ) } "prefix with a brace";
+dies_ok { RedisDB::KeyMap->new( prefixes => { 'prefix:' => 'prefix:long:' } ) } "code is longer than prefix";
+dies_ok { RedisDB::KeyMap->new( prefixes => { 'prefix:a:' => 'p:', 'prefix:b:' => 'p:' } ) } "duplicate codes";
+dies_ok { RedisDB::KeyMap->new( prefixes => { 'prefix:a:' => 'p:', 'prefix:b:' => 'p:x' } ) }
+"code starts with another code";
+dies_ok { RedisDB::KeyMap->new( prefixes => { 'prefix:a:' => 'p:', 'p:long:' => 'q:' } ) } "prefix starts with a code";
+
+my $cluster = RedisDB::Cluster->new( startup_nodes => [], no_slots_initialization => 1, key_map => $map );
+is $cluster->_stored_key("${p}user:{42}:profile"), 'u:{42}:profile', "cluster maps keys";
+is RedisDB::Cluster::key_slot( $cluster->_stored_key("${p}user:{42}:profile") ),
+  RedisDB::Cluster::key_slot("${p}{42}:settings"), "hash tag is not changed";
+
+# in-memory server supporting SET, GET, KEYS, SCAN, and RANDOMKEY, ECHO
+# returns the last received command
+my ( %db, $last );
+my $server = MockServer->new(
+    sub {
+        my ( $conn, $command, @args ) = @_;
+        my $reply;
+        if ( $command eq 'SET' ) {
+            $db{ $args[0] } = $args[1];
+            $reply = "+OK\015\012";
+        }
+        elsif ( $command eq 'GET' ) {
+            $reply = MockServer::string( $db{ $args[0] } );
+        }
+        elsif ( $command eq 'KEYS' or $command eq 'SCAN' ) {
+            my $re = $command eq 'KEYS' ? $args[0] : $args[2];
+            $re =~ s/\*/.*/g;
+            my @keys = sort grep { /^$re$/ } keys %db;
+            $reply = MockServer::bulk(@keys);
+            $reply = "*2\015\012" . MockServer::string(0) . $reply if $command eq 'SCAN';
+        }
+        elsif ( $command eq 'RANDOMKEY' ) {
+            $reply = MockServer::string( ( sort keys %db )[0] );
+        }
+        elsif ( $command eq 'ECHO' ) {
+            $reply = MockServer::string($last);
+        }
+        $last = join ' ', $command, @args;
+        return $reply;
+    }
+) or plan skip_all => "Can't start server";
+my $port = $server->port;
+
+my $redis = RedisDB->new( host => '127.0.0.1', port => $port, key_map => $map, lazy => 1 );
+$redis->set( "${p}user:1", 'alice' );
+is $redis->echo('last'), 'SET u:1 alice', "key was mapped";
+is $redis->get("${p}user:1"), 'alice', "GET";
+$redis->set( "${p}config", 1 );
+$redis->set( 'other', 1 );
+eq_or_diff $redis->keys("${p}*"), ["${p}config"], "KEYS";
+eq_or_diff $redis->keys('*'), [ 'other', "${p}config", "${p}user:1" ], "KEYS with all keys";
+eq_or_diff $redis->scan( 0, MATCH => "${p}user:*" ), [ 0, ["${p}user:1"] ], "SCAN";
+is $redis->randomkey, 'other', "RANDOMKEY";
+my $reply;
+$redis->send_command( KEYS => "${p}user:*", sub { $reply = $_[1] } );
+$redis->mainloop;
+eq_or_diff $reply, ["${p}user:1"], "KEYS with callback";
+
+done_testing;
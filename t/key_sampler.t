@@ -0,0 +1,95 @@
+use Test::Most 0.22;
+use RedisDB;
+use RedisDB::KeySampler;
+use File::Temp qw(tempdir);
+use POSIX ();
+use lib 't/lib';
+use MockServer;
+
+# GET and MGET return "value" for keys starting with "x" and nil for other
+# keys, other commands return OK
+my $server = MockServer->new(
+    sub {
+        my ( $conn, $command, @args ) = @_;
+        my @values = map { /^x/ ? 'value' : undef } @args;
+        return MockServer::string( $values[0] ) if $command eq 'GET';
+        return MockServer::bulk(@values) if $command eq 'MGET';
+        return "+OK\015\012";
+    }
+) or plan skip_all => "Can't start server";
+my $port = $server->port;
+
+my $sampler = RedisDB::KeySampler->new( rate => 1 );
+my $redis = RedisDB->new( host => '127.0.0.1', port => $port, key_sampler => $sampler );
+is $redis->get('xa'), 'value', "GET";
+is $redis->get('missing'), undef, "GET of missing key";
+$redis->set( xb => 'abc', EX => 10 );
+$redis->setex( xc => 5, 'abcd' );
+$redis->mget(qw(xa missing xb));
+$redis->hset( h => f => 'value' );
+$redis->hget( h => 'f' );
+$redis->del(qw(xa xb));
+$redis->send_command( 'GET', 'xd', sub { } );
+$redis->mainloop;
+$redis->ping;
+
+my @events = map { [ ( split ' ', $_ )[ 1, 3, 4, 5 ] ] } $sampler->events;
+eq_or_diff \@events,
+  [
+    [ r => 2, 5, 0 ],
+    [ w => 2, 3, 10000 ],
+    [ w => 2, 4, 5000 ],
+    [ r => 2, 5, 0 ],
+    [ r => 2, 5, 0 ],
+    [ a => 1, 6, 0 ],
+    [ r => 1, 0, 0 ],
+    [ d => 2, 0, 0 ],
+    [ d => 2, 0, 0 ],
+    [ r => 2, 5, 0 ],
+  ],
+  "recorded operations, key lengths, sizes, and TTLs";
+my @ids = map { ( split ' ', $_ )[2] } $sampler->events;
+is $ids[0], $ids[3], "the same key has the same id";
+isnt $ids[0], $ids[4], "different keys have different ids";
+
+my $dir = tempdir( CLEANUP => 1 );
+$sampler->save("$dir/sample");
+open my $fh, '<', "$dir/sample" or die $!;
+my @lines = <$fh>;
+is $lines[0], "# RedisDB key sample rate=1\n", "header";
+is @lines, 11, "all events were saved";
+
+my $file_sampler = RedisDB::KeySampler->new( rate => 1, file => "$dir/stream" );
+$redis->{key_sampler} = $file_sampler;
+$redis->get('xa');
+open $fh, '<', "$dir/stream" or die $!;
+@lines = <$fh>;
+is @lines, 2, "event was written to the file";
+is scalar $file_sampler->events, 0, "event was not kept in memory";
+
+# forked processes share the file handle, lines must not be torn
+my @pids;
+for my $child ( 1 .. 4 ) {
+    my $pid = fork;
+    die "Couldn't fork: $!" unless defined $pid;
+    unless ($pid) {
+        $file_sampler->_record( time, 'r', "key:$child:$_:" . ( 'x' x 50 ), 100, 0 ) for 1 .. 2000;
+        POSIX::_exit(0);
+    }
+    push @pids, $pid;
+}
+waitpid $_, 0 for @pids;
+open $fh, '<', "$dir/stream" or die $!;
+@lines = <$fh>;
+is @lines, 8002, "events of all processes were written";
+is scalar( grep { !/^[0-9.]+ [a-z] [0-9a-f]{16} \d+ \d+ \d+\n\z/ } @lines[ 1 .. $#lines ] ), 0,
+  "lines are not mixed";
+
+$sampler = RedisDB::KeySampler->new( rate => 0.25 );
+my @sampled = grep { $sampler->_sampled("key:$_") } 1 .. 4000;
+cmp_ok abs( @sampled - 1000 ), '<', 150, "about a quarter of keys is sampled";
+eq_or_diff [ grep { $sampler->_sampled("key:$_") } 1 .. 4000 ], \@sampled, "sampling is deterministic";
+
+dies_ok { RedisDB::KeySampler->new( rate => 2 ) } "invalid rate";
+
+done_testing;
@@ -0,0 +1,169 @@
+package MockServer;
+
+# fake redis server for tests. It runs in a child process, parses commands
+# received from any number of clients, and invokes the handler for every
+# command:
+#
+#   my $server = MockServer->new(
+#       sub {
+#           my ( $conn, $command, @args ) = @_;
+#           return "+OK\015\012";
+#       }
+#   ) or plan skip_all => "Can't start server";
+#   my $redis = RedisDB->new( host => '127.0.0.1', port => $server->port );
+#
+# $conn is a hash that is kept while the client is connected, it contains the
+# number of the connection in "id" and the socket in "socket". Command name is
+# passed in upper case. The handler returns the data to send to the client, or
+# nothing if it doesn't want to reply. Setting $conn->{close} closes the
+# connection after sending the reply.
+#
+# Parameters after the handler: timeout - the server exits after this many
+# seconds, default is 10; delay - seconds to wait after reading data before
+# processing it, so pipelined commands are processed together; port - port to
+# listen on, by default a free port is chosen; fork - serve every connection in
+# a separate process, so a handler that sleeps doesn't delay other clients, the
+# state of the handler is not shared between the connections then.
+
+use strict;
+use warnings;
+use IO::Select;
+use IO::Socket::IP;
+use POSIX ();
+use Time::HiRes qw(sleep);
+
+sub new {
+    my ( $class, $handler, %params ) = @_;
+    my $srv = IO::Socket::IP->new(
+        LocalAddr => '127.0.0.1',
+        ( $params{port} ? ( LocalPort => $params{port} ) : () ),
+        Proto     => 'tcp',
+        Listen    => 16,
+        ReuseAddr => 1,
+    ) or return;
+    my $self = bless { port => $srv->sockport, parent => $$ }, $class;
+    $self->{pid} = fork;
+    die "Couldn't fork: $!" unless defined $self->{pid};
+    if ( $self->{pid} ) {
+        close $srv;
+        return $self;
+    }
+
+    # the child must not return into the test or run its END blocks
+    $SIG{ALRM} = sub { POSIX::_exit(1) };
+    alarm( $params{timeout} || 10 );
+    eval { _serve( $srv, $handler, \%params ) };
+    warn $@ if $@;
+    POSIX::_exit(0);
+}
+
+sub _serve {
+    my ( $srv, $handler, $params ) = @_;
+    local $SIG{CHLD} = 'IGNORE' if $params->{fork};
+    my $select = IO::Select->new($srv);
+    my ( %conn, $id, $child );
+    my $close = sub {
+        my $sock = shift;
+        $select->remove($sock);
+        delete $conn{$sock};
+        close $sock;
+        POSIX::_exit(0) if $child and not %conn;
+    };
+    while (1) {
+        for my $sock ( $select->can_read ) {
+            if ( $sock == $srv ) {
+                my $cli = $srv->accept or next;
+                $id++;
+                if ( $params->{fork} ) {
+                    my $pid = fork;
+                    die "Couldn't fork: $!" unless defined $pid;
+                    if ($pid) {
+                        close $cli;
+                        next;
+                    }
+
+                    # the child serves only this client
+                    alarm( $params->{timeout} || 10 );
+                    close $srv;
+                    $select = IO::Select->new;
+                    $child  = 1;
+                }
+                $select->add($cli);
+                $conn{$cli} = { id => $id, socket => $cli, buf => '' };
+                next;
+            }
+            my $conn = $conn{$sock};
+            sysread( $sock, my $data, 65536 );
+            unless ( defined $data and length $data ) {
+                $close->($sock);
+                next;
+            }
+            sleep $params->{delay} if $params->{delay};
+            $conn->{buf} .= $data;
+            while ( my @args = _command( \$conn->{buf} ) ) {
+                my $reply = $handler->( $conn, uc shift @args, @args );
+                _write( $sock, $reply ) if defined $reply and length $reply;
+                if ( $conn->{close} ) {
+                    $close->($sock);
+                    last;
+                }
+            }
+        }
+    }
+}
+
+# remove the first complete command from the buffer and return its arguments
+sub _command {
+    my $buf = shift;
+    return unless $$buf =~ /^\*(\d+)\015\012/;
+    my ( $argc, $pos, @args ) = ( $1, $+[0] );
+    for ( 1 .. $argc ) {
+        substr( $$buf, $pos ) =~ /^\$(\d+)\015\012/ or return;
+        push @args, substr $$buf, $pos + $+[0], $1;
+        $pos += $+[0] + $1 + 2;
+    }
+    return if $pos > length $$buf;
+    substr $$buf, 0, $pos, '';
+    return @args;
+}
+
+sub _write {
+    my ( $sock, $data ) = @_;
+    while ( length $data ) {
+        my $written = syswrite $sock, $data;
+        return unless $written;
+        substr $data, 0, $written, '';
+    }
+    return;
+}
+
+# encode the list as a multi-bulk reply, undefined elements are nil
+sub bulk {
+    return "*" . @_ . "\015\012" . join '',
+      map { defined $_ ? "\$" . length($_) . "\015\012$_\015\012" : "\$-1\015\012" } @_;
+}
+
+# encode the string as a bulk reply
+sub string {
+    my $str = shift;
+    return defined $str ? "\$" . length($str) . "\015\012$str\015\012" : "\$-1\015\012";
+}
+
+sub port {
+    return shift->{port};
+}
+
+sub stop {
+    my $self = shift;
+    return unless $self->{pid} and $$ == $self->{parent};
+    kill 'TERM', $self->{pid};
+    waitpid $self->{pid}, 0;
+    delete $self->{pid};
+    return;
+}
+
+sub DESTROY {
+    shift->stop;
+}
+
+1;
@@ -0,0 +1,125 @@
+use Test::Most 0.22;
+use RedisDB;
+use RedisDB::Loader;
+use RedisDB::Cluster;
+use RedisDB::KeyMap;
+
+# records commands and replies to them in mainloop
+{
+    package FakeRedis;
+    sub new { bless { commands => [], pending => [], @_[ 1 .. $#_ ] }, $_[0] }
+
+    *_stored_key = \&RedisDB::Cluster::_stored_key;
+
+    sub send_command {
+        my $self     = shift;
+        my $callback = pop;
+        push @{ $self->{commands} }, [@_];
+        push @{ $self->{pending} }, [ [@_], $callback ];
+        return 1;
+    }
+
+    sub mainloop {
+        my $self = shift;
+        while ( my $req = shift @{ $self->{pending} } ) {
+            my ( $command, @args ) = @{ $req->[0] };
+            my $reply;
+            if ( $args[0] eq 'error' ) {
+                $reply = RedisDB::Error->new("ERR failed");
+            }
+            elsif ( $command eq 'MGET' ) {
+                $reply = [ map { /^missing/ ? undef : "value of $_" } @args ];
+            }
+            else {
+                my $hash = shift @args;
+                $reply = [ map { "$hash.$_" } @args ];
+            }
+            $req->[1]->( $self, $reply );
+        }
+    }
+}
+
+subtest "batching" => sub {
+    my $redis  = FakeRedis->new;
+    my $loader = RedisDB::Loader->new( redis => $redis );
+    my @got;
+    my $foo  = $loader->get('foo');
+    my $bar  = $loader->get( 'bar', sub { push @got, $_[1] } );
+    my $miss = $loader->get('missing');
+    is $loader->get('foo'), $foo, "repeated lookup returned the same handle";
+    my $f1 = $loader->hget( 'h1', 'f1' );
+    my $f2 = $loader->hget( 'h1', 'f2' );
+    my $f3 = $loader->hget( 'h2', 'f1' );
+    is $loader->pending, 6, "6 values are pending";
+    ok !$foo->ready, "value is not loaded yet";
+    eq_or_diff $redis->{commands}, [], "nothing was sent";
+
+    is $foo->value, 'value of foo', "got value, which dispatched the batch";
+    is $loader->pending, 0, "no pending values";
+    eq_or_diff [ sort { $a->[0] cmp $b->[0] or $a->[1] cmp $b->[1] } @{ $redis->{commands} } ],
+      [ [qw(HMGET h1 f1 f2)], [qw(HMGET h2 f1)], [qw(MGET bar foo missing)] ],
+      "one MGET and one HMGET per hash were sent"
+      or diag explain $redis->{commands};
+    eq_or_diff \@got, ['value of bar'], "callback was invoked";
+    ok $bar->ready, "value is ready";
+    is $miss->value, undef, "missing key";
+    eq_or_diff [ map { $_->value } $f1, $f2, $f3 ], [qw(h1.f1 h1.f2 h2.f1)], "hash fields";
+
+    $loader->get( 'foo', sub { push @got, $_[1] } );
+    eq_or_diff \@got, [ 'value of bar', 'value of foo' ],
+      "callback for memoized value was invoked immediately";
+    is $loader->dispatch, 0, "memoized value was not requested again";
+
+    $loader->clear;
+    $loader->get('foo');
+    is $loader->pending, 1, "value was forgotten after clear";
+    my $err = $loader->get('error');
+    is $loader->dispatch, 1, "sent one command";
+    throws_ok { $err->value } qr/ERR failed/, "value throws error";
+};
+
+subtest "max_batch" => sub {
+    my $redis = FakeRedis->new;
+    my $loader = RedisDB::Loader->new( redis => $redis, max_batch => 2 );
+    my @values = map { $loader->get("key$_") } 1 .. 5;
+    is $loader->dispatch, 3, "keys were split into 3 commands";
+    eq_or_diff [ map { $_->value } @values ], [ map { "value of key$_" } 1 .. 5 ],
+      "got all values";
+};
+
+subtest "cluster" => sub {
+    my $cluster = FakeRedis->new;
+    my $loader = RedisDB::Loader->new( cluster => $cluster );
+    my @keys   = qw(foo bar {user1}.name {user1}.email);
+    my %values = map { $_ => $loader->get($_) } @keys;
+    is $loader->dispatch, 3, "sent a command per slot";
+    for ( @{ $cluster->{commands} } ) {
+        my ( undef, @args ) = @$_;
+        my %slots = map { RedisDB::Cluster::key_slot($_) => 1 } @args;
+        is keys %slots, 1, "all keys in MGET @args are in the same slot";
+    }
+    is $values{$_}->value, "value of $_", "got $_" for @keys;
+};
+
+subtest "cluster with key map" => sub {
+    my $map = RedisDB::KeyMap->new( prefixes => { 'production:' => 'p:' } );
+    my $cluster = FakeRedis->new( _key_map => $map );
+    my $loader = RedisDB::Loader->new( cluster => $cluster );
+
+    # find keys that are in the same slot, but not after mapping
+    my ( %slot, @keys );
+    for my $i ( 1 .. 10000 ) {
+        my $key = "production:$i";
+        my $other = $slot{ RedisDB::Cluster::key_slot($key) } ||= $key;
+        next if $other eq $key;
+        my %mapped = map { RedisDB::Cluster::key_slot( $map->encode($_) ) => 1 } $key, $other;
+        next if keys %mapped == 1;
+        @keys = ( $other, $key );
+        last;
+    }
+    $loader->get($_) for @keys;
+    is $loader->dispatch, 2, "keys are grouped by the mapped slots";
+    eq_or_diff [ sort map { $_->[1] } @{ $cluster->{commands} } ], [ sort @keys ], "a command per key";
+};
+
+done_testing;
@@ -0,0 +1,196 @@
+use Test::Most 0.22;
+use RedisDB;
+use RedisDB::NearCache;
+use lib 't/lib';
+use MockServer;
+use File::Temp qw(tempdir);
+use File::Spec;
+
+my $dir  = tempdir( CLEANUP => 1 );
+my $path = File::Spec->catfile( $dir, 'cache' );
+
+my $cache = RedisDB::NearCache->new(
+    path      => $path,
+    slots     => 64,
+    slot_size => 128,
+);
+
+subtest "get and set" => sub {
+    is_deeply [ $cache->get('foo') ], [], "foo is not in the cache";
+    ok $cache->set( 'foo', 'bar' ), "stored foo";
+    is_deeply [ $cache->get('foo') ], ['bar'], "got foo from the cache";
+    ok $cache->set( 'nil', undef ), "stored undefined value";
+    is_deeply [ $cache->get('nil') ], [undef], "got undefined value from the cache";
+    ok $cache->hset( 'hash', 'field', 'value' ), "stored field of the hash";
+    is_deeply [ $cache->hget( 'hash', 'field' ) ], ['value'], "got field from the cache";
+    is_deeply [ $cache->hget( 'hash', 'other' ) ], [], "other field is not in the cache";
+    is_deeply [ $cache->get('hash') ], [], "hash itself is not in the cache";
+    ok !$cache->set( 'big', 'x' x 200 ), "value that doesn't fit into slot is not stored";
+};
+
+subtest "invalidation" => sub {
+    $cache->hset( 'hash', 'other', 'value2' );
+    my $generation = $cache->generation;
+    $cache->invalidate('hash');
+    is_deeply [ $cache->hget( 'hash', 'field' ) ], [], "field was invalidated";
+    is_deeply [ $cache->hget( 'hash', 'other' ) ], [], "other field was invalidated";
+    is_deeply [ $cache->get('foo') ], ['bar'], "foo is still in the cache";
+    ok !$cache->set( 'hash', 'value', $generation ), "value obtained before invalidation is not stored";
+    $cache->flush;
+    is_deeply [ $cache->get('foo') ], [], "cache was flushed";
+};
+
+subtest "shared between processes" => sub {
+    $cache->set( 'parent', 1 );
+    my $pid = fork;
+    if ( $pid == 0 ) {
+        my @res = $cache->get('parent');
+        $cache->set( 'child', 2 );
+        exit( @res && $res[0] == 1 ? 0 : 1 );
+    }
+    waitpid $pid, 0;
+    is $?, 0, "child got value stored by parent";
+    my $other = RedisDB::NearCache->new(
+        path      => $path,
+        slots     => 64,
+        slot_size => 128,
+    );
+    is_deeply [ $other->get('child') ], [2], "value stored by child is visible in other instance";
+    dies_ok { RedisDB::NearCache->new( path => $path, slots => 32, slot_size => 128 ) }
+    "can't open cache with different size";
+};
+
+subtest "expiration" => sub {
+    my $short = RedisDB::NearCache->new(
+        path      => File::Spec->catfile( $dir, 'short' ),
+        slots     => 16,
+        slot_size => 128,
+        ttl       => 0.1,
+    );
+    $short->set( 'foo', 'bar' );
+    is_deeply [ $short->get('foo') ], ['bar'], "got foo from the cache";
+    select undef, undef, undef, 0.2;
+    is_deeply [ $short->get('foo') ], [], "foo has expired";
+};
+
+subtest "near_cache option" => sub {
+
+    # in-memory server with databases and transactions
+    my %db;
+    my $server = MockServer->new(
+        sub {
+            my ( $conn, $command, @args ) = @_;
+            my $db = $db{ $conn->{db} || 0 } ||= {};
+            if ( $conn->{multi} and $command ne 'EXEC' ) {
+                push @{ $conn->{multi} }, [ $command, @args ];
+                return "+QUEUED\015\012";
+            }
+            if ( $command eq 'SELECT' ) {
+                $conn->{db} = $args[0];
+                return "+OK\015\012";
+            }
+            elsif ( $command eq 'MULTI' ) {
+                $conn->{multi} = [];
+                return "+OK\015\012";
+            }
+            elsif ( $command eq 'EXEC' ) {
+                my @replies;
+                for ( @{ delete $conn->{multi} } ) {
+                    my ( $cmd, $key, $value ) = @$_;
+                    if ( $cmd eq 'FLUSHALL' ) {
+                        %$_ = () for values %db;
+                        push @replies, "+OK\015\012";
+                        next;
+                    }
+                    $db->{$key} = $value if $cmd eq 'SET';
+                    push @replies, $cmd eq 'SET' ? "+OK\015\012" : MockServer::string( $db->{$key} );
+                }
+                return "*" . @replies . "\015\012" . join '', @replies;
+            }
+            elsif ( $command eq 'SET' ) {
+                $db->{ $args[0] } = $args[1];
+                return "+OK\015\012";
+            }
+            elsif ( $command eq 'GET' ) {
+                return MockServer::string( $db->{ $args[0] } );
+            }
+            elsif ( $command eq 'HGET' ) {
+                return MockServer::string( $db->{"$args[0]/$args[1]"} );
+            }
+            elsif ( $command eq 'HSET' ) {
+                $db->{"$args[0]/$args[1]"} = $args[2];
+                return ":1\015\012";
+            }
+            elsif ( $command eq 'SORT' or $command =~ /^GEORADIUS/ ) {
+                $db->{ $args[-1] } = $command;
+                return ":1\015\012";
+            }
+            elsif ( $command eq 'FLUSHDB' or $command eq 'FLUSHALL' ) {
+                %$_ = () for $command eq 'FLUSHDB' ? $db : values %db;
+                return "+OK\015\012";
+            }
+            elsif ( $command eq 'SWAPDB' ) {
+                @db{ @args[ 0, 1 ] } = @db{ @args[ 1, 0 ] };
+                return "+OK\015\012";
+            }
+            return "+PONG\015\012";
+        }
+    ) or plan skip_all => "Can't start server";
+    $cache->flush;
+    my $redis = RedisDB->new(
+        host       => '127.0.0.1',
+        port       => $server->port,
+        near_cache => $cache,
+    );
+    my $other = RedisDB->new( host => '127.0.0.1', port => $server->port );
+
+    $other->set( foo => 'bar' );
+    is $redis->get('foo'), 'bar', "got foo from the server";
+    $other->set( foo => 'baz' );
+    is $redis->get('foo'), 'bar', "got foo from the cache";
+    $other->hset( 'hash', 'field', 1 );
+    is $redis->hget( 'hash', 'field' ), 1, "got field from the server";
+    $other->hset( 'hash', 'field', 2 );
+    is $redis->hget( 'hash', 'field' ), 1, "got field from the cache";
+    is $redis->ping, 'PONG', "other commands are sent to the server";
+
+    $redis->set( foo => 'own' );
+    is $redis->get('foo'), 'own', "own write invalidated the cached value";
+    $redis->hset( 'hash', 'field', 3 );
+    is $redis->hget( 'hash', 'field' ), 3, "own write invalidated cached fields";
+
+    $redis->multi;
+    is $redis->get('foo'), 'QUEUED', "the cache is not used in a transaction";
+    is_deeply [ $cache->_get( "127.0.0.1:" . $server->port . "/0", 'foo' ) ], ['own'], "QUEUED was not stored";
+    $redis->set( foo => 'multi' );
+    eq_or_diff $redis->exec, [ 'own', 'OK' ], "transaction got all the replies";
+    is $redis->get('foo'), 'multi', "write in the transaction invalidated the cached value";
+
+    $redis->select(1);
+    is $redis->get('foo'), undef, "values are cached separately for every database";
+    $redis->select(0);
+    is $redis->get('foo'), 'multi', "value in database 0";
+
+    $redis->set( dest => 'old' );
+    is $redis->get('dest'), 'old', "got dest from the server";
+    $redis->sort( 'list', STORE => 'dest' );
+    is $redis->get('dest'), 'SORT', "SORT invalidated the key in the STORE option";
+    $redis->georadius( 'geo', 0, 0, 1, 'km', STORE => 'dest' );
+    is $redis->get('dest'), 'GEORADIUS', "GEORADIUS invalidated the key in the STORE option";
+    $redis->georadiusbymember( 'geo', 'm', 1, 'km', STOREDIST => 'dest' );
+    is $redis->get('dest'), 'GEORADIUSBYMEMBER', "GEORADIUSBYMEMBER invalidated the key in the STOREDIST option";
+
+    $redis->execute( 'SWAPDB', 0, 1 );
+    is $redis->get('foo'), undef, "SWAPDB cleared the cache";
+    $other->set( foo => 'swapped' );
+    is $redis->get('foo'), undef, "missing key is cached";
+    $redis->flushdb;
+    $other->set( foo => 'flushed' );
+    is $redis->get('foo'), 'flushed', "FLUSHDB cleared the cache";
+    $redis->multi;
+    $redis->flushall;
+    $redis->exec;
+    is $redis->get('foo'), undef, "FLUSHALL in the transaction cleared the cache";
+};
+
+done_testing;
@@ -0,0 +1,59 @@
+use Test::Most 0.22;
+use RedisDB;
+use RedisDB::Profiler;
+use lib 't/lib';
+use MockServer;
+use File::Temp qw(tempdir);
+
+# replies to GET with a 100 bytes value, and +OK to other commands
+my $server = MockServer->new(
+    sub {
+        my ( $conn, $command ) = @_;
+        return $command eq 'GET' ? MockServer::string( 'x' x 100 ) : "+OK\015\012";
+    }
+);
+plan skip_all => "Can't start server" unless $server;
+
+my $dir      = tempdir( CLEANUP => 1 );
+my $profiler = RedisDB::Profiler->new( depth => 2, file => "$dir/redis.folded" );
+my $redis    = RedisDB->new( host => '127.0.0.1', port => $server->port, profiler => $profiler );
+
+sub load_user  { $redis->get('user') }
+sub save_user  { $redis->set( 'user', 'x' x 50 ) }
+sub handler    { load_user() for 1 .. 3; save_user() }
+sub async_save { $redis->set( 'user', 1, sub { } ); $redis->mainloop }
+
+handler();
+async_save();
+
+my @report = $profiler->report;
+is scalar @report, 3, "three call sites";
+my %by_sub = map { ( $_->{site}[-1] =~ /^main::(\w+)/ )[0] => $_ } @report;
+my $get = $by_sub{load_user};
+ok $get, "load_user call site" or diag explain \@report;
+is $get->{command}, 'GET', "command";
+is $get->{count},   3,     "count";
+is scalar @{ $get->{site} }, 2, "two frames";
+like $get->{site}[0], qr/^main::handler\(.*profiler\.t:\d+\)$/, "outer frame is the caller of load_user";
+ok $get->{total} > 0 && $get->{max} <= $get->{total}, "time is recorded";
+ok $get->{p50} <= $get->{p99} && $get->{p99} <= $get->{max}, "percentiles";
+is $get->{sent}, 3 * length("*2\r\n\$3\r\nGET\r\n\$4\r\nuser\r\n"), "bytes sent";
+is $get->{received}, 3 * 103, "bytes received";
+ok $by_sub{save_user}{sent} > 50, "SET sent the value";
+is $by_sub{async_save}{command}, 'SET', "callback command recorded";
+
+my @lines = split /\n/, $profiler->folded('count');
+is scalar @lines, 3, "three lines in folded output";
+like $_, qr/^main(?:::\w+)?\([^;]+\);main::\w+\([^;]+\);(?:GET|SET) \d+$/, "folded line $_" for @lines;
+ok( ( grep { /load_user.*;GET 3$/ } @lines ), "count of GET commands" );
+
+$profiler->dump;
+open my $fh, '<', "$dir/redis.folded" or die $!;
+my @dumped = <$fh>;
+is scalar @dumped, 3, "dumped results into the file";
+like $dumped[0], qr/ \d+$/, "time is the default metric";
+
+$profiler->reset;
+is scalar( () = $profiler->report ), 0, "reset statistics";
+
+done_testing;
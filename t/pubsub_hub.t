@@ -0,0 +1,66 @@
+use Test::Most 0.22;
+use RedisDB;
+use RedisDB::PubSubHub;
+use IO::Select;
+use lib 't/lib';
+use MockServer;
+
+my @seen;
+my $server = MockServer->new(
+    sub {
+        my ( $conn, $command, $channel ) = @_;
+        push @seen, $command;
+        if ( $command eq 'SUBSCRIBE' ) {
+            return MockServer::bulk( 'subscribe', $channel, 1 ) . MockServer::bulk( 'message', $channel, 'hello' );
+        }
+        elsif ( $command eq 'PSUBSCRIBE' ) {
+            return MockServer::bulk( 'psubscribe', $channel, 2 );
+        }
+        elsif ( $command eq 'UNSUBSCRIBE' ) {
+            return MockServer::bulk( 'unsubscribe', $channel, 1 )
+              . MockServer::bulk( 'pmessage', 'f*', 'foo', join ',', @seen );
+        }
+        return;
+    }
+);
+plan skip_all => "Can't start server" unless $server;
+
+my $hub = RedisDB::PubSubHub->new(
+    redis => RedisDB->new(
+        host => '127.0.0.1',
+        port => $server->port,
+    )
+);
+
+sub wait_for {
+    my $cond = shift;
+    my $sel  = IO::Select->new( $hub->socket );
+    for ( 1 .. 50 ) {
+        $hub->process_messages;
+        return 1 if $cond->();
+        $sel->can_read(0.1);
+    }
+    return;
+}
+
+my ( @first, @second, @pattern );
+my $s1 = $hub->subscribe( foo => sub { push @first, [ @_[ 1 .. 3 ] ] } );
+my $s2 = $hub->subscribe( foo => sub { push @second, $_[3] } );
+is $hub->listeners('foo'), 2, "two listeners of foo";
+my $p = $hub->psubscribe( 'f*' => sub { push @pattern, [ @_[ 1 .. 3 ] ] } );
+ok wait_for( sub { @first and @second } ), "got the message";
+eq_or_diff \@first, [ [ 'foo', undef, 'hello' ] ], "first listener got the message once";
+eq_or_diff \@second, ['hello'], "second listener got the message once";
+
+ok $hub->unsubscribe($s1), "removed first listener";
+is $hub->listeners('foo'), 1, "one listener of foo";
+ok $hub->unsubscribe($s2), "removed second listener";
+ok !$hub->unsubscribe($s2), "second listener was already removed";
+ok wait_for( sub { @pattern } ), "got the message for pattern";
+eq_or_diff \@pattern, [ [ 'foo', 'f*', 'SUBSCRIBE,PSUBSCRIBE,UNSUBSCRIBE' ] ],
+  "SUBSCRIBE and UNSUBSCRIBE were sent to the server once";
+dies_ok { $hub->subscribe('foo') } "callback is required";
+
+undef $hub;
+
+done_testing;
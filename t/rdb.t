@@ -0,0 +1,203 @@
+use Test::Most 0.22;
+use RedisDB::RDB;
+
+# helpers building RDB file pieces
+
+sub len {
+    my $len = shift;
+    return chr $len if $len < 64;
+    return pack 'n', 0x4000 | $len if $len < 16384;
+    return "\x80" . pack 'N', $len;
+}
+
+sub str {
+    my $str = shift;
+    return len( length $str ) . $str;
+}
+
+sub lp_entry {
+    my $item = shift;
+    my $data;
+    if ( $item =~ /^[0-9]+$/ and $item < 128 ) {
+        $data = chr $item;
+    }
+    elsif ( $item =~ /^-[0-9]+$/ and $item >= -4096 ) {
+        my $value = $item + 8192;
+        $data = pack 'CC', 0xC0 | ( $value >> 8 ), $value & 0xff;
+    }
+    else {
+        $data = chr( 0x80 | length $item ) . $item;
+    }
+    return $data . chr length $data;
+}
+
+sub listpack {
+    my $entries = join '', map { lp_entry($_) } @_;
+    return pack( 'Vv', 7 + length $entries, scalar @_ ) . $entries . "\xff";
+}
+
+sub ziplist {
+    my $entries = '';
+    for (@_) {
+        $entries .= "\0";
+        if (/^[0-9]+$/ and $_ <= 12) {
+            $entries .= chr( 0xF1 + $_ );
+        }
+        elsif (/^-?[0-9]+$/) {
+            $entries .= "\xc0" . pack 's<', $_;
+        }
+        else {
+            $entries .= chr( length $_ ) . $_;
+        }
+    }
+    return pack( 'VVv', 11 + length $entries, 0, scalar @_ ) . $entries . "\xff";
+}
+
+my $stream_lp = listpack(
+    2, 0, 2, 'f1', 'f2', 0,    # master entry
+    2, 0, 0, 'v1', 'v2', 4,    # same fields as master
+    0, 5, 0, 1, 'x', 'y', 5,   # own fields
+);
+my $stream = len(1)
+  . str( pack 'Q>Q>', 1000, 0 )
+  . str($stream_lp)
+  . len(2)
+  . len(1005) . len(0)         # last id
+  . len(1000) . len(0)         # first id
+  . len(0) . len(0)            # max deleted id
+  . len(2)                     # entries added
+  . len(1)                     # groups
+  . str('g')
+  . len(1000) . len(0)
+  . len(1)                     # entries read
+  . len(1) . ( "\0" x 24 ) . len(1)    # PEL
+  . len(1) . str('c') . ( "\0" x 16 ) . len(1) . ( "\0" x 16 );
+
+my $rdb = join '',
+  'REDIS0011',
+  "\xfa", str('redis-ver'), str('7.2.0'),
+  "\xfa", str('ctime'), "\xc2", pack( 'l<', 1_600_000_000 ),
+  "\xf7", len(42), len(2), len(1), len(5), str('aux'), len(0),    # module aux
+  "\xfe", len(0),
+  "\xfb", len(10), len(1),
+  "\x00", str('foo'), str('bar'),
+  "\x00", str('num'), "\xc1", pack( 's<', 12345 ),
+  "\xfc", pack( 'Q<', 1_600_000_100_000 ),
+  "\x00", str('lzf'), "\xc3", len(6), len(9), "\x02abc\x80\x02",
+  "\xf9", "\x05",
+  "\x12", str('list'), len(2), len(2), str( listpack( 'a', 5, -3 ) ), len(1), str('plain'),
+  "\x0b", str('intset'), str( pack 'VVs<3', 2, 3, 1, -2, 3 ),
+  "\x14", str('set'), str( listpack( 'x', 'y' ) ),
+  "\x05", str('zset'), len(2), str('m1'), pack( 'd<', 1.5 ), str('m2'), pack( 'd<', -2 ),
+  "\xf8", len(100),
+  "\x10", str('user:1'), str( listpack( 'name', 'bob', 'age', 42 ) ),
+  "\x0a", str('user:2'), str( ziplist( 'a', 7, 1000, -5 ) ),
+  "\x15", str('events'), $stream,
+  "\xfe", len(1),
+  "\xfd", pack( 'V', 1_600_000_200 ),
+  "\x04", str('h'), len(1), str('f'), str('v'),
+  "\x00", str('big'), str( 'x' x 200_000 ),
+  "\xff", "\0" x 8;
+
+open my $fh, '<', \$rdb;
+my $reader = RedisDB::RDB->new( fh => $fh, values => 1 );
+is $reader->version, 11, "version";
+my @keys;
+while ( my $key = $reader->next_key ) {
+    push @keys, $key;
+}
+eq_or_diff $reader->aux, { 'redis-ver' => '7.2.0', ctime => 1_600_000_000 }, "aux fields";
+my %keys = map { $_->{key} => $_ } @keys;
+eq_or_diff [ map { $_->{key} } @keys ],
+  [qw(foo num lzf list intset set zset user:1 user:2 events h big)], "all keys were read";
+
+is $keys{foo}{value}, 'bar', "string";
+is $keys{foo}{encoding}, 'raw', "string encoding";
+is $keys{foo}{size}, 1 + 4 + 4, "string size";
+is $keys{num}{value}, 12345, "integer string";
+is $keys{num}{encoding}, 'int', "integer encoding";
+is $keys{lzf}{value}, 'abcabcabc', "LZF compressed string";
+is $keys{lzf}{expire}, 1_600_000_100_000, "expire in ms";
+is $keys{foo}{expire}, undef, "no expire";
+eq_or_diff $keys{list}{value}, [ 'a', 5, -3, 'plain' ], "quicklist";
+is $keys{list}{elements}, 4, "quicklist elements";
+eq_or_diff $keys{intset}{value}, [ 1, -2, 3 ], "intset";
+is $keys{intset}{type}, 'set', "intset type";
+eq_or_diff $keys{set}{value}, [qw(x y)], "set listpack";
+eq_or_diff $keys{zset}{value}, [ m1 => 1.5, m2 => -2 ], "zset";
+is $keys{zset}{elements}, 2, "zset elements";
+eq_or_diff $keys{'user:1'}{value}, [ name => 'bob', age => 42 ], "hash listpack";
+is $keys{'user:1'}{encoding}, 'listpack', "hash encoding";
+is $keys{'user:1'}{elements}, 2, "hash elements";
+eq_or_diff $keys{'user:2'}{value}, [ 'a', 7, 1000, -5 ], "list ziplist";
+is $keys{h}{db}, 1, "key in the second database";
+is $keys{h}{expire}, 1_600_000_200_000, "expire in seconds";
+is $keys{big}{elements}, 200_000, "string length";
+
+my $events = $keys{events}{value};
+eq_or_diff $events->{entries},
+  [ [ '1000-0', [ f1 => 'v1', f2 => 'v2' ] ], [ '1005-0', [ x => 'y' ] ] ], "stream entries";
+is $events->{last_id}, '1005-0', "stream last id";
+eq_or_diff $events->{groups}, [ { name => 'g', last_id => '1000-0', entries_read => 1 } ],
+  "stream groups";
+is $keys{events}{elements}, 2, "stream length";
+
+open $fh, '<', \$rdb;
+$reader = RedisDB::RDB->new( fh => $fh );
+my @sizes;
+while ( my $key = $reader->next_key ) {
+    ok !exists $key->{value}, "no value for $key->{key}";
+    push @sizes, [ $key->{key}, $key->{size}, $key->{elements} ];
+}
+eq_or_diff \@sizes, [ map { [ @$_{qw(key size elements)} ] } @keys ],
+  "sizes and elements are the same without values";
+
+eq_or_diff [ RedisDB::RDB::commands( $keys{zset} ) ],
+  [ [qw(DEL zset)], [ 'ZADD', 'zset', 1.5, 'm1', -2, 'm2' ] ], "zset commands";
+eq_or_diff [ RedisDB::RDB::commands( $keys{list}, 3 ) ],
+  [ [qw(DEL list)], [ 'RPUSH', 'list', 'a', 5, -3 ], [qw(RPUSH list plain)] ], "list in batches";
+eq_or_diff [ RedisDB::RDB::commands( $keys{lzf} ) ],
+  [ [qw(SET lzf abcabcabc)], [ 'PEXPIREAT', 'lzf', 1_600_000_100_000 ] ], "string with expire";
+eq_or_diff [ RedisDB::RDB::commands( $keys{events} ) ],
+  [
+    [qw(DEL events)],
+    [qw(XADD events 1000-0 f1 v1 f2 v2)],
+    [qw(XADD events 1005-0 x y)],
+    [qw(XSETID events 1005-0)],
+    [qw(XGROUP CREATE events g 1000-0 ENTRIESREAD 1)],
+  ],
+  "stream commands";
+
+open $fh, '<', \$rdb;
+$reader = RedisDB::RDB->new( fh => $fh, values => 1 );
+my ( %streamed, %chunks );
+while (
+    my $key = $reader->next_key(
+        sub {
+            my ( $key, $chunk ) = @_;
+            ok !exists $key->{value}, "chunk of $key->{key} is passed before the value";
+            push @{ $chunks{ $key->{key} } }, $chunk;
+            push @{ $streamed{ $key->{key} } }, RedisDB::RDB::chunk_commands( $key, $chunk );
+        },
+        2
+    )
+  )
+{
+    push @{ $streamed{ $key->{key} } }, RedisDB::RDB::commands( $key, 2 );
+    is $key->{chunks} // 0, scalar @{ $chunks{ $key->{key} } || [] }, "number of chunks of $key->{key}";
+}
+eq_or_diff $chunks{list}, [ [ 'a', 5 ], [ -3, 'plain' ] ], "list is passed in chunks";
+eq_or_diff $chunks{zset}, [ [ m1 => 1.5, m2 => -2 ] ], "zset chunk contains pairs";
+eq_or_diff $chunks{intset}, [ [ 1, -2 ], [3] ], "compact encoding is passed in chunks";
+is scalar @{ $chunks{events} }, 1, "stream entries are passed in chunks";
+ok !$chunks{foo}, "strings are not passed in chunks";
+eq_or_diff \%streamed, { map { $_->{key} => [ RedisDB::RDB::commands( $_, 2 ) ] } @keys },
+  "commands are the same when elements are passed in chunks";
+
+dies_ok { RedisDB::RDB->new( fh => do { open my $fh, '<', \"RDB"; $fh } ) } "not an RDB file";
+my $truncated = substr $rdb, 0, 100;
+open $fh, '<', \$truncated;
+$reader = RedisDB::RDB->new( fh => $fh );
+throws_ok { 1 while $reader->next_key } qr/Unexpected end/, "truncated file";
+
+done_testing;
@@ -0,0 +1,127 @@
+use Test::Most 0.22;
+use RedisDB;
+use RedisDB::Redlock;
+use POSIX ();
+
+# emulates a server, keys don't expire. Scripts are not in the cache until
+# they are sent using EVAL
+{
+    package FakeRedis;
+    sub new { bless { data => {}, commands => [], pending => [], down => 0 }, shift }
+
+    sub send_command {
+        my $self     = shift;
+        my $callback = pop;
+        push @{ $self->{commands} }, $_[0];
+        push @{ $self->{pending} }, [ [@_], $callback ];
+        return 1;
+    }
+
+    sub _reply {
+        my ( $self, $command, @args ) = @_;
+        return RedisDB::Error::DISCONNECTED->new("Couldn't connect") if $self->{down};
+        my $data = $self->{data};
+        if ( $command eq 'SET' ) {
+            return undef if exists $data->{ $args[0] };
+            $data->{ $args[0] } = $args[1];
+            $self->{ttl}{ $args[0] } = $args[4];
+            return 'OK';
+        }
+        my $script;
+        if ( $command eq 'EVAL' ) {
+            $script = shift @args;
+            $self->{scripts}{ Digest::SHA::sha1_hex($script) } = $script;
+        }
+        else {
+            $script = $self->{scripts}{ shift @args }
+              or return RedisDB::Error->new("NOSCRIPT No matching script");
+        }
+        my ( undef, $key, $token, $ttl ) = @args;
+        return 0 unless defined $data->{$key} and $data->{$key} eq $token;
+        if ( $script =~ /DEL/ ) {
+            delete $data->{$key};
+        }
+        else {
+            $self->{ttl}{$key} = $ttl;
+        }
+        return 1;
+    }
+
+    sub mainloop {
+        my $self = shift;
+        while ( my $req = shift @{ $self->{pending} } ) {
+            $req->[1]->( $self, $self->_reply( @{ $req->[0] } ) );
+        }
+    }
+}
+
+my @servers = map { FakeRedis->new } 1 .. 3;
+my $redlock = RedisDB::Redlock->new( servers => \@servers, retry_count => 2, retry_delay => 0.01 );
+
+subtest "lock and unlock" => sub {
+    my $lock = $redlock->lock( 'res', 10 );
+    ok $lock, "got the lock";
+    ok $lock->{validity} > 9.8 && $lock->{validity} < 9.9, "validity accounts for the drift"
+      or diag $lock->{validity};
+    is $_->{data}{res}, $lock->{token}, "key is set on the server" for @servers;
+    is $_->{ttl}{res}, 10000, "with the ttl" for @servers;
+    ok !$redlock->lock( 'res', 10 ), "can't acquire the lock again";
+    is $redlock->unlock($lock), 1, "released the lock";
+    ok !exists $_->{data}{res}, "key was deleted" for @servers;
+    is $lock->{validity}, 0, "lock is not valid";
+};
+
+subtest "quorum" => sub {
+    $servers[0]{down} = 1;
+    $servers[1]{data}{res} = 'other';
+    ok !$redlock->lock( 'res', 10 ), "can't get the lock from the minority";
+    is $servers[1]{data}{res}, 'other', "the other lock was not released";
+    ok !exists $servers[2]{data}{res}, "partially acquired lock was released";
+    delete $servers[1]{data}{res};
+    my $lock = $redlock->lock( 'res', 10 );
+    ok $lock, "got the lock with one server down";
+    is $redlock->unlock($lock), 1, "released the lock";
+    $servers[0]{down} = 0;
+};
+
+subtest "extend" => sub {
+    my @locks = map { $redlock->lock( $_, 1 ) } qw(a b c);
+    is scalar( grep { $_ } @locks ), 3, "got three locks";
+    $_->{commands} = [] for @servers;
+    $servers[1]{data}{b} = $servers[2]{data}{b} = 'other';
+    my @res = $redlock->extend( 5, @locks );
+    is scalar @res, 3, "returned all locks";
+    ok $locks[0]{validity} > 4.9, "lock a was extended";
+    is $locks[1]{validity}, 0, "lock b was lost";
+    ok $locks[2]{validity} > 4.9, "lock c was extended";
+    is $servers[0]{ttl}{a}, 5000, "ttl was updated";
+    eq_or_diff $servers[0]{commands}, [qw(EVALSHA EVALSHA EVALSHA EVAL EVAL EVAL)],
+      "all scripts were sent in one batch and loaded when missing";
+    $_->{commands} = [] for @servers;
+    $redlock->extend( 5, @locks[ 0, 2 ] );
+    eq_or_diff $servers[0]{commands}, [qw(EVALSHA EVALSHA)], "scripts are cached";
+    is $redlock->unlock(@locks), 2, "released two locks";
+};
+
+subtest "tokens are unique in forked processes" => sub {
+    rand;
+    pipe my $r, my $w or die "Couldn't create pipe: $!";
+    my @pids = map {
+        my $pid = fork;
+        die "Couldn't fork: $!" unless defined $pid;
+        unless ($pid) {
+            close $r;
+            syswrite $w, RedisDB::Redlock::_token() . "\n";
+            POSIX::_exit(0);
+        }
+        $pid;
+    } 1 .. 3;
+    close $w;
+    my @tokens = <$r>;
+    waitpid $_, 0 for @pids;
+    chomp @tokens;
+    like $_, qr/^[0-9a-f]{32}$/, "token is 16 bytes in hex" for @tokens;
+    is scalar( keys %{ { map { $_ => 1 } @tokens, RedisDB::Redlock::_token() } } ), 4, "tokens are different";
+};
+
+done_testing;
@@ -0,0 +1,98 @@
+use Test::Most 0.22;
+use RedisDB;
+use RedisDB::Profiler;
+use lib 't/lib';
+use MockServer;
+use Time::HiRes qw(time);
+
+# GET "failN:key" returns LOADING error for the first N requests, "err:key"
+# always returns ERR, COUNT returns how many times the key was requested, LOG
+# returns the requested keys matching the pattern in the order of requests
+my ( %count, @log );
+my $server = MockServer->new(
+    sub {
+        my ( $conn, $command, $key ) = @_;
+        if ( $command eq 'COUNT' ) {
+            return ":" . ( $count{$key} || 0 ) . "\015\012";
+        }
+        elsif ( $command eq 'LOG' ) {
+            return MockServer::bulk( grep { /$key/ } @log );
+        }
+        push @log, $key;
+        if ( ++$count{$key} and $key =~ /^fail([0-9]+):/ and $count{$key} <= $1 ) {
+            return "-LOADING Redis is loading the dataset in memory\015\012";
+        }
+        elsif ( $key =~ /^err:/ ) {
+            return "-ERR failed\015\012";
+        }
+        return MockServer::string($key);
+    },
+    timeout => 20,
+);
+plan skip_all => "Can't start server" unless $server;
+
+my $redis = RedisDB->new(
+    host  => '127.0.0.1',
+    port  => $server->port,
+    retry => { base_delay => 0.01, max_delay => 0.05, deadline => 1 },
+);
+
+subtest "execute" => sub {
+    is $redis->get('fail2:a'), 'fail2:a', "got the value after retries";
+    is $redis->execute( 'COUNT', 'fail2:a' ), 3, "the command was sent 3 times";
+    throws_ok { $redis->get('err:a') } qr/ERR failed/, "other errors are thrown";
+    is $redis->execute( 'COUNT', 'err:a' ), 1, "other errors are not retried";
+};
+
+subtest "pipeline" => sub {
+    $redis->send_command( 'GET', $_ ) for qw(ok:b fail1:b ok2:b fail3:b);
+    eq_or_diff [ $redis->get_all_replies ], [qw(ok:b fail1:b ok2:b fail3:b)],
+      "replies are in order";
+    eq_or_diff [ map { $redis->execute( 'COUNT', $_ ) } qw(ok:b fail1:b ok2:b fail3:b) ],
+      [ 1, 2, 1, 4 ], "only failed commands were retried";
+
+    my @replies;
+    $redis->get( $_, sub { push @replies, $_[1] } ) for qw(fail2:c ok:c);
+    $redis->mainloop;
+    eq_or_diff \@replies, [qw(ok:c fail2:c)], "callbacks got the final replies";
+
+    $redis->send_command( 'GET', $_ ) for qw(fail2:e1 ok:e2 fail1:e3 fail2:e4);
+    eq_or_diff [ $redis->get_all_replies ], [qw(fail2:e1 ok:e2 fail1:e3 fail2:e4)],
+      "replies are in order";
+    eq_or_diff $redis->execute( 'LOG', ':e' ),
+      [qw(fail2:e1 ok:e2 fail1:e3 fail2:e4 fail2:e1 fail1:e3 fail2:e4 fail2:e1 fail2:e4)],
+      "failed commands were sent again in the original order";
+};
+
+subtest "durable writes" => sub {
+    my @replies;
+    $redis->send_durable( {}, SET => $_, 1, sub { push @replies, [ @_[ 1, 2 ] ] } )
+      for qw(ok:f fail1:f);
+    $redis->mainloop;
+    eq_or_diff \@replies, [ [ 'ok:f', { replicas => 1 } ], [ 'fail1:f', undef ] ],
+      "retried write is not confirmed by WAIT";
+};
+
+subtest "profiler" => sub {
+    my $profiler = RedisDB::Profiler->new;
+    my $profiled = RedisDB->new(
+        host     => '127.0.0.1',
+        port     => $server->port,
+        profiler => $profiler,
+        retry    => { base_delay => 0.01, max_delay => 0.05, deadline => 1 },
+    );
+    is $profiled->get('fail2:g'), 'fail2:g', "got the value after retries";
+    my $count = 0;
+    $count += $_->{count} for grep { $_->{command} eq 'GET' } $profiler->report;
+    is $count, 3, "every attempt was profiled";
+};
+
+subtest "deadline" => sub {
+    my $start = time;
+    throws_ok { $redis->get('fail1000:d') } qr/^LOADING/, "got the error after the deadline";
+    my $elapsed = time - $start;
+    cmp_ok $elapsed, '<', 1.1, "gave up before the deadline";
+    cmp_ok $redis->execute( 'COUNT', 'fail1000:d' ), '>', 5, "the command was retried";
+};
+
+done_testing;
@@ -0,0 +1,52 @@
+use Test::Most 0.22;
+use Test::RedisDB;
+use RedisDB::Scheduler;
+use Time::HiRes qw(time sleep);
+
+my $server = Test::RedisDB->new;
+plan( skip_all => "Can't start redis-server" ) unless $server;
+my $redis = $server->redisdb_client;
+
+my $scheduler = RedisDB::Scheduler->new(
+    redis              => $redis,
+    name               => 'test',
+    partitions         => 3,
+    visibility_timeout => 1,
+);
+
+subtest "schedule and claim" => sub {
+    my $now = time;
+    $scheduler->schedule_many( map { [ "task$_", $now - 1 ] } 1 .. 10 );
+    $scheduler->schedule( "later", $now + 100 );
+    my @tasks = $scheduler->claim(4);
+    is @tasks, 4, "claimed 4 tasks";
+    push @tasks, $scheduler->claim(100);
+    eq_or_diff [ sort @tasks ], [ sort map { "task$_" } 1 .. 10 ], "claimed all due tasks";
+    is_deeply [ $scheduler->claim(1) ], [], "no more due tasks";
+    cmp_ok abs( $scheduler->next_due - $now - 100 ), '<', 0.01, "next task is due in 100s";
+    is $scheduler->ack( @tasks[ 0 .. 7 ] ), 8, "acknowledged 8 tasks";
+    is $scheduler->requeue( $tasks[8] ), 1, "requeued one task";
+    is_deeply [ $scheduler->claim(10) ], [ $tasks[8] ], "claimed requeued task";
+    is $scheduler->retry( 0.2, $tasks[8] ), 1, "rescheduled task";
+    is_deeply [ $scheduler->claim(10) ], [], "task is not yet due";
+    my $start = time;
+    $scheduler->wait_for_tasks(5);
+    cmp_ok time - $start, '<', 1, "woke up when the task became due";
+    is_deeply [ $scheduler->claim(10) ], [ $tasks[8] ], "claimed rescheduled task";
+};
+
+subtest "visibility timeout" => sub {
+    my @tasks = $scheduler->claim(10);
+    is @tasks, 1, "one task is not acknowledged";
+    sleep 1.1;
+    is_deeply [ $scheduler->claim(10) ], \@tasks, "task returned into the schedule after timeout";
+    is $scheduler->ack(@tasks), 1, "acknowledged the task";
+};
+
+subtest "script cache flushed" => sub {
+    $redis->script_flush;
+    $scheduler->schedule( "flushed", time - 1 );
+    is_deeply [ $scheduler->claim(10) ], ["flushed"], "claimed task after script cache was flushed";
+};
+
+done_testing;
@@ -0,0 +1,73 @@
+use Test::Most 0.22;
+use RedisDB;
+use Time::HiRes qw(sleep);
+use lib 't/lib';
+use MockServer;
+
+# SLOW replies after the given number of seconds, ID returns the number of
+# the connection, ECHO returns the argument
+my $server = MockServer->new(
+    sub {
+        my ( $conn, $command, $arg ) = @_;
+        if ( $command eq 'SLOW' ) {
+            sleep $arg;
+            return "+SLOW $arg\015\012";
+        }
+        return ":$conn->{id}\015\012" if $command eq 'ID';
+        return MockServer::string($arg);
+    },
+    fork    => 1,
+    timeout => 20,
+) or plan skip_all => "Can't start server";
+my $port = $server->port;
+
+my $redis = RedisDB->new(
+    host         => '127.0.0.1',
+    port         => $port,
+    timeout      => 0.2,
+    soft_timeout => 1,
+    raise_error  => 0,
+);
+is $redis->execute('ID'), 1, "first connection";
+
+my %replies;
+$redis->send_command( SLOW => 0.3, sub { $replies{slow} = $_[1] } );
+$redis->send_command( ECHO => 'a', sub { $replies{echo} = $_[1] } );
+$redis->mainloop;
+isa_ok $replies{slow}, 'RedisDB::Error::EAGAIN', "slow command timed out";
+is $replies{echo}, 'a', "the next command got its reply";
+is $redis->echo('b'), 'b', "late reply was discarded";
+is $redis->execute('ID'), 1, "connection was kept";
+
+my $res = $redis->execute( SLOW => 0.3 );
+isa_ok $res, 'RedisDB::Error::EAGAIN', "synchronous command timed out";
+is $redis->{_abandoned}, 1, "one reply is expected";
+is $redis->echo('c'), 'c', "the next synchronous command got its reply";
+is $redis->{_abandoned}, 0, "late reply was discarded";
+
+$redis->{raise_error} = 1;
+throws_ok { $redis->execute( SLOW => 0.3 ) } 'RedisDB::Error::EAGAIN', "timeout is thrown with raise_error";
+is $redis->echo('d'), 'd', "the command after the exception got its reply";
+is $redis->execute('ID'), 1, "connection was kept";
+$redis->{raise_error} = 0;
+
+$redis->{max_abandoned} = 1;
+my @replies;
+$redis->send_command( SLOW => 1, sub { push @replies, $_[1] } ) for 1 .. 2;
+$redis->mainloop;
+isa_ok $replies[0], 'RedisDB::Error::EAGAIN', "first command timed out";
+isa_ok $replies[1], 'RedisDB::Error::EAGAIN', "second command failed";
+is $redis->execute('ID'), 2, "too many abandoned replies, reconnected";
+is $redis->{_abandoned}, 0, "nothing is expected";
+
+my $hard = RedisDB->new(
+    host        => '127.0.0.1',
+    port        => $port,
+    timeout     => 0.2,
+    raise_error => 0,
+);
+my $id = $hard->execute('ID');
+isa_ok $hard->execute( SLOW => 0.3 ), 'RedisDB::Error::EAGAIN', "timeout without soft_timeout";
+isnt $hard->execute('ID'), $id, "connection was reset";
+
+done_testing;
@@ -0,0 +1,130 @@
+use Test::Most 0.22;
+use RedisDB;
+use RedisDB::Spool;
+use Time::HiRes qw(time sleep);
+use lib 't/lib';
+use MockServer;
+use File::Temp qw(tempdir);
+use File::Spec;
+
+my $dir = tempdir( CLEANUP => 1 );
+
+subtest "spool file" => sub {
+    my $path  = File::Spec->catfile( $dir, 'unit.spool' );
+    my $spool = RedisDB::Spool->new(
+        path      => $path,
+        commands  => [qw(set lpush)],
+        max_bytes => 30,
+        batch     => 2,
+    );
+    ok $spool->eligible('SET'),  "SET is eligible";
+    ok !$spool->eligible('GET'), "GET is not eligible";
+    ok $spool->append("request1"), "appended first request";
+    ok $spool->append("request2"), "appended second request";
+    ok !$spool->append("request3"), "spool is full";
+    is $spool->pending, 24, "24 bytes are pending";
+    dies_ok { RedisDB::Spool->new( path => $path, commands => ['SET'] ) }
+    "spool file is locked";
+
+    my ( $requests, $pos ) = $spool->_read_batch;
+    eq_or_diff $requests, [qw(request1 request2)], "read the batch";
+    $spool->_commit( 12, 1 );
+    is $spool->pending, 12, "first request was replayed";
+    undef $spool;
+
+    $spool = RedisDB::Spool->new( path => $path, commands => ['SET'] );
+    ( $requests, $pos ) = $spool->_read_batch;
+    eq_or_diff $requests, [qw(request2)], "position was restored after reopening";
+    $spool->_commit( $pos, 1 );
+    is $spool->pending, 0, "spool is empty";
+    is -s $path, 0, "spool file was truncated";
+};
+
+subtest "incomplete record" => sub {
+    my %db;
+    my $server = MockServer->new(
+        sub {
+            my ( $conn, $command, @args ) = @_;
+            return MockServer::string( $db{ $args[0] } ) if $command eq 'GET';
+            $db{ $args[0] } = $args[1];
+            return "+OK\015\012";
+        }
+    ) or plan skip_all => "Can't start server";
+    my $set = sub { MockServer::bulk( 'SET', @_ ) };
+    my $path  = File::Spec->catfile( $dir, 'torn.spool' );
+    my $spool = RedisDB::Spool->new( path => $path, commands => ['SET'] );
+    ok $spool->append( $set->( a => 1 ) ), "appended first request";
+    ok $spool->append( $set->( b => 2 ) ), "appended second request";
+    undef $spool;
+
+    # process was killed in the middle of the append
+    truncate $path, ( -s $path ) - 5 or die "Couldn't truncate $path: $!";
+    $spool = RedisDB::Spool->new( path => $path, commands => ['SET'] );
+    is $spool->pending, 4 + length $set->( a => 1 ), "incomplete record was removed";
+    ok $spool->append( $set->( c => 3 ) ), "appended third request";
+
+    my $redis = RedisDB->new( host => '127.0.0.1', port => $server->port, spool => $spool );
+    ok $redis->drain_spool, "drained spool";
+    is $spool->stats->{replayed}, 2, "two requests were replayed";
+    eq_or_diff [ map { $redis->get($_) } qw(a b c) ], [ 1, undef, 3 ], "complete requests were replayed";
+};
+
+subtest "spooling while server is not available" => sub {
+    my %db;
+    my $handler = sub {
+        my ( $conn, $command, @args ) = @_;
+        if ( $command eq 'SET' ) {
+            $db{ $args[0] } = $args[1];
+            return "+OK\015\012";
+        }
+        return MockServer::string( $db{ $args[0] } ) if $command eq 'GET';
+        $conn->{close} = 1;
+        return "+PONG\015\012";
+    };
+    my $server = MockServer->new($handler);
+    plan skip_all => "Can't start server" unless $server;
+    my $port = $server->port;
+    $server->stop;
+
+    my $spool = RedisDB::Spool->new(
+        path           => File::Spec->catfile( $dir, 'redis.spool' ),
+        commands       => ['SET'],
+        drain_interval => 60,
+    );
+    my $redis = RedisDB->new(
+        host               => '127.0.0.1',
+        port               => $port,
+        lazy               => 1,
+        reconnect_attempts => 3,
+        spool              => $spool,
+    );
+    my $start = time;
+    is $redis->set( foo => 1 ), 'SPOOLED', "SET was spooled";
+    ok time - $start < 1, "didn't wait between connection attempts";
+    is $redis->set( foo => 2 ), 'SPOOLED', "second SET was spooled";
+    my $reply;
+    $redis->set( bar => 3, sub { $reply = $_[1] } );
+    is $reply, 'SPOOLED', "callback got SPOOLED reply";
+    dies_ok { $redis->get('foo') } "GET is not spooled";
+    is $spool->stats->{spooled}, 3, "three commands were spooled";
+    ok !$redis->drain_spool, "couldn't drain spool";
+
+    $server = MockServer->new( $handler, port => $port ) or die "Can't start server: $!";
+    ok $redis->drain_spool, "drained spool";
+    eq_or_diff $spool->stats,
+      { spooled => 3, replayed => 3, errors => 0, rejected => 0, pending_bytes => 0 },
+      "all commands were replayed";
+    is $redis->set( foo => 4 ), 'OK', "SET is sent to the server";
+    is $redis->get('foo'), 4, "got the value";
+
+    is $redis->ping, 'PONG', "server closes connection after PING";
+    $server->stop;
+    $start = time;
+    is $redis->set( foo => 5 ), 'SPOOLED', "SET was spooled after the connection was lost";
+    ok time - $start < 1, "didn't wait between connection attempts";
+    $server = MockServer->new( $handler, port => $port ) or die "Can't start server: $!";
+    ok $redis->drain_spool, "drained spool";
+    is $redis->get('foo'), 5, "got the new value";
+};
+
+done_testing;
@@ -0,0 +1,257 @@
+#!/usr/bin/perl
+
+# Replay keys sampled by RedisDB::KeySampler through simulated caches of
+# different sizes and print miss ratio curves.
+#
+#   cache_sim.pl [--policies lru,lfu,ttl] [--points 20] [--sizes 64M,1G]
+#                [--overhead 64] [--samples 5] [--target 0.95] sample...
+#
+# Eviction is approximated the same way as redis does it: --samples random
+# keys are checked and the best candidate is evicted. lru evicts the least
+# recently used key, lfu the key with the lowest logarithmic access counter,
+# and ttl the key with the nearest expiration among keys with TTL, like
+# allkeys-lru, allkeys-lfu, and volatile-ttl policies. A read miss stores the
+# value in the cache, as the application would do after fetching it from the
+# database. Sizes are printed for the full traffic, i.e. simulated sizes
+# divided by the sampling rate.
+
+use 5.010;
+use strict;
+use warnings;
+use Getopt::Long;
+
+my ( $policies, $points, $sizes, $overhead, $samples, $target ) = ( 'lru,lfu,ttl', 20, undef, 64, 5 );
+GetOptions(
+    "policies=s" => \$policies,
+    "points=i"   => \$points,
+    "sizes=s"    => \$sizes,
+    "overhead=i" => \$overhead,
+    "samples=i"  => \$samples,
+    "target=f"   => \$target,
+  )
+  or die "Usage: $0 [--policies lru,lfu,ttl] [--points N] [--sizes SIZE,...] [--overhead BYTES]"
+  . " [--samples N] [--target HIT_RATE] FILE...\n";
+die "Sample file is not specified\n" unless @ARGV;
+my @policies = split /,/, $policies;
+/^(?:lru|lfu|ttl)$/ or die "Unknown policy $_\n" for @policies;
+
+my ( $rate, @events );
+for my $file (@ARGV) {
+    open my $fh, '<', $file or die "Couldn't open $file: $!";
+    while (<$fh>) {
+        if (/^# RedisDB key sample rate=(\S+)/) {
+            die "Samples were recorded with different rates\n" if defined $rate and $rate != $1;
+            $rate = $1;
+            next;
+        }
+        next if /^#/;
+        my @event = split;
+        next unless @event == 6;
+        $event[0] *= 1000;
+        push @events, \@event;
+    }
+}
+die "The sample is empty\n" unless @events;
+$rate ||= 1;
+
+# samples from many processes are merged by time
+@events = sort { $a->[0] <=> $b->[0] } @events if @ARGV > 1;
+
+# the largest size every key had, their sum is the size of the cache that
+# never evicts
+my ( %largest, %current );
+my $reads = 0;
+for (@events) {
+    my ( $op, $id, $klen, $size ) = @$_[ 1 .. 4 ];
+    $reads++ if $op eq 'r';
+    if    ( $op eq 'a' ) { $current{$id} += $size }
+    elsif ( $size > 0 )  { $current{$id} = $size }
+    my $bytes = $klen + ( $current{$id} || 0 ) + $overhead;
+    $largest{$id} = $bytes if not $largest{$id} or $bytes > $largest{$id};
+}
+my $working_set = 0;
+$working_set += $_ for values %largest;
+
+my @capacities;
+if ($sizes) {
+    @capacities = map { parse_size($_) * $rate } split /,/, $sizes;
+}
+else {
+    @capacities = map { $working_set * 0.01**( 1 - $_ / ( $points - 1 ) ) } 0 .. $points - 1;
+}
+
+printf "Events: %d, reads: %d, keys: %d, sampling rate: %s\n", scalar @events, $reads, scalar keys %largest,
+  $rate;
+printf "Size of all keys: %s\n\n", human( $working_set / $rate );
+printf "%-12s" . ( " %8s" x @policies ) . "\n", 'size', @policies;
+
+my %needed;
+for my $capacity (@capacities) {
+    my @ratios;
+    for my $policy (@policies) {
+        my $miss = simulate( $policy, $capacity );
+        push @ratios, $miss;
+        $needed{$policy} //= $capacity if defined $target and 1 - $miss >= $target;
+    }
+    printf "%-12s" . ( " %8.4f" x @ratios ) . "\n", human( $capacity / $rate ), @ratios;
+}
+say "\nMiss ratio is the fraction of reads that didn't find the key in the cache.";
+
+if ( defined $target ) {
+    say "";
+    for (@policies) {
+        if ( defined $needed{$_} ) {
+            printf "%s: %s for %.1f%% hit rate\n", $_, human( $needed{$_} / $rate ), 100 * $target;
+        }
+        else {
+            printf "%s: %.1f%% hit rate is not reached\n", $_, 100 * $target;
+        }
+    }
+}
+
+# replay the events through the cache of the given size using the eviction
+# policy, return the miss ratio
+sub simulate {
+    my ( $policy, $capacity ) = @_;
+    srand 1;
+    my ( %size, %known, %known_ttl, %expire, %access, %counter, %decayed, @keys, %index, @volatile, %vindex );
+    my ( $used, $reads, $hits ) = ( 0, 0, 0 );
+
+    my $unexpire = sub {
+        my $id = shift;
+        delete $expire{$id};
+        my $i = delete $vindex{$id};
+        return unless defined $i;
+        my $last = pop @volatile;
+        if ( $i < @volatile ) {
+            $volatile[$i] = $last;
+            $vindex{$last} = $i;
+        }
+    };
+    my $remove = sub {
+        my $id = shift;
+        return unless exists $size{$id};
+        $used -= delete $size{$id};
+        $unexpire->($id);
+        delete $_->{$id} for \%access, \%counter, \%decayed;
+        my $i    = delete $index{$id};
+        my $last = pop @keys;
+        if ( $i < @keys ) {
+            $keys[$i] = $last;
+            $index{$last} = $i;
+        }
+    };
+
+    # logarithmic counter that decrements every minute, as in redis
+    my $lfu = sub {
+        my ( $id, $t ) = @_;
+        my $value = $counter{$id} - int( ( $t - $decayed{$id} ) / 60000 );
+        return $value > 0 ? $value : 0;
+    };
+    my $touch = sub {
+        my ( $id, $t ) = @_;
+        my $value = $lfu->( $id, $t );
+        my $base  = $value > 5 ? $value - 5 : 0;
+        $value++ if $value < 255 and rand() < 1 / ( $base * 10 + 1 );
+        $counter{$id} = $value;
+        $decayed{$id} = $access{$id} = $t;
+    };
+    my $store = sub {
+        my ( $id, $bytes, $t ) = @_;
+        if ( exists $size{$id} ) {
+            $used += $bytes - $size{$id};
+        }
+        else {
+            $used += $bytes;
+            $index{$id} = @keys;
+            push @keys, $id;
+            $counter{$id} = 5;
+            $decayed{$id} = $t;
+        }
+        $size{$id} = $bytes;
+        $touch->( $id, $t );
+    };
+    my $set_expire = sub {
+        my ( $id, $at ) = @_;
+        $expire{$id} = $at;
+        return if exists $vindex{$id};
+        $vindex{$id} = @volatile;
+        push @volatile, $id;
+    };
+    my $evict = sub {
+        my $t = shift;
+        my $pool = $policy eq 'ttl' ? \@volatile : \@keys;
+        return unless @$pool;
+        my ( $victim, $best );
+        for ( 1 .. $samples ) {
+            my $id = $pool->[ rand @$pool ];
+            my $score =
+                $policy eq 'lru' ? $access{$id}
+              : $policy eq 'lfu' ? $lfu->( $id, $t ) * 1e13 + $access{$id}
+              :                    $expire{$id};
+            ( $victim, $best ) = ( $id, $score ) if not defined $best or $score < $best;
+        }
+        $remove->($victim);
+        return 1;
+    };
+
+    for (@events) {
+        my ( $t, $op, $id, $klen, $size, $ttl ) = @$_;
+        $remove->($id) if exists $expire{$id} and $expire{$id} <= $t;
+        if ( $op eq 'r' ) {
+            $reads++;
+            $known{$id} = $size if $size;
+            if ( exists $size{$id} ) {
+                $hits++;
+                $touch->( $id, $t );
+                if ($size) {
+                    $used += $klen + $size + $overhead - $size{$id};
+                    $size{$id} = $klen + $size + $overhead;
+                }
+            }
+            else {
+                $store->( $id, $klen + ( $known{$id} || 0 ) + $overhead, $t );
+                $set_expire->( $id, $t + $known_ttl{$id} ) if $known_ttl{$id};
+            }
+        }
+        elsif ( $op eq 'w' or $op eq 'a' ) {
+            $known{$id} = $op eq 'a' ? ( $known{$id} || 0 ) + $size : $size;
+            $store->( $id, $klen + $known{$id} + $overhead, $t );
+            if ( $op eq 'w' ) {
+                $known_ttl{$id} = $ttl;
+                $ttl ? $set_expire->( $id, $t + $ttl ) : $unexpire->($id);
+            }
+        }
+        elsif ( $op eq 'd' ) {
+            $remove->($id);
+            delete $known{$id};
+        }
+        elsif ( $op eq 'e' ) {
+            $known_ttl{$id} = $ttl;
+            $set_expire->( $id, $t + $ttl ) if exists $size{$id};
+        }
+        while ( $used > $capacity ) {
+            last unless $evict->($t);
+        }
+
+        # nothing can be evicted, the write is rejected
+        $remove->($id) if $used > $capacity;
+    }
+    return $reads ? 1 - $hits / $reads : 0;
+}
+
+sub parse_size {
+    my $size = shift;
+    my ( $num, $unit ) = $size =~ /^([0-9.]+)([KMGT]?)B?$/i or die "Invalid size $size\n";
+    return $num * 1024**( index( 'KMGT', uc $unit ) + 1 ) if $unit;
+    return $num;
+}
+
+sub human {
+    my $bytes = shift;
+    for my $unit ( '', qw(K M G) ) {
+        return sprintf( "%.1f%s", $bytes, $unit ) if $bytes < 1024;
+        $bytes /= 1024;
+    }
+    return sprintf "%.1fT", $bytes;
+}
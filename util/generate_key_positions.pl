@@ -15,9 +15,9 @@ my %commands;
 for (@$commands) {
     my ($cmd, $arity, $flags, $first_key, $last_key, $step_key) = @$_;
     next unless $first_key;
-    $commands{$cmd} = $first_key;
+    $commands{$cmd} = "[ $first_key, $last_key, $step_key ]";
 }
 
 for (sort keys %commands) {
-    say "    $_ => $commands{$_}";
+    say "    $_ => $commands{$_},";
 }
@@ -0,0 +1,123 @@
+#!/usr/bin/perl
+
+# Analyse RDB file, e.g. a backup, without loading it into the server.
+#
+#   rdb_report.pl [--separator :] [--depth 1] [--top 20] [--db N] dump.rdb
+#   rdb_report.pl --resp commands.resp dump.rdb
+#   redis-cli --pipe < commands.resp
+#
+# Reports the number of keys, their size in the file, element counts and
+# encodings grouped by key prefix, distribution of TTLs, and the biggest keys.
+
+use 5.010;
+use strict;
+use warnings;
+use Getopt::Long;
+use RedisDB::RDB;
+
+my ( $separator, $depth, $top, $db, $resp ) = ( ':', 1, 20 );
+GetOptions(
+    "separator=s" => \$separator,
+    "depth=i"     => \$depth,
+    "top=i"       => \$top,
+    "db=i"        => \$db,
+    "resp=s"      => \$resp,
+) or die "Usage: $0 [--separator STR] [--depth N] [--top N] [--db N] [--resp FILE] FILE\n";
+my $file = shift or die "RDB file is not specified\n";
+
+my $resp_fh;
+if ($resp) {
+    open $resp_fh, '>', $resp or die "Couldn't open $resp: $!";
+    binmode $resp_fh;
+}
+
+my $rdb = RedisDB::RDB->new( file => $file, values => $resp ? 1 : 0 );
+my ( %prefix, %ttl, @biggest, %total, $now, $selected );
+
+# elements of collections are written as soon as they are read, so big keys
+# are not kept in memory
+my $write_chunk = $resp_fh && sub {
+    my ( $key, $chunk ) = @_;
+    return if defined $db and $key->{db} != $db;
+    write_resp( $key, RedisDB::RDB::chunk_commands( $key, $chunk ) );
+};
+my @ttl_buckets = ( [ '< 1m' => 60 ], [ '< 1h' => 3600 ], [ '< 1d' => 86400 ], [ '< 1w' => 7 * 86400 ] );
+
+while ( my $key = $rdb->next_key($write_chunk) ) {
+    next if defined $db and $key->{db} != $db;
+
+    # TTLs are relative to the time the file was created
+    $now //= 1000 * ( $rdb->aux->{ctime} || time );
+
+    my @parts = split /\Q$separator\E/, $key->{key}, $depth + 1;
+    my $name = @parts > $depth ? join( $separator, @parts[ 0 .. $depth - 1 ] ) . $separator . '*' : '(no prefix)';
+    my $stats = $prefix{$name} ||= { keys => 0, size => 0, elements => 0, encodings => {} };
+    $stats->{keys}++;
+    $stats->{size}     += $key->{size};
+    $stats->{elements} += $key->{elements} || 0;
+    $stats->{encodings}{"$key->{type}/$key->{encoding}"}++;
+    $total{keys}++;
+    $total{size} += $key->{size};
+
+    my $bucket = 'no ttl';
+    if ( defined $key->{expire} ) {
+        my $left = ( $key->{expire} - $now ) / 1000;
+        $bucket = $left <= 0 ? 'expired' : '>= 1w';
+        for (@ttl_buckets) {
+            if ( $left > 0 and $left < $_->[1] ) {
+                $bucket = $_->[0];
+                last;
+            }
+        }
+    }
+    $ttl{$bucket}++;
+
+    # keep only the top N keys, so memory doesn't depend on the dataset
+    if ( @biggest < $top or $key->{size} > $biggest[-1]{size} ) {
+        push @biggest, { map { $_ => $key->{$_} } qw(db key type encoding size elements) };
+        @biggest = sort { $b->{size} <=> $a->{size} } @biggest;
+        pop @biggest if @biggest > $top;
+    }
+
+    write_resp( $key, RedisDB::RDB::commands($key) ) if $resp_fh;
+}
+
+if ($resp_fh) {
+    close $resp_fh or die "Couldn't write $resp: $!";
+}
+
+say "RDB version: ", $rdb->version;
+say "$_: ", $rdb->aux->{$_} for sort keys %{ $rdb->aux };
+say "Keys: ", $total{keys} || 0, ", size: ", $total{size} || 0;
+
+say "\nBy prefix:";
+printf "%-40s %10s %12s %12s  %s\n", qw(prefix keys bytes elements encodings);
+for my $name ( sort { $prefix{$b}{size} <=> $prefix{$a}{size} } keys %prefix ) {
+    my $stats = $prefix{$name};
+    printf "%-40s %10d %12d %12d  %s\n", $name, @$stats{qw(keys size elements)},
+      join( ' ', map { "$_:$stats->{encodings}{$_}" } sort keys %{ $stats->{encodings} } );
+}
+
+say "\nTTL:";
+printf "%-10s %10d\n", $_, $ttl{$_} for grep { $ttl{$_} } 'no ttl', 'expired', map( { $_->[0] } @ttl_buckets ), '>= 1w';
+
+say "\nBiggest keys:";
+printf "%-40s %3s %-18s %12s %10s\n", qw(key db type bytes elements);
+for (@biggest) {
+    printf "%-40s %3d %-18s %12d %10s\n", $_->{key}, $_->{db}, "$_->{type}/$_->{encoding}", $_->{size},
+      $_->{elements} // '-';
+}
+
+sub write_resp {
+    my ( $key, @commands ) = @_;
+    if ( not defined $selected or $selected != $key->{db} ) {
+        print $resp_fh to_resp( SELECT => $key->{db} );
+        $selected = $key->{db};
+    }
+    print $resp_fh to_resp(@$_) for @commands;
+    return;
+}
+
+sub to_resp {
+    return join '', '*' . @_ . "\r\n", map { '$' . length($_) . "\r\n$_\r\n" } @_;
+}